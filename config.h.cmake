@@ -13,6 +13,9 @@
 #cmakedefine HAVE_STRNCASECMP		1
 #cmakedefine HAVE_REALLOCARRAY		1
 
+/* Optional libraries. */
+#cmakedefine HAVE_ZLIB			1
+
 
 /*--------------------------------------------------------------------*/
 /* Package information. */
@@ -27,6 +30,7 @@
 
 
 #define DB_FILE_DEF		"@SHARE_DIR@/minipro_db.ini"
+#define BENCH_DB_FILE_DEF	"@CMAKE_SOURCE_DIR@/minipro_db.ini" /* Shipped. */
 
 
 #endif /* __CONFIG_H_IN__ */
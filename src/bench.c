@@ -0,0 +1,363 @@
+#include <sys/param.h>
+#include <sys/types.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+
+#include "utils/macro.h"
+#include "minipro.h"
+#include "minipro_int.h"
+#include "progress.h"
+#include "config.h"
+
+
+#define BENCH_REPEATS		7	/* Median of runs is reported. */
+#define BENCH_CHIPS_SAMPLE	64	/* Chips for lookups, even spread. */
+#define BENCH_CMP_SIZE		(64 * 1024)
+
+
+typedef struct bench_ctx_s {
+	const char	*db_file_name;
+	chip_p		chips_db;
+	size_t		chips_db_count;
+	chip_p		sample[BENCH_CHIPS_SAMPLE];
+	size_t		sample_count;
+	chip_p		id_sample[BENCH_CHIPS_SAMPLE];
+	size_t		id_sample_count;
+	chip_p		fuse_chip;
+	uint8_t		*fuse_buf;
+	size_t		fuse_buf_size;
+	uint8_t		*cmp_buf1;
+	uint8_t		*cmp_buf2;
+	uint8_t		*cmp_mask;
+	progress_p	progress;
+	volatile size_t	sink;	/* Keep results alive. */
+} bench_ctx_t, *bench_ctx_p;
+
+typedef int (*bench_fn)(bench_ctx_p ctx, size_t iters);
+
+typedef struct bench_s {
+	const char	*name;
+	bench_fn	fn;
+	size_t		iters;	/* Per run. */
+	size_t		bytes;	/* Per iteration, for throughput. */
+} bench_t, *bench_p;
+
+
+static uint64_t
+bench_time_ns(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ((((uint64_t)ts.tv_sec) * 1000000000) +
+	    (uint64_t)ts.tv_nsec);
+}
+
+static int
+bench_u64_cmp(const void *a, const void *b) {
+	const uint64_t *x = a, *y = b;
+
+	return (((*x) > (*y)) - ((*x) < (*y)));
+}
+
+
+static int
+bench_db_load(bench_ctx_p ctx, size_t iters) {
+	int error;
+	size_t i, count;
+	chip_p chips_db;
+
+	for (i = 0; i < iters; i ++) {
+		error = chip_db_load(ctx->db_file_name, 0, &chips_db, &count);
+		if (0 != error)
+			return (error);
+		ctx->sink += count;
+		chip_db_free(chips_db);
+	}
+
+	return (0);
+}
+
+static int
+bench_db_get_by_name(bench_ctx_p ctx, size_t iters) {
+	size_t i;
+
+	for (i = 0; i < iters; i ++) {
+		ctx->sink += (size_t)chip_db_get_by_name(ctx->chips_db,
+		    ctx->sample[(i % ctx->sample_count)]->name);
+	}
+
+	return (0);
+}
+
+static int
+bench_db_get_by_id(bench_ctx_p ctx, size_t iters) {
+	size_t i;
+	chip_p chip;
+
+	if (0 == ctx->id_sample_count)
+		return (ENOENT);
+	for (i = 0; i < iters; i ++) {
+		chip = ctx->id_sample[(i % ctx->id_sample_count)];
+		ctx->sink += (size_t)chip_db_get_by_id(ctx->chips_db,
+		    chip->chip_id, chip->chip_id_size);
+	}
+
+	return (0);
+}
+
+/* Equal blocks: verify common case, whole buffer compared. */
+static int
+bench_verify_cmp(bench_ctx_p ctx, size_t iters) {
+	size_t i;
+
+	for (i = 0; i < iters; i ++) {
+		ctx->sink += mp_memcmp_idx(ctx->cmp_buf1, ctx->cmp_buf2,
+		    BENCH_CMP_SIZE);
+	}
+
+	return (0);
+}
+
+/* Mismatch in last byte: index search after memcmp(). */
+static int
+bench_verify_cmp_diff(bench_ctx_p ctx, size_t iters) {
+	size_t i;
+
+	ctx->cmp_buf2[(BENCH_CMP_SIZE - 1)] ^= 0xff;
+	for (i = 0; i < iters; i ++) {
+		ctx->sink += mp_memcmp_idx(ctx->cmp_buf1, ctx->cmp_buf2,
+		    BENCH_CMP_SIZE);
+	}
+	ctx->cmp_buf2[(BENCH_CMP_SIZE - 1)] ^= 0xff;
+
+	return (0);
+}
+
+/* Equal blocks under verify mask. */
+static int
+bench_verify_cmp_mask(bench_ctx_p ctx, size_t iters) {
+	size_t i;
+
+	for (i = 0; i < iters; i ++) {
+		ctx->sink += mp_memcmp_mask_idx(ctx->cmp_buf1, ctx->cmp_buf2,
+		    ctx->cmp_mask, BENCH_CMP_SIZE);
+	}
+
+	return (0);
+}
+
+/* All fuses of chip, as minipro_fuses_verify() does. */
+static int
+bench_fuse_parse(bench_ctx_p ctx, size_t iters) {
+	int error;
+	size_t i, j, count;
+	uint32_t val;
+	fuse_decl_p fuses;
+
+	if (NULL == ctx->fuse_chip)
+		return (ENOENT);
+	fuses = ctx->fuse_chip->fuses;
+	count = fuses[0].size;
+	for (i = 0; i < iters; i ++) {
+		for (j = 1; j < count; j ++) {
+			error = mp_buf_get_named_line_val32(ctx->fuse_buf,
+			    ctx->fuse_buf_size, fuses[j].name,
+			    strlen(fuses[j].name), &val);
+			if (0 != error)
+				return (error);
+			ctx->sink += val;
+		}
+	}
+
+	return (0);
+}
+
+static int
+bench_hdr_gen(bench_ctx_p ctx, size_t iters) {
+	size_t i;
+	uint8_t hdr[16]; /* Handle msg_hdr size. */
+
+	for (i = 0; i < iters; i ++) {
+		mp_msg_chip_hdr_gen(ctx->sample[(i % ctx->sample_count)], 0,
+		    hdr, sizeof(hdr));
+		ctx->sink += hdr[1];
+	}
+
+	return (0);
+}
+
+/* Per block callback: progress_cb() -> progress_update() fast path. */
+static int
+bench_progress_cb(bench_ctx_p ctx, size_t iters) {
+	size_t i;
+	static const char *msg = "Bench... ";
+
+	for (i = 0; i < iters; i ++) {
+		progress_update(ctx->progress, msg, i, (iters + 1));
+	}
+	progress_update(ctx->progress, msg, (iters + 1), (iters + 1));
+
+	return (0);
+}
+
+static const bench_t benches[] = {
+	{ "chip_db_load",		bench_db_load,		4,	0 },
+	{ "chip_db_get_by_name",	bench_db_get_by_name,	4096,	0 },
+	{ "chip_db_get_by_id",		bench_db_get_by_id,	4096,	0 },
+	{ "verify_cmp_64k",		bench_verify_cmp,	256,
+	    BENCH_CMP_SIZE },
+	{ "verify_cmp_64k_diff",	bench_verify_cmp_diff,	256,
+	    BENCH_CMP_SIZE },
+	{ "verify_cmp_64k_mask",	bench_verify_cmp_mask,	256,
+	    BENCH_CMP_SIZE },
+	{ "fuse_parse",			bench_fuse_parse,	4096,	0 },
+	{ "chip_hdr_gen",		bench_hdr_gen,		65536,	0 },
+	{ "progress_cb",		bench_progress_cb,	1048576, 0 },
+};
+
+
+static int
+bench_ctx_init(bench_ctx_p ctx) {
+	int error;
+	size_t i, j, step, off;
+	chip_p chip;
+	fuse_decl_p fuses;
+
+	error = chip_db_load(ctx->db_file_name, 0, &ctx->chips_db,
+	    &ctx->chips_db_count);
+	if (0 != error) {
+		fprintf(stderr, "Fail on chips DB load: %s: %i - %s\n",
+		    ctx->db_file_name, error, strerror(error));
+		return (error);
+	}
+	if (0 == ctx->chips_db_count)
+		return (ENOENT);
+	/* Fixed, even spread sample: reproducible between runs. */
+	step = MAX((ctx->chips_db_count / BENCH_CHIPS_SAMPLE), 1);
+	for (i = 0; i < ctx->chips_db_count &&
+	    BENCH_CHIPS_SAMPLE > ctx->sample_count; i += step) {
+		ctx->sample[ctx->sample_count ++] = &ctx->chips_db[i];
+	}
+	for (i = 0, chip = ctx->chips_db; NULL != chip->name; chip ++, i ++) {
+		if (0 == (i % step) &&
+		    0 != (CHIP_OPT4_CHIP_ID & chip->opts4) &&
+		    BENCH_CHIPS_SAMPLE > ctx->id_sample_count) {
+			ctx->id_sample[ctx->id_sample_count ++] = chip;
+		}
+		if (NULL != chip->fuses &&
+		    (NULL == ctx->fuse_chip ||
+		     ctx->fuse_chip->fuses[0].size < chip->fuses[0].size)) {
+			ctx->fuse_chip = chip;
+		}
+	}
+	/* Fuses file as written by read action. */
+	if (NULL != ctx->fuse_chip) {
+		fuses = ctx->fuse_chip->fuses;
+		ctx->fuse_buf = malloc(MP_FUSES_BUF_SIZE_MAX);
+		if (NULL == ctx->fuse_buf)
+			return (ENOMEM);
+		for (j = 1, off = 0; j < fuses[0].size; j ++) {
+			off += (size_t)snprintf((char*)(ctx->fuse_buf + off),
+			    (MP_FUSES_BUF_SIZE_MAX - off), "%s = 0x%02zx\n",
+			    fuses[j].name, j);
+			if (MP_FUSES_BUF_SIZE_MAX <= off)
+				return (EOVERFLOW);
+		}
+		ctx->fuse_buf_size = off;
+	}
+	ctx->cmp_buf1 = malloc(BENCH_CMP_SIZE);
+	ctx->cmp_buf2 = malloc(BENCH_CMP_SIZE);
+	ctx->cmp_mask = malloc(BENCH_CMP_SIZE);
+	if (NULL == ctx->cmp_buf1 || NULL == ctx->cmp_buf2 ||
+	    NULL == ctx->cmp_mask)
+		return (ENOMEM);
+	for (i = 0; i < BENCH_CMP_SIZE; i ++) {
+		ctx->cmp_buf1[i] = (uint8_t)((i * 31) + 7);
+	}
+	memcpy(ctx->cmp_buf2, ctx->cmp_buf1, BENCH_CMP_SIZE);
+	/* Serial number like don't care holes. */
+	memset(ctx->cmp_mask, 0xff, BENCH_CMP_SIZE);
+	for (i = 0; i < BENCH_CMP_SIZE; i += 4096) {
+		memset((ctx->cmp_mask + i), 0x00, 16);
+	}
+
+	return (progress_create(PROGRESS_F_NO_TEXT, -1, &ctx->progress));
+}
+
+static void
+bench_ctx_free(bench_ctx_p ctx) {
+
+	progress_destroy(ctx->progress);
+	free(ctx->cmp_buf1);
+	free(ctx->cmp_buf2);
+	free(ctx->cmp_mask);
+	free(ctx->fuse_buf);
+	chip_db_free(ctx->chips_db);
+}
+
+
+int
+main(int argc, char **argv) {
+	int error, first = 1;
+	size_t i, r;
+	uint64_t tm, ns[BENCH_REPEATS];
+	bench_ctx_t ctx;
+
+	if (2 < argc ||
+	    (2 == argc && '-' == argv[1][0])) {
+		fprintf(stderr, "Usage: %s [chips_db_file]\n"
+		    "Default DB: "BENCH_DB_FILE_DEF"\n"
+		    "Results printed to stdout as JSON.\n", argv[0]);
+		return (EINVAL);
+	}
+	memset(&ctx, 0x00, sizeof(ctx));
+	ctx.db_file_name = ((2 == argc) ? argv[1] : BENCH_DB_FILE_DEF);
+	error = bench_ctx_init(&ctx);
+	if (0 != error)
+		goto err_out;
+
+	printf("{\"package\":\"%s\",\"db\":\"%s\",\"chips\":%zu,"
+	    "\"repeats\":%i,\"results\":[",
+	    PACKAGE_STRING, ctx.db_file_name, ctx.chips_db_count,
+	    BENCH_REPEATS);
+	for (i = 0; i < SIZEOF(benches); i ++) {
+		/* Warmup: caches, page faults. */
+		error = benches[i].fn(&ctx, benches[i].iters);
+		if (0 != error) {
+			fprintf(stderr, "%s: skipped: %i - %s\n",
+			    benches[i].name, error, strerror(error));
+			error = 0;
+			continue;
+		}
+		for (r = 0; r < BENCH_REPEATS; r ++) {
+			tm = bench_time_ns();
+			benches[i].fn(&ctx, benches[i].iters);
+			ns[r] = (bench_time_ns() - tm);
+		}
+		qsort(ns, BENCH_REPEATS, sizeof(uint64_t), bench_u64_cmp);
+		tm = ns[(BENCH_REPEATS / 2)];
+		printf("%s\n{\"name\":\"%s\",\"iters\":%zu,"
+		    "\"ns_per_op\":%"PRIu64",\"min_ns_per_op\":%"PRIu64","
+		    "\"max_ns_per_op\":%"PRIu64",\"bytes_per_s\":%"PRIu64"}",
+		    ((0 != first) ? "" : ","), benches[i].name,
+		    benches[i].iters,
+		    (tm / benches[i].iters),
+		    (ns[0] / benches[i].iters),
+		    (ns[(BENCH_REPEATS - 1)] / benches[i].iters),
+		    ((0 != benches[i].bytes) ?
+		    ((((uint64_t)benches[i].bytes * benches[i].iters) *
+		    1000000000) / MAX(tm, 1)) : 0));
+		first = 0;
+	}
+	printf("\n]}\n");
+
+err_out:
+	bench_ctx_free(&ctx);
+
+	return (error);
+}
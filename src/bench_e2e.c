@@ -0,0 +1,624 @@
+#include <sys/param.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "utils/macro.h"
+#include "utils/sys.h"
+#include "minipro.h"
+#include "database.h"
+#include "sim.h"
+#include "config.h"
+
+
+#define E2E_CMD_LAT_US_DEF	20	/* Device time per command. */
+#define E2E_BYTE_NS_DEF		100	/* Device time per payload byte. */
+#define E2E_SIZE_MAX_DEF	(256 * 1024)
+#define E2E_CASES_MAX_DEF	12	/* Chips. */
+#define E2E_THRESHOLD_DEF	10	/* %, allowed regression. */
+#define E2E_BASELINE_SIZE_MAX	(16 * 1024 * 1024)
+#define E2E_THREADS_MAX		64
+#define E2E_USB_ITERS		1000	/* Version requests per device. */
+
+#define E2E_OP_ERASE		0
+#define E2E_OP_WRITE		1
+#define E2E_OP_READ		2
+#define E2E_OP_VERIFY		3
+#define E2E_OP__COUNT__		4
+static const char *e2e_op_str[] = {
+	"erase",
+	"write",
+	"read",
+	"verify",
+	NULL
+};
+
+
+typedef struct e2e_opts_s {
+	const char	*db_file_name;
+	uint32_t	cmd_lat_us;
+	uint32_t	byte_ns;
+	size_t		size_max;
+	size_t		cases_max;
+	const char	*baseline_file_name;
+	uint32_t	threshold;
+	size_t		threads;
+	size_t		usb_devs;	/* Real programmers on shared ctx. */
+} e2e_opts_t, *e2e_opts_p;
+
+/* Concurrent pass: every thread owns its sim and handle. */
+typedef struct e2e_thr_s {
+	pthread_t	thread;
+	e2e_opts_p	opts;
+	chip_p		*cases;
+	size_t		count;
+	size_t		idx;		/* Thread number. */
+	size_t		bytes;
+	int		error;
+	minipro_p	mp;		/* USB pass: opened handle. */
+	size_t		round_trips;	/* USB pass. */
+} e2e_thr_t, *e2e_thr_p;
+
+typedef struct e2e_res_s {
+	size_t		bytes;
+	uint64_t	wall_us;
+	uint64_t	cpu_us;
+	size_t		round_trips;	/* Commands sent to device. */
+	double		bytes_per_s;
+	double		rt_per_kib;
+	double		cpu_us_per_kib;
+} e2e_res_t, *e2e_res_p;
+
+
+static uint64_t
+e2e_time_us(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ((((uint64_t)ts.tv_sec) * 1000000) +
+	    (((uint64_t)ts.tv_nsec) / 1000));
+}
+
+static uint64_t
+e2e_cpu_us(void) {
+	struct rusage ru;
+
+	if (0 != getrusage(RUSAGE_SELF, &ru))
+		return (0);
+
+	return ((((uint64_t)ru.ru_utime.tv_sec) * 1000000) +
+	    (uint64_t)ru.ru_utime.tv_usec +
+	    (((uint64_t)ru.ru_stime.tv_sec) * 1000000) +
+	    (uint64_t)ru.ru_stime.tv_usec);
+}
+
+/* Chips with distinct code size / read and write block sizes. */
+static int
+e2e_case_is_new(chip_p *cases, size_t count, chip_p chip) {
+	size_t i;
+
+	for (i = 0; i < count; i ++) {
+		if (cases[i]->code_memory_size == chip->code_memory_size &&
+		    cases[i]->read_block_size == chip->read_block_size &&
+		    cases[i]->write_block_size == chip->write_block_size)
+			return (0);
+	}
+
+	return (1);
+}
+
+static int
+e2e_op_run(minipro_p mp, sim_p sim, int op, const uint8_t *pattern,
+    size_t size, e2e_res_p res) {
+	int error;
+	uint8_t *buf = NULL;
+	size_t buf_size, err_offset;
+	uint32_t buf_val, chip_val;
+	uint64_t wall, cpu;
+	sim_stats_t stats;
+
+	sim_stats_reset(sim);
+	wall = e2e_time_us();
+	cpu = e2e_cpu_us();
+	switch (op) {
+	case E2E_OP_ERASE:
+		error = minipro_erase(mp);
+		break;
+	case E2E_OP_WRITE:
+		error = minipro_page_write(mp, (MP_PAGE_WR_F_NO_ERASE |
+		    MP_PAGE_WR_F_PRE_NO_UNPROTECT |
+		    MP_PAGE_WR_F_POST_NO_PROTECT),
+		    MP_CHIP_PAGE_CODE, 0, pattern, size, NULL, NULL);
+		break;
+	case E2E_OP_READ:
+		error = minipro_page_read(mp, MP_CHIP_PAGE_CODE, 0, size,
+		    &buf, &buf_size, NULL, NULL);
+		if (0 == error &&
+		    0 != memcmp(pattern, buf, size)) {
+			error = EBADMSG;
+		}
+		free(buf);
+		break;
+	case E2E_OP_VERIFY:
+		error = minipro_page_verify(mp, MP_CHIP_PAGE_CODE, 0,
+		    pattern, size, &err_offset, &buf_val, &chip_val,
+		    NULL, NULL);
+		if (0 == error && size != err_offset) {
+			error = EBADMSG;
+		}
+		break;
+	default:
+		return (EINVAL);
+	}
+	res->cpu_us = (e2e_cpu_us() - cpu);
+	res->wall_us = (e2e_time_us() - wall);
+	if (0 != error)
+		return (error);
+	sim_stats_get(sim, &stats);
+	res->bytes = size;
+	res->round_trips = stats.cmds;
+	res->bytes_per_s = (((double)size * 1000000.0) /
+	    (double)MAX(res->wall_us, 1));
+	res->rt_per_kib = (((double)stats.cmds * 1024.0) / (double)size);
+	res->cpu_us_per_kib = (((double)res->cpu_us * 1024.0) /
+	    (double)size);
+
+	return (0);
+}
+
+/* Find "name":<number> in case line of previous run output. */
+static int
+e2e_baseline_get(const uint8_t *bl, size_t bl_size, const char *key,
+    const char *name, double *val) {
+	char str[256];
+	const uint8_t *line, *end, *ptr;
+
+	if (NULL == bl)
+		return (ENOENT);
+	snprintf(str, sizeof(str), "\"case\":\"%s\"", key);
+	line = memmem(bl, bl_size, str, strlen(str));
+	if (NULL == line)
+		return (ENOENT);
+	end = memchr(line, '\n', (size_t)((bl + bl_size) - line));
+	if (NULL == end) {
+		end = (bl + bl_size);
+	}
+	snprintf(str, sizeof(str), "\"%s\":", name);
+	ptr = memmem(line, (size_t)(end - line), str, strlen(str));
+	if (NULL == ptr)
+		return (ENOENT);
+	(*val) = strtod((const char*)(ptr + strlen(str)), NULL);
+
+	return (0);
+}
+
+static int
+e2e_chip_run(e2e_opts_p opts, chip_p chip, const uint8_t *bl,
+    size_t bl_size, int *first, size_t *regressions) {
+	int error, op;
+	uint8_t *pattern;
+	size_t i, size;
+	double base, thr;
+	char key[CHIP_NAME_MAX + 16];
+	sim_p sim = NULL;
+	minipro_p mp = NULL;
+	e2e_res_t res;
+
+	size = chip->code_memory_size;
+	pattern = malloc(size);
+	if (NULL == pattern)
+		return (ENOMEM);
+	for (i = 0; i < size; i ++) { /* Fixed, not erased state. */
+		pattern[i] = (uint8_t)((i * 13) ^ (i >> 8));
+	}
+	error = sim_create(chip, opts->cmd_lat_us, opts->byte_ns, &sim);
+	if (0 != error)
+		goto err_out;
+	error = minipro_open_transfer(sim_transfer, sim, 0, &mp);
+	if (0 != error)
+		goto err_out;
+	error = minipro_chip_set(mp, chip, 0);
+	if (0 != error)
+		goto err_out;
+
+	thr = ((double)opts->threshold / 100.0);
+	for (op = 0; E2E_OP__COUNT__ > op; op ++) {
+		if (E2E_OP_ERASE == op &&
+		    0 == (CHIP_OPT4_ERASE & chip->opts4))
+			continue;
+		memset(&res, 0x00, sizeof(res));
+		error = e2e_op_run(mp, sim, op, pattern, size, &res);
+		if (0 != error) {
+			fprintf(stderr, "%s: %s: error %i - %s\n",
+			    chip->name, e2e_op_str[op], error,
+			    strerror(error));
+			goto err_out;
+		}
+		snprintf(key, sizeof(key), "%s/%s", chip->name,
+		    e2e_op_str[op]);
+		printf("%s\n{\"case\":\"%s\",\"size\":%zu,"
+		    "\"read_block_size\":%"PRIu32","
+		    "\"write_block_size\":%"PRIu32",\"wall_us\":%"PRIu64","
+		    "\"round_trips\":%zu,\"bytes_per_s\":%.0f,"
+		    "\"rt_per_kib\":%.3f,\"cpu_us_per_kib\":%.3f}",
+		    ((0 != (*first)) ? "" : ","), key, size,
+		    chip->read_block_size, chip->write_block_size,
+		    res.wall_us, res.round_trips, res.bytes_per_s,
+		    res.rt_per_kib, res.cpu_us_per_kib);
+		(*first) = 0;
+		/* CPU time is too noisy: reported only. */
+		if (0 == e2e_baseline_get(bl, bl_size, key, "bytes_per_s",
+		    &base) &&
+		    res.bytes_per_s < (base * (1.0 - thr))) {
+			fprintf(stderr, "REGRESSION: %s: bytes_per_s: "
+			    "%.0f, baseline: %.0f\n",
+			    key, res.bytes_per_s, base);
+			(*regressions) ++;
+		}
+		if (0 == e2e_baseline_get(bl, bl_size, key, "rt_per_kib",
+		    &base) &&
+		    res.rt_per_kib > (base * (1.0 + thr))) {
+			fprintf(stderr, "REGRESSION: %s: rt_per_kib: "
+			    "%.3f, baseline: %.3f\n",
+			    key, res.rt_per_kib, base);
+			(*regressions) ++;
+		}
+	}
+
+err_out:
+	minipro_close(mp);
+	sim_destroy(sim);
+	free(pattern);
+
+	return (error);
+}
+
+/* Write, read back and verify own share of cases. */
+static void *
+e2e_thread(void *arg) {
+	e2e_thr_p thr = arg;
+	int error = 0, op;
+	uint8_t *pattern;
+	size_t i, j, size;
+	chip_p chip;
+	sim_p sim;
+	minipro_p mp;
+	e2e_res_t res;
+
+	for (i = thr->idx; i < thr->count && 0 == error;
+	    i += thr->opts->threads) {
+		chip = thr->cases[i];
+		size = chip->code_memory_size;
+		sim = NULL;
+		mp = NULL;
+		pattern = malloc(size);
+		if (NULL == pattern) {
+			error = ENOMEM;
+			break;
+		}
+		for (j = 0; j < size; j ++) { /* Per thread data. */
+			pattern[j] = (uint8_t)((j * 13) ^ (j >> 8) ^ thr->idx);
+		}
+		error = sim_create(chip, thr->opts->cmd_lat_us,
+		    thr->opts->byte_ns, &sim);
+		if (0 != error)
+			goto next;
+		error = minipro_open_transfer(sim_transfer, sim, 0, &mp);
+		if (0 != error)
+			goto next;
+		error = minipro_chip_set(mp, chip, 0);
+		for (op = E2E_OP_WRITE; E2E_OP__COUNT__ > op && 0 == error;
+		    op ++) {
+			error = e2e_op_run(mp, sim, op, pattern, size, &res);
+			thr->bytes += size;
+		}
+		if (0 != error) {
+			fprintf(stderr, "thread %zu: %s: error %i - %s\n",
+			    thr->idx, chip->name, error, strerror(error));
+		}
+next:
+		minipro_close(mp);
+		sim_destroy(sim);
+		free(pattern);
+	}
+	thr->error = error;
+
+	return (NULL);
+}
+
+static int
+e2e_threads_run(e2e_opts_p opts, chip_p *cases, size_t count,
+    int *first) {
+	int error = 0;
+	size_t i, started, bytes = 0;
+	uint64_t wall;
+	e2e_thr_t thrs[E2E_THREADS_MAX];
+
+	memset(thrs, 0x00, sizeof(thrs));
+	wall = e2e_time_us();
+	for (started = 0; started < opts->threads; started ++) {
+		thrs[started].opts = opts;
+		thrs[started].cases = cases;
+		thrs[started].count = count;
+		thrs[started].idx = started;
+		error = pthread_create(&thrs[started].thread, NULL,
+		    e2e_thread, &thrs[started]);
+		if (0 != error)
+			break;
+	}
+	for (i = 0; i < started; i ++) {
+		pthread_join(thrs[i].thread, NULL);
+		bytes += thrs[i].bytes;
+		if (0 == error) {
+			error = thrs[i].error;
+		}
+	}
+	if (0 != error)
+		return (error);
+	wall = (e2e_time_us() - wall);
+	printf("%s\n{\"case\":\"concurrent/%zu\",\"threads\":%zu,"
+	    "\"size\":%zu,\"wall_us\":%"PRIu64",\"bytes_per_s\":%.0f}",
+	    ((0 != (*first)) ? "" : ","), opts->threads, opts->threads,
+	    bytes, wall,
+	    (((double)bytes * 1000000.0) / (double)MAX(wall, 1)));
+	(*first) = 0;
+
+	return (0);
+}
+
+/* Shared USB context pass: requests to all devices in parallel, each
+ * answer must come from own device. */
+static void *
+e2e_usb_thread(void *arg) {
+	e2e_thr_p thr = arg;
+	int error = 0;
+	size_t i;
+	minipro_ver_t ver;
+	minipro_ver_p ver_open = minipro_ver_get(thr->mp);
+
+	for (i = 0; i < E2E_USB_ITERS && 0 == error; i ++) {
+		error = minipro_get_version_info(thr->mp, &ver);
+		if (0 == error &&
+		    0 != memcmp(ver.serial_num, ver_open->serial_num,
+		    sizeof(ver.serial_num))) {
+			error = EBADMSG; /* Answer from other device. */
+		}
+		thr->round_trips ++;
+	}
+	thr->error = error;
+
+	return (NULL);
+}
+
+static int
+e2e_usb_run(e2e_opts_p opts, int *first) {
+	int error = 0;
+	size_t i, j, opened, started, round_trips = 0;
+	uint64_t wall;
+	minipro_usb_ctx_p ctx = NULL;
+	e2e_thr_t thrs[E2E_THREADS_MAX];
+
+	memset(thrs, 0x00, sizeof(thrs));
+	error = minipro_usb_ctx_create(&ctx);
+	if (0 != error) {
+		fprintf(stderr, "Fail on USB context create: %i - %s\n",
+		    error, strerror(error));
+		return (error);
+	}
+	for (opened = 0; opened < opts->usb_devs; opened ++) {
+		error = minipro_open_ex(ctx, MP_TL866_VID, MP_TL866_PID,
+		    opened, 0, &thrs[opened].mp);
+		if (0 != error) {
+			fprintf(stderr, "Fail on programmer %zu open: "
+			    "%i - %s\n", opened, error, strerror(error));
+			goto err_out;
+		}
+		for (j = 0; j < opened; j ++) { /* Must be distinct. */
+			if (0 != memcmp(
+			    minipro_ver_get(thrs[j].mp)->serial_num,
+			    minipro_ver_get(thrs[opened].mp)->serial_num,
+			    sizeof(((minipro_ver_p)0)->serial_num)))
+				continue;
+			fprintf(stderr, "Programmers %zu and %zu have same "
+			    "serial number.\n", j, opened);
+			error = EEXIST;
+			opened ++;
+			goto err_out;
+		}
+	}
+	wall = e2e_time_us();
+	for (started = 0; started < opened; started ++) {
+		thrs[started].idx = started;
+		error = pthread_create(&thrs[started].thread, NULL,
+		    e2e_usb_thread, &thrs[started]);
+		if (0 != error)
+			break;
+	}
+	for (i = 0; i < started; i ++) {
+		pthread_join(thrs[i].thread, NULL);
+		round_trips += thrs[i].round_trips;
+		if (0 == error && 0 != thrs[i].error) {
+			error = thrs[i].error;
+			fprintf(stderr, "programmer %zu: error %i - %s\n",
+			    i, error, strerror(error));
+		}
+	}
+	if (0 != error)
+		goto err_out;
+	wall = (e2e_time_us() - wall);
+	printf("%s\n{\"case\":\"usb_shared_ctx/%zu\",\"devices\":%zu,"
+	    "\"round_trips\":%zu,\"wall_us\":%"PRIu64","
+	    "\"round_trips_per_s\":%.0f}",
+	    ((0 != (*first)) ? "" : ","), opened, opened, round_trips, wall,
+	    (((double)round_trips * 1000000.0) / (double)MAX(wall, 1)));
+	(*first) = 0;
+
+err_out:
+	for (i = 0; i < opened; i ++) {
+		minipro_close(thrs[i].mp);
+	}
+	minipro_usb_ctx_destroy(ctx);
+
+	return (error);
+}
+
+static void
+e2e_usage(const char *progname) {
+
+	fprintf(stderr,
+	    "Usage: %s [options]\n"
+	    "Read/verify/write/erase jobs against simulated programmer,\n"
+	    "results printed to stdout as JSON, one case per line.\n"
+	    "options:\n"
+	    "	-d <file_name>	chips database, default: "
+	    BENCH_DB_FILE_DEF"\n"
+	    "	-l <us>		device time per command, default: %i\n"
+	    "	-n <ns>		device time per payload byte, default: %i\n"
+	    "	-s <size>	max chip code size, default: %i\n"
+	    "	-c <count>	max chips, default: %i\n"
+	    "	-b <file_name>	baseline: output of previous run\n"
+	    "	-t <percent>	allowed regression, default: %i\n"
+	    "	-j <threads>	also run cases concurrently, handle per\n"
+	    "			thread, data checked, max: %i\n"
+	    "	-u <count>	also check real programmers (2 or more)\n"
+	    "			on one shared USB context, parallel\n"
+	    "			requests, answers checked by serial\n",
+	    progname, E2E_CMD_LAT_US_DEF, E2E_BYTE_NS_DEF,
+	    E2E_SIZE_MAX_DEF, E2E_CASES_MAX_DEF, E2E_THRESHOLD_DEF,
+	    E2E_THREADS_MAX);
+}
+
+
+int
+main(int argc, char **argv) {
+	int error, ch, first = 1;
+	size_t i, chips_db_count, count = 0, regressions = 0;
+	size_t bl_size = 0;
+	uint8_t *bl = NULL;
+	chip_p chips_db = NULL, chip, *cases = NULL;
+	e2e_opts_t opts;
+
+	memset(&opts, 0x00, sizeof(opts));
+	opts.db_file_name = BENCH_DB_FILE_DEF;
+	opts.cmd_lat_us = E2E_CMD_LAT_US_DEF;
+	opts.byte_ns = E2E_BYTE_NS_DEF;
+	opts.size_max = E2E_SIZE_MAX_DEF;
+	opts.cases_max = E2E_CASES_MAX_DEF;
+	opts.threshold = E2E_THRESHOLD_DEF;
+	while (-1 != (ch = getopt(argc, argv, "d:l:n:s:c:b:t:j:u:h"))) {
+		switch (ch) {
+		case 'd':
+			opts.db_file_name = optarg;
+			break;
+		case 'l':
+			opts.cmd_lat_us = (uint32_t)strtoul(optarg, NULL, 0);
+			break;
+		case 'n':
+			opts.byte_ns = (uint32_t)strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			opts.size_max = (size_t)strtoul(optarg, NULL, 0);
+			break;
+		case 'c':
+			opts.cases_max = (size_t)strtoul(optarg, NULL, 0);
+			break;
+		case 'b':
+			opts.baseline_file_name = optarg;
+			break;
+		case 't':
+			opts.threshold = (uint32_t)strtoul(optarg, NULL, 0);
+			break;
+		case 'j':
+			opts.threads = (size_t)strtoul(optarg, NULL, 0);
+			if (E2E_THREADS_MAX < opts.threads) {
+				e2e_usage(argv[0]);
+				return (EINVAL);
+			}
+			break;
+		case 'u':
+			opts.usb_devs = (size_t)strtoul(optarg, NULL, 0);
+			if (2 > opts.usb_devs ||
+			    E2E_THREADS_MAX < opts.usb_devs) {
+				e2e_usage(argv[0]);
+				return (EINVAL);
+			}
+			break;
+		default:
+			e2e_usage(argv[0]);
+			return (EINVAL);
+		}
+	}
+
+	if (NULL != opts.baseline_file_name) {
+		error = read_file(opts.baseline_file_name, 0, 0, 0,
+		    E2E_BASELINE_SIZE_MAX, &bl, &bl_size);
+		if (0 != error) {
+			fprintf(stderr, "Fail on baseline read: %s: "
+			    "%i - %s\n", opts.baseline_file_name,
+			    error, strerror(error));
+			return (error);
+		}
+	}
+	error = chip_db_load(opts.db_file_name, 0, &chips_db,
+	    &chips_db_count);
+	if (0 != error) {
+		fprintf(stderr, "Fail on chips DB load: %s: %i - %s\n",
+		    opts.db_file_name, error, strerror(error));
+		goto err_out;
+	}
+	cases = calloc(MAX(opts.cases_max, 1), sizeof(chip_p));
+	if (NULL == cases) {
+		error = ENOMEM;
+		goto err_out;
+	}
+	for (chip = chips_db; NULL != chip->name &&
+	    opts.cases_max > count; chip ++) {
+		if (0 == chip->code_memory_size ||
+		    opts.size_max < chip->code_memory_size ||
+		    0 == chip->read_block_size ||
+		    0 == chip->write_block_size ||
+		    MP_BLOCK_SIZE_MAX < chip->read_block_size ||
+		    MP_BLOCK_SIZE_MAX < chip->write_block_size ||
+		    0 == e2e_case_is_new(cases, count, chip))
+			continue;
+		cases[count ++] = chip;
+	}
+
+	printf("{\"package\":\"%s\",\"cmd_lat_us\":%"PRIu32","
+	    "\"byte_ns\":%"PRIu32",\"results\":[",
+	    PACKAGE_STRING, opts.cmd_lat_us, opts.byte_ns);
+	for (i = 0; i < count; i ++) {
+		error = e2e_chip_run(&opts, cases[i], bl, bl_size,
+		    &first, &regressions);
+		if (0 != error)
+			break;
+	}
+	if (0 == error && 0 != opts.threads) {
+		error = e2e_threads_run(&opts, cases, count, &first);
+	}
+	if (0 == error && 0 != opts.usb_devs) {
+		error = e2e_usb_run(&opts, &first);
+	}
+	printf("\n]}\n");
+	if (0 == error && 0 != regressions) {
+		fprintf(stderr, "%zu regressions over %"PRIu32"%%.\n",
+		    regressions, opts.threshold);
+		error = 1;
+	}
+
+err_out:
+	free(cases);
+	chip_db_free(chips_db);
+	free(bl);
+
+	return (error);
+}
@@ -0,0 +1,321 @@
+#include <sys/param.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include "utils/macro.h"
+#include "database.h"
+#include "dumpio.h"
+#include "config.h"
+
+
+#define DIFF_CHUNK_SIZE		(64 * 1024) /* Equal check by memcmp(). */
+#define DIFF_FILE_SIZE_MAX	(1024 * 1024 * 1024) /* 1Gb, gzip only. */
+
+/* Exit codes, as cmp(1). */
+#define DIFF_RET_SAME		0
+#define DIFF_RET_DIFFER		1
+#define DIFF_RET_ERROR		2
+
+
+typedef struct diff_file_s {
+	const char	*name;
+	const uint8_t	*data;
+	size_t		size;
+	int		is_mapped;
+} diff_file_t, *diff_file_p;
+
+typedef struct diff_range_s {
+	size_t		start;
+	size_t		end;
+	size_t		bytes;		/* Differ bytes. */
+	size_t		bits_10;	/* Expected 1, actual 0. */
+	size_t		bits_01;	/* Expected 0, actual 1. */
+} diff_range_t, *diff_range_p;
+
+typedef struct diff_opts_s {
+	const char	*db_file_name;
+	const char	*chip_name;
+	size_t		block_size;
+	size_t		ranges_max;	/* Printed, 0 - all. */
+	int		quiet;
+} diff_opts_t, *diff_opts_p;
+
+
+static int
+diff_file_open(const char *file_name, diff_file_p df) {
+	int error = 0, fd;
+	struct stat st;
+	void *data;
+
+	memset(df, 0x00, sizeof(diff_file_t));
+	df->name = file_name;
+	if (0 != dumpio_is_gzip(file_name))
+		return (dumpio_read_file(file_name, 0, 0, DIFF_FILE_SIZE_MAX,
+		    (uint8_t**)&df->data, &df->size));
+	fd = open(file_name, O_RDONLY);
+	if (-1 == fd)
+		return (errno);
+	if (0 != fstat(fd, &st)) {
+		error = errno;
+		goto err_out;
+	}
+	df->size = (size_t)st.st_size;
+	if (0 == df->size)
+		goto err_out; /* Nothing to map. */
+	data = mmap(NULL, df->size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (MAP_FAILED == data) {
+		error = errno;
+		goto err_out;
+	}
+	madvise(data, df->size, MADV_SEQUENTIAL);
+	df->data = data;
+	df->is_mapped = 1;
+
+err_out:
+	close(fd);
+
+	return (error);
+}
+
+static void
+diff_file_close(diff_file_p df) {
+
+	if (NULL == df->data)
+		return;
+	if (0 != df->is_mapped) {
+		munmap((void*)(size_t)df->data, df->size);
+	} else {
+		free((void*)(size_t)df->data);
+	}
+	df->data = NULL;
+}
+
+/* First differ byte index in [pos, end), end if equal. */
+static size_t
+diff_first(const uint8_t *a, const uint8_t *b, size_t pos, size_t end) {
+	uint64_t wa, wb;
+
+	for (; (pos + 8) <= end; pos += 8) {
+		memcpy(&wa, (a + pos), 8);
+		memcpy(&wb, (b + pos), 8);
+		if (wa != wb)
+			break;
+	}
+	for (; pos < end && a[pos] == b[pos]; pos ++)
+		;
+
+	return (pos);
+}
+
+/* Bytes and bit flips of block. */
+static void
+diff_block_count(const uint8_t *a, const uint8_t *b, size_t size,
+    diff_range_p r) {
+	size_t i;
+	uint64_t wa, wb;
+
+	for (i = 0; (i + 8) <= size; i += 8) {
+		memcpy(&wa, (a + i), 8);
+		memcpy(&wb, (b + i), 8);
+		if (wa == wb)
+			continue;
+		r->bits_10 += (size_t)__builtin_popcountll(wa & ~wb);
+		r->bits_01 += (size_t)__builtin_popcountll(~wa & wb);
+		for (wa ^= wb; 0 != wa; wa >>= 8) {
+			r->bytes += (0 != (wa & 0xff));
+		}
+	}
+	for (; i < size; i ++) {
+		if (a[i] == b[i])
+			continue;
+		r->bits_10 += (size_t)__builtin_popcount(
+		    (unsigned)(a[i] & ~b[i]) & 0xff);
+		r->bits_01 += (size_t)__builtin_popcount(
+		    (unsigned)(~a[i] & b[i]) & 0xff);
+		r->bytes ++;
+	}
+}
+
+static void
+diff_range_print(const diff_opts_p opts, const diff_range_p r,
+    size_t *ranges) {
+
+	(*ranges) ++;
+	if (0 != opts->quiet ||
+	    (0 != opts->ranges_max && (*ranges) > opts->ranges_max))
+		return;
+	printf("0x%08zx - 0x%08zx: %zu bytes differ, bits 1->0: %zu, "
+	    "0->1: %zu\n", r->start, (r->end - 1), r->bytes, r->bits_10,
+	    r->bits_01);
+}
+
+static void
+diff_usage(const char *progname) {
+
+	fprintf(stderr,
+	    "Usage: %s [options] <expected_file> <actual_file>\n"
+	    "Compare image and chip dump (or two dumps), print differ\n"
+	    "ranges aligned to blocks and bit flips summary.\n"
+	    "Files *.gz are unpacked. Exit: 0 - same, 1 - differ, "
+	    "2 - error.\n"
+	    "options:\n"
+	    "	-d <file_name>	chips database, default: "DB_FILE_DEF"\n"
+	    "	-p <chip>	chip: write block size for ranges\n"
+	    "	-b <size>	block size, default: chip write block "
+	    "or 1\n"
+	    "	-m <count>	max ranges to print, default: all\n"
+	    "	-q		summary only\n",
+	    progname);
+}
+
+
+int
+main(int argc, char **argv) {
+	int error = 0, ch, ret = DIFF_RET_ERROR;
+	size_t pos, end, tm, blk, size, ranges = 0, blocks = 0;
+	size_t chips_db_count;
+	chip_p chips_db = NULL, chip = NULL;
+	diff_file_t df[2];
+	diff_range_t r, blk_r, total;
+	diff_opts_t opts;
+
+	memset(&opts, 0x00, sizeof(opts));
+	memset(df, 0x00, sizeof(df));
+	opts.db_file_name = DB_FILE_DEF;
+	while (-1 != (ch = getopt(argc, argv, "d:p:b:m:qh"))) {
+		switch (ch) {
+		case 'd':
+			opts.db_file_name = optarg;
+			break;
+		case 'p':
+			opts.chip_name = optarg;
+			break;
+		case 'b':
+			opts.block_size = (size_t)strtoul(optarg, NULL, 0);
+			break;
+		case 'm':
+			opts.ranges_max = (size_t)strtoul(optarg, NULL, 0);
+			break;
+		case 'q':
+			opts.quiet = 1;
+			break;
+		default:
+			diff_usage(argv[0]);
+			return (DIFF_RET_ERROR);
+		}
+	}
+	if (2 != (argc - optind)) {
+		diff_usage(argv[0]);
+		return (DIFF_RET_ERROR);
+	}
+
+	if (NULL != opts.chip_name) {
+		error = chip_db_load(opts.db_file_name, 0, &chips_db,
+		    &chips_db_count);
+		if (0 != error) {
+			fprintf(stderr, "Fail on chips DB load: %s: "
+			    "%i - %s\n", opts.db_file_name,
+			    error, strerror(error));
+			return (DIFF_RET_ERROR);
+		}
+		chip = chip_db_get_by_name(chips_db, opts.chip_name);
+		if (NULL == chip) {
+			fprintf(stderr, "Chip \"%s\" not found.\n",
+			    opts.chip_name);
+			goto err_out;
+		}
+		if (0 == opts.block_size) {
+			opts.block_size = ((0 != chip->write_block_size) ?
+			    chip->write_block_size : chip->read_block_size);
+		}
+	}
+	if (0 == opts.block_size) {
+		opts.block_size = 1;
+	}
+	for (ch = 0; ch < 2; ch ++) {
+		error = diff_file_open(argv[(optind + ch)], &df[ch]);
+		if (0 != error) {
+			fprintf(stderr, "Fail on file open: %s: %i - %s\n",
+			    argv[(optind + ch)], error, strerror(error));
+			goto err_out;
+		}
+	}
+	if (NULL != chip && 0 == opts.quiet) {
+		printf("Chip: %s, code size: %"PRIu32", block size: %zu.\n",
+		    chip->name, chip->code_memory_size, opts.block_size);
+	}
+	if (df[0].size != df[1].size) {
+		printf("Size differ: %zu vs %zu, compared: %zu.\n",
+		    df[0].size, df[1].size, MIN(df[0].size, df[1].size));
+	}
+
+	/* Equal chunks skipped by memcmp() (vectorized by libc), differ
+	 * blocks counted by words. */
+	memset(&r, 0x00, sizeof(r));
+	memset(&total, 0x00, sizeof(total));
+	size = MIN(df[0].size, df[1].size);
+	for (pos = 0; pos < size;) {
+		tm = MIN(DIFF_CHUNK_SIZE, (size - pos));
+		if (0 == memcmp((df[0].data + pos), (df[1].data + pos), tm)) {
+			pos += tm;
+			continue;
+		}
+		pos = diff_first(df[0].data, df[1].data, pos, (pos + tm));
+		blk = (pos - (pos % opts.block_size));
+		end = MIN((blk + opts.block_size), size);
+		if (0 != r.bytes && r.end != blk) { /* Not adjacent. */
+			diff_range_print(&opts, &r, &ranges);
+			memset(&r, 0x00, sizeof(r));
+		}
+		if (0 == r.bytes) {
+			r.start = blk;
+		}
+		r.end = end;
+		memset(&blk_r, 0x00, sizeof(blk_r));
+		diff_block_count((df[0].data + blk), (df[1].data + blk),
+		    (end - blk), &blk_r);
+		r.bytes += blk_r.bytes;
+		r.bits_10 += blk_r.bits_10;
+		r.bits_01 += blk_r.bits_01;
+		total.bytes += blk_r.bytes;
+		total.bits_10 += blk_r.bits_10;
+		total.bits_01 += blk_r.bits_01;
+		blocks ++;
+		pos = end;
+	}
+	if (0 != r.bytes) {
+		diff_range_print(&opts, &r, &ranges);
+	}
+	if (0 == opts.quiet &&
+	    0 != opts.ranges_max && ranges > opts.ranges_max) {
+		printf("... %zu more ranges.\n", (ranges - opts.ranges_max));
+	}
+	printf("Differ: %zu bytes in %zu blocks, %zu ranges; "
+	    "bits 1->0: %zu, 0->1: %zu.\n",
+	    total.bytes, blocks, ranges, total.bits_10, total.bits_01);
+	if (0 != total.bits_10) {
+		printf("1->0: expected 1 read 0 - not erased cells, or "
+		    "stuck at 0.\n");
+	}
+	if (0 != total.bits_01) {
+		printf("0->1: expected 0 read 1 - not programmed or weak "
+		    "cells (charge loss).\n");
+	}
+	ret = ((0 != total.bytes || df[0].size != df[1].size) ?
+	    DIFF_RET_DIFFER : DIFF_RET_SAME);
+
+err_out:
+	diff_file_close(&df[0]);
+	diff_file_close(&df[1]);
+	chip_db_free(chips_db);
+
+	return (ret);
+}
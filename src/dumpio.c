@@ -0,0 +1,365 @@
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include "config.h"
+#ifdef HAVE_ZLIB
+#	include <zlib.h>
+#endif
+
+#include "utils/macro.h"
+#include "utils/sys.h"
+
+#include "dumpio.h"
+
+
+#define DUMPIO_GZ_FILE_SIZE_MAX	(1024 * 1024 * 1024) /* 1Gb */
+#define DUMPIO_GZ_BUF_SIZE	(64 * 1024)
+
+
+typedef struct dumpio_s {
+	int		fd;
+	uint32_t	flags;
+	off_t		end;		/* Max written offset + size. */
+#ifdef HAVE_ZLIB
+	int		is_gzip;
+	z_stream	zs;
+	uint8_t		zbuf[DUMPIO_GZ_BUF_SIZE];
+#endif
+} dumpio_t;
+
+
+static int
+dumpio_write_all(int fd, const uint8_t *buf, size_t size) {
+	ssize_t ios;
+
+	while (0 != size) {
+		ios = write(fd, buf, size);
+		if (0 >= ios)
+			return ((0 != errno) ? errno : EIO);
+		buf += ios;
+		size -= (size_t)ios;
+	}
+
+	return (0);
+}
+
+static int
+dumpio_is_zero(const uint8_t *buf, size_t size) {
+
+	if (0 == size)
+		return (1);
+	/* First byte zero and buffer equal to itself shifted. */
+	return (0 == buf[0] && 0 == memcmp(buf, (buf + 1), (size - 1)));
+}
+
+/* File is new: zero pieces are skipped, split by DUMPIO_SPARSE_BLK
+ * aligned blocks, so block without data stays hole even if filled by
+ * few writes. */
+static int
+dumpio_sparse_write(dumpio_p dio, off_t offset, const uint8_t *buf,
+    size_t size) {
+	size_t tm, run = 0;
+	off_t run_offset = offset;
+
+	while (0 != size) {
+		tm = (size_t)(DUMPIO_SPARSE_BLK -
+		    (offset % DUMPIO_SPARSE_BLK));
+		tm = MIN(tm, size);
+		if (0 != dumpio_is_zero(buf, tm)) {
+			/* Flush data before hole. */
+			if (0 != run &&
+			    run != (size_t)pwrite(dio->fd, (buf - run), run,
+			    run_offset))
+				return ((0 != errno) ? errno : EIO);
+			run = 0;
+			run_offset = (offset + (off_t)tm);
+		} else {
+			run += tm;
+		}
+		offset += (off_t)tm;
+		buf += tm;
+		size -= tm;
+	}
+	if (0 != run &&
+	    run != (size_t)pwrite(dio->fd, (buf - run), run, run_offset))
+		return ((0 != errno) ? errno : EIO);
+
+	return (0);
+}
+
+#ifdef HAVE_ZLIB
+static int
+dumpio_gz_deflate(dumpio_p dio, const uint8_t *buf, size_t size,
+    int flush) {
+	int error, zerr;
+
+	dio->zs.next_in = (Bytef*)(size_t)buf;
+	dio->zs.avail_in = (uInt)size;
+	do {
+		dio->zs.next_out = dio->zbuf;
+		dio->zs.avail_out = sizeof(dio->zbuf);
+		zerr = deflate(&dio->zs, flush);
+		if (Z_STREAM_ERROR == zerr)
+			return (EINVAL);
+		error = dumpio_write_all(dio->fd, dio->zbuf,
+		    (sizeof(dio->zbuf) - dio->zs.avail_out));
+		if (0 != error)
+			return (error);
+	} while (0 == dio->zs.avail_out);
+
+	return (0);
+}
+
+static int
+dumpio_gz_read(const char *file_name, off_t offset, size_t size,
+    size_t max_size, uint8_t **buf_ret, size_t *buf_size_ret) {
+	int error = 0, zerr;
+	uint8_t *zbuf = NULL, *buf = NULL, *tm;
+	size_t zbuf_size, allocated = 0, done = 0;
+	off_t skip = offset;
+	z_stream zs;
+	uint8_t discard[DUMPIO_GZ_BUF_SIZE];
+
+	error = read_file(file_name, 0, 0, 0, DUMPIO_GZ_FILE_SIZE_MAX,
+	    &zbuf, &zbuf_size);
+	if (0 != error)
+		return (error);
+	memset(&zs, 0x00, sizeof(zs));
+	if (Z_OK != inflateInit2(&zs, (15 + 16))) {
+		free(zbuf);
+		return (ENOMEM);
+	}
+	zs.next_in = zbuf;
+	zs.avail_in = (uInt)zbuf_size;
+	if (0 != size) {
+		max_size = MIN(max_size, size);
+	}
+	for (;;) {
+		if (0 != skip) {
+			zs.next_out = discard;
+			zs.avail_out = (uInt)MIN((off_t)sizeof(discard), skip);
+		} else {
+			if (allocated == done) {
+				if (max_size == done) {
+					if (0 == size) {
+						error = EFBIG;
+					}
+					break; /* Requested size readed. */
+				}
+				allocated = MIN(max_size,
+				    MAX((allocated * 2), DUMPIO_GZ_BUF_SIZE));
+				tm = realloc(buf, (allocated + 1));
+				if (NULL == tm) {
+					error = ENOMEM;
+					break;
+				}
+				buf = tm;
+			}
+			zs.next_out = (buf + done);
+			zs.avail_out = (uInt)(allocated - done);
+		}
+		zerr = inflate(&zs, Z_NO_FLUSH);
+		if (0 != skip) {
+			skip -= (off_t)((uint8_t*)zs.next_out - discard);
+		} else {
+			done = (size_t)((uint8_t*)zs.next_out - buf);
+		}
+		if (Z_STREAM_END == zerr) {
+			if (0 == zs.avail_in)
+				break;
+			inflateReset(&zs); /* Next gzip member. */
+			continue;
+		}
+		if (Z_OK != zerr) {
+			error = ((Z_MEM_ERROR == zerr) ? ENOMEM : EINVAL);
+			break;
+		}
+	}
+	inflateEnd(&zs);
+	free(zbuf);
+	if (0 == error && 0 != skip) {
+		error = EINVAL; /* Offset beyond data. */
+	}
+	if (0 != error) {
+		free(buf);
+		return (error);
+	}
+	if (NULL == buf) { /* Empty. */
+		buf = malloc(1);
+		if (NULL == buf)
+			return (ENOMEM);
+	}
+	(*buf_ret) = buf;
+	(*buf_size_ret) = done;
+
+	return (0);
+}
+#endif
+
+
+int
+dumpio_is_gzip(const char *file_name) {
+	size_t len;
+
+	if (NULL == file_name)
+		return (0);
+	len = strlen(file_name);
+
+	return (3 < len && 0 == strcasecmp((file_name + len - 3), ".gz"));
+}
+
+int
+dumpio_open(const char *file_name, uint32_t flags, dumpio_p *dio_ret) {
+	int oflags = (O_WRONLY | O_CREAT);
+	dumpio_p dio;
+
+	if (NULL == file_name || NULL == dio_ret)
+		return (EINVAL);
+	if (0 != dumpio_is_gzip(file_name)) {
+#ifndef HAVE_ZLIB
+		return (ENOTSUP);
+#endif
+		if (0 != (DUMPIO_F_SPARSE & flags))
+			return (EINVAL);
+	}
+	dio = calloc(1, sizeof(dumpio_t));
+	if (NULL == dio)
+		return (ENOMEM);
+	dio->flags = flags;
+#ifdef HAVE_ZLIB
+	dio->is_gzip = dumpio_is_gzip(file_name);
+	if (0 != dio->is_gzip &&
+	    Z_OK != deflateInit2(&dio->zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+	    (15 + 16), 8, Z_DEFAULT_STRATEGY)) {
+		free(dio);
+		return (ENOMEM);
+	}
+	if (0 != dio->is_gzip) {
+		oflags |= O_TRUNC;
+	}
+#endif
+	if (0 != (DUMPIO_F_SPARSE & flags)) {
+		oflags |= O_TRUNC;
+	}
+	dio->fd = open(file_name, oflags, 0600);
+	if (-1 == dio->fd) {
+		oflags = errno;
+#ifdef HAVE_ZLIB
+		if (0 != dio->is_gzip) {
+			deflateEnd(&dio->zs);
+		}
+#endif
+		free(dio);
+		return (oflags);
+	}
+	(*dio_ret) = dio;
+
+	return (0);
+}
+
+int
+dumpio_write(dumpio_p dio, off_t offset, const uint8_t *buf,
+    size_t size) {
+	int error;
+
+	if (NULL == dio || (NULL == buf && 0 != size) || 0 > offset)
+		return (EINVAL);
+#ifdef HAVE_ZLIB
+	if (0 != dio->is_gzip) {
+		if (offset != dio->end)
+			return (ESPIPE); /* Stream: only sequential. */
+		error = dumpio_gz_deflate(dio, buf, size, Z_NO_FLUSH);
+	} else
+#endif
+	if (0 != (DUMPIO_F_SPARSE & dio->flags)) {
+		error = dumpio_sparse_write(dio, offset, buf, size);
+	} else if (size != (size_t)pwrite(dio->fd, buf, size, offset)) {
+		error = ((0 != errno) ? errno : EIO);
+	} else {
+		error = 0;
+	}
+	if (0 != error)
+		return (error);
+	dio->end = MAX(dio->end, (offset + (off_t)size));
+
+	return (0);
+}
+
+int
+dumpio_close(dumpio_p dio) {
+	int error = 0;
+	struct stat st;
+
+	if (NULL == dio)
+		return (EINVAL);
+#ifdef HAVE_ZLIB
+	if (0 != dio->is_gzip) {
+		error = dumpio_gz_deflate(dio, NULL, 0, Z_FINISH);
+		deflateEnd(&dio->zs);
+	}
+#endif
+	if (0 == error &&
+	    0 != (DUMPIO_F_SPARSE & dio->flags) &&
+	    0 == fstat(dio->fd, &st) &&
+	    st.st_size < dio->end &&
+	    0 != ftruncate(dio->fd, dio->end)) {
+		error = errno;
+	}
+	close(dio->fd);
+	free(dio);
+
+	return (error);
+}
+
+int
+dumpio_file_size_get(const char *file_name, off_t *file_size) {
+	int fd, error = 0;
+	uint8_t isize[4];
+
+	if (0 == dumpio_is_gzip(file_name))
+		return (file_size_get(file_name, 0, file_size));
+#ifndef HAVE_ZLIB
+	return (ENOTSUP);
+#endif
+	if (NULL == file_size)
+		return (EINVAL);
+	/* ISIZE: gzip trailer, uncompressed size mod 2^32. */
+	fd = open(file_name, O_RDONLY);
+	if (-1 == fd)
+		return (errno);
+	if (sizeof(isize) != (size_t)pread(fd, isize, sizeof(isize),
+	    (lseek(fd, 0, SEEK_END) - (off_t)sizeof(isize)))) {
+		error = ((0 != errno) ? errno : EINVAL);
+	} else {
+		(*file_size) = (off_t)(((uint32_t)isize[0]) |
+		    (((uint32_t)isize[1]) << 8) |
+		    (((uint32_t)isize[2]) << 16) |
+		    (((uint32_t)isize[3]) << 24));
+	}
+	close(fd);
+
+	return (error);
+}
+
+int
+dumpio_read_file(const char *file_name, off_t offset, size_t size,
+    size_t max_size, uint8_t **buf, size_t *buf_size) {
+
+	if (0 == dumpio_is_gzip(file_name))
+		return (read_file(file_name, 0, offset, size, max_size,
+		    buf, buf_size));
+#ifdef HAVE_ZLIB
+	return (dumpio_gz_read(file_name, offset, size, max_size, buf,
+	    buf_size));
+#else
+	return (ENOTSUP);
+#endif
+}
@@ -0,0 +1,32 @@
+#ifndef __DUMPIO_H
+#define __DUMPIO_H
+
+#include <sys/types.h>
+#include <inttypes.h>
+
+
+/* Chip dump files. File name ending with ".gz": gzip stream, written
+ * and read transparently (requires zlib). Sparse: runs of 0x00 are not
+ * written - holes, read back as zeros by any reader. */
+#define DUMPIO_F_SPARSE		0x00000001
+#define DUMPIO_SPARSE_BLK	4096	/* Hole granularity, file offset. */
+
+typedef struct dumpio_s *dumpio_p;
+
+
+int	dumpio_is_gzip(const char *file_name);
+
+/* Plain: file kept, data updated at offsets. Sparse or gzip: file
+ * truncated, gzip writes must be sequential from offset 0. */
+int	dumpio_open(const char *file_name, uint32_t flags, dumpio_p *dio_ret);
+int	dumpio_write(dumpio_p dio, off_t offset, const uint8_t *buf,
+	    size_t size);
+/* Finish stream, sparse: extend file over trailing hole. */
+int	dumpio_close(dumpio_p dio);
+
+/* read_file() / file_size_get() with gzip decompression. */
+int	dumpio_file_size_get(const char *file_name, off_t *file_size);
+int	dumpio_read_file(const char *file_name, off_t offset, size_t size,
+	    size_t max_size, uint8_t **buf, size_t *buf_size);
+
+#endif
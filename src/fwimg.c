@@ -0,0 +1,510 @@
+#include <sys/types.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+
+#include "utils/macro.h"
+#include "utils/mem_utils.h"
+#include "utils/sys.h"
+
+#include "fwimg.h"
+#include "dumpio.h"
+
+
+#define FWIMG_FILE_SIZE_MAX	(1024 * 1024 * 1024) /* 1Gb */
+#define FWIMG_SEGS_PREALLOC	16
+#define FWIMG_DATA_PREALLOC	(64 * 1024)
+#define FWIMG_REC_SIZE_MAX	(1 + 4 + 255 + 1) /* Count, addr, data, sum. */
+
+
+typedef struct fwimg_ctx_s {
+	fwimg_p		img;
+	size_t		data_allocated;
+	size_t		segs_allocated;
+	size_t		data_size_max;
+} fwimg_ctx_t, *fwimg_ctx_p;
+
+/* Hex char to nibble, 0xff - not hex char. */
+static const uint8_t fwimg_hex_tbl[256] = {
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07,
+	0x08, 0x09, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+};
+
+
+/* Table lookup without branches in loop, check once at end. */
+static int
+fwimg_hex_decode(const uint8_t *src, size_t count, uint8_t *dst) {
+	register size_t i;
+	register uint8_t hi, lo, bad = 0;
+
+	for (i = 0; i < count; i ++) {
+		hi = fwimg_hex_tbl[src[(i * 2)]];
+		lo = fwimg_hex_tbl[src[((i * 2) + 1)]];
+		bad |= (hi | lo);
+		dst[i] = (uint8_t)((hi << 4) | lo);
+	}
+
+	return ((0 != (0xf0 & bad)) ? EINVAL : 0);
+}
+
+static int
+fwimg_seg_add(fwimg_ctx_p ctx, uint64_t address, const uint8_t *data,
+    size_t size) {
+	int error;
+	uint8_t *tm;
+	size_t allocated;
+	fwimg_p img = ctx->img;
+	mp_range_p seg;
+
+	if (0 == size)
+		return (0);
+	if ((address + size) > 0x100000000ull)
+		return (ERANGE);
+	if ((img->data_size + size) > ctx->data_size_max)
+		return (EFBIG);
+	if ((img->data_size + size) > ctx->data_allocated) {
+		allocated = MAX((ctx->data_allocated * 2),
+		    (img->data_size + size));
+		allocated = MAX(allocated, FWIMG_DATA_PREALLOC);
+		tm = realloc(img->data, allocated);
+		if (NULL == tm)
+			return (ENOMEM);
+		img->data = tm;
+		ctx->data_allocated = allocated;
+	}
+	/* Continue last segment if adjacent. */
+	seg = ((0 != img->count) ? &img->segs[(img->count - 1)] : NULL);
+	if (NULL != seg &&
+	    ((uint64_t)seg->address + seg->size) == address) {
+		seg->size += size;
+	} else {
+		error = realloc_items((void**)&img->segs, sizeof(mp_range_t),
+		    &ctx->segs_allocated, FWIMG_SEGS_PREALLOC, img->count);
+		if (0 != error)
+			return (error);
+		seg = &img->segs[img->count];
+		seg->address = (uint32_t)address;
+		seg->size = size;
+		seg->offset = img->data_size;
+		img->count ++;
+	}
+	memcpy((img->data + img->data_size), data, size);
+	img->data_size += size;
+
+	return (0);
+}
+
+static int
+fwimg_seg_cmp(const void *a, const void *b) {
+	const mp_range_t *ra = a, *rb = b;
+
+	if (ra->address < rb->address)
+		return (-1);
+	if (ra->address > rb->address)
+		return (1);
+	return (0);
+}
+
+/* Sort, check overlaps, restore data order and merge adjacent. */
+static int
+fwimg_finish(fwimg_p img) {
+	size_t i, j, offset;
+	uint8_t *data;
+
+	if (0 == img->count) {
+		fprintf(stderr, "No data in firmware file.\n");
+		return (EINVAL);
+	}
+	qsort(img->segs, img->count, sizeof(mp_range_t), fwimg_seg_cmp);
+	for (i = 1, offset = img->segs[0].size; i < img->count; i ++) {
+		if (((size_t)img->segs[(i - 1)].address +
+		    img->segs[(i - 1)].size) > img->segs[i].address) {
+			fprintf(stderr, "Firmware file segments overlap "
+			    "at 0x%08"PRIx32".\n", img->segs[i].address);
+			return (EINVAL);
+		}
+		if (offset != img->segs[i].offset) {
+			offset = SIZE_MAX; /* Not in address order. */
+			continue;
+		}
+		offset += img->segs[i].size;
+	}
+	if (0 != img->segs[0].offset || SIZE_MAX == offset) {
+		data = malloc(img->data_size);
+		if (NULL == data)
+			return (ENOMEM);
+		for (i = 0, offset = 0; i < img->count; i ++) {
+			memcpy((data + offset),
+			    (img->data + img->segs[i].offset),
+			    img->segs[i].size);
+			img->segs[i].offset = offset;
+			offset += img->segs[i].size;
+		}
+		free(img->data);
+		img->data = data;
+	}
+	for (i = 1, j = 0; i < img->count; i ++) {
+		if (((size_t)img->segs[j].address + img->segs[j].size) ==
+		    img->segs[i].address) {
+			img->segs[j].size += img->segs[i].size;
+			continue;
+		}
+		j ++;
+		img->segs[j] = img->segs[i];
+	}
+	img->count = (j + 1);
+
+	return (0);
+}
+
+/* Next text line, without CR/LF and trailing spaces, NULL at end. */
+static const uint8_t *
+fwimg_line_get(const uint8_t **ptr, const uint8_t *end,
+    size_t *line_size) {
+	const uint8_t *line, *eol;
+
+	while ((*ptr) < end &&
+	    ('\r' == (**ptr) || '\n' == (**ptr) ||
+	     ' ' == (**ptr) || '\t' == (**ptr))) {
+		(*ptr) ++;
+	}
+	if ((*ptr) >= end)
+		return (NULL);
+	line = (*ptr);
+	eol = memchr(line, '\n', (size_t)(end - line));
+	if (NULL == eol) {
+		eol = end;
+	}
+	(*ptr) = eol;
+	while (eol > line &&
+	    ('\r' == eol[-1] || ' ' == eol[-1] || '\t' == eol[-1])) {
+		eol --;
+	}
+	(*line_size) = (size_t)(eol - line);
+
+	return (line);
+}
+
+static int
+fwimg_ihex_parse(fwimg_ctx_p ctx, const uint8_t *buf, size_t buf_size) {
+	int error;
+	const uint8_t *ptr = buf, *end = (buf + buf_size), *line;
+	size_t line_size, line_num, i, count;
+	uint8_t rec[FWIMG_REC_SIZE_MAX], sum;
+	uint32_t base = 0;
+
+	for (line_num = 1;
+	    NULL != (line = fwimg_line_get(&ptr, end, &line_size));
+	    line_num ++) {
+		/* :LLAAAATT<data>CC */
+		count = ((line_size - 1) / 2);
+		if (':' != line[0] ||
+		    0 == (line_size & 1) ||
+		    5 > count ||
+		    sizeof(rec) < count ||
+		    0 != fwimg_hex_decode((line + 1), count, rec) ||
+		    count != ((size_t)rec[0] + 5))
+			goto bad_rec;
+		for (i = 0, sum = 0; i < count; i ++) {
+			sum += rec[i];
+		}
+		if (0 != sum)
+			goto bad_rec;
+		switch (rec[3]) {
+		case 0x00: /* Data. */
+			error = fwimg_seg_add(ctx,
+			    ((uint64_t)base + ((((uint32_t)rec[1]) << 8) | rec[2])),
+			    (rec + 4), rec[0]);
+			if (0 != error)
+				return (error);
+			break;
+		case 0x01: /* End of file. */
+			return (0);
+		case 0x02: /* Extended segment address. */
+		case 0x04: /* Extended linear address. */
+			if (2 != rec[0])
+				goto bad_rec;
+			base = ((((uint32_t)rec[4]) << 8) | rec[5]);
+			base <<= ((0x02 == rec[3]) ? 4 : 16);
+			break;
+		case 0x03: /* Start addresses: not for programmer. */
+		case 0x05:
+			break;
+		default:
+			goto bad_rec;
+		}
+	}
+
+	return (0);
+
+bad_rec:
+	fprintf(stderr, "Bad Intel HEX record at line %zu.\n", line_num);
+	return (EINVAL);
+}
+
+static int
+fwimg_srec_parse(fwimg_ctx_p ctx, const uint8_t *buf, size_t buf_size) {
+	int error;
+	const uint8_t *ptr = buf, *end = (buf + buf_size), *line;
+	size_t line_size, line_num, i, count, addr_size;
+	uint8_t rec[FWIMG_REC_SIZE_MAX], sum;
+	uint32_t address;
+
+	for (line_num = 1;
+	    NULL != (line = fwimg_line_get(&ptr, end, &line_size));
+	    line_num ++) {
+		/* S<type><count><address><data><checksum> */
+		count = ((line_size - 2) / 2);
+		if (4 > line_size ||
+		    'S' != line[0] ||
+		    0 != (line_size & 1) ||
+		    sizeof(rec) < count ||
+		    0 != fwimg_hex_decode((line + 2), count, rec) ||
+		    count != ((size_t)rec[0] + 1))
+			goto bad_rec;
+		for (i = 0, sum = 0; i < count; i ++) {
+			sum += rec[i];
+		}
+		if (0xff != sum)
+			goto bad_rec;
+		switch (line[1]) {
+		case '0': /* Header. */
+		case '5': /* Records count. */
+		case '6':
+			continue;
+		case '1': /* Data. */
+		case '2':
+		case '3':
+			addr_size = (size_t)(line[1] - '0' + 1);
+			break;
+		case '7': /* Start address, end of file. */
+		case '8':
+		case '9':
+			return (0);
+		default:
+			goto bad_rec;
+		}
+		if ((addr_size + 2) > count)
+			goto bad_rec;
+		for (i = 0, address = 0; i < addr_size; i ++) {
+			address = ((address << 8) | rec[(1 + i)]);
+		}
+		error = fwimg_seg_add(ctx, address, (rec + 1 + addr_size),
+		    (count - addr_size - 2));
+		if (0 != error)
+			return (error);
+	}
+
+	return (0);
+
+bad_rec:
+	fprintf(stderr, "Bad S-record at line %zu.\n", line_num);
+	return (EINVAL);
+}
+
+static uint64_t
+fwimg_elf_rd(const uint8_t *ptr, size_t size, int is_be) {
+	size_t i;
+	uint64_t ret = 0;
+
+	for (i = 0; i < size; i ++) {
+		ret |= (((uint64_t)ptr[((0 != is_be) ? (size - i - 1) : i)]) <<
+		    (i * 8));
+	}
+
+	return (ret);
+}
+
+static int
+fwimg_elf_parse(fwimg_ctx_p ctx, const uint8_t *buf, size_t buf_size) {
+	int error, is_64, is_be;
+	size_t i, ph_size, wsz;
+	uint64_t ph_off, ph_num, p_off, p_addr, p_fsize;
+	const uint8_t *ph;
+
+	if (52 > buf_size ||
+	    0 != memcmp(buf, "\177ELF", 4) ||
+	    (1 != buf[4] && 2 != buf[4]) ||
+	    (1 != buf[5] && 2 != buf[5]))
+		goto bad_file;
+	is_64 = (2 == buf[4]);
+	is_be = (2 == buf[5]);
+	wsz = ((0 != is_64) ? 8 : 4);
+	if (0 != is_64 && 64 > buf_size)
+		goto bad_file;
+	/* e_phoff, e_phentsize, e_phnum. */
+	ph_off = fwimg_elf_rd((buf + 28 + ((0 != is_64) ? 4 : 0)), wsz,
+	    is_be);
+	ph_size = (size_t)fwimg_elf_rd((buf + ((0 != is_64) ? 54 : 42)), 2,
+	    is_be);
+	ph_num = fwimg_elf_rd((buf + ((0 != is_64) ? 56 : 44)), 2, is_be);
+	if (((0 != is_64) ? 56 : 32) > ph_size ||
+	    ph_off > buf_size ||
+	    (ph_num * ph_size) > (buf_size - ph_off))
+		goto bad_file;
+	for (i = 0; i < ph_num; i ++) {
+		ph = (buf + ph_off + (i * ph_size));
+		if (1 != fwimg_elf_rd(ph, 4, is_be)) /* PT_LOAD */
+			continue;
+		if (0 != is_64) {
+			p_off = fwimg_elf_rd((ph + 8), 8, is_be);
+			p_addr = fwimg_elf_rd((ph + 24), 8, is_be);
+			p_fsize = fwimg_elf_rd((ph + 32), 8, is_be);
+		} else {
+			p_off = fwimg_elf_rd((ph + 4), 4, is_be);
+			p_addr = fwimg_elf_rd((ph + 12), 4, is_be);
+			p_fsize = fwimg_elf_rd((ph + 16), 4, is_be);
+		}
+		if (p_off > buf_size ||
+		    p_fsize > (buf_size - p_off))
+			goto bad_file;
+		/* Load (physical) address: initialized data in flash. */
+		error = fwimg_seg_add(ctx, p_addr, (buf + p_off),
+		    (size_t)p_fsize);
+		if (0 != error)
+			return (error);
+	}
+
+	return (0);
+
+bad_file:
+	fprintf(stderr, "Bad ELF file or program headers.\n");
+	return (EINVAL);
+}
+
+
+int
+fwimg_fmt_detect(const char *file_name) {
+	const char *ext, *end;
+	char buf[8];
+
+	if (NULL == file_name)
+		return (FWIMG_FMT_RAW);
+	end = (file_name + strlen(file_name));
+	if (0 != dumpio_is_gzip(file_name)) { /* fw.hex.gz */
+		end -= 3;
+	}
+	for (ext = end; ext > file_name && '.' != ext[-1] &&
+	    '/' != ext[-1]; ext --)
+		;
+	if (ext == file_name || '.' != ext[-1] ||
+	    sizeof(buf) <= (size_t)(end - ext))
+		return (FWIMG_FMT_RAW);
+	memcpy(buf, ext, (size_t)(end - ext));
+	buf[(end - ext)] = 0;
+	ext = buf;
+	if (0 == strcasecmp(ext, "hex") ||
+	    0 == strcasecmp(ext, "ihex") ||
+	    0 == strcasecmp(ext, "ihx"))
+		return (FWIMG_FMT_IHEX);
+	if (0 == strcasecmp(ext, "srec") ||
+	    0 == strcasecmp(ext, "s19") ||
+	    0 == strcasecmp(ext, "s28") ||
+	    0 == strcasecmp(ext, "s37") ||
+	    0 == strcasecmp(ext, "mot"))
+		return (FWIMG_FMT_SREC);
+	if (0 == strcasecmp(ext, "elf") ||
+	    0 == strcasecmp(ext, "axf"))
+		return (FWIMG_FMT_ELF);
+
+	return (FWIMG_FMT_RAW);
+}
+
+int
+fwimg_load(const char *file_name, int fmt, size_t data_size_max,
+    fwimg_p img) {
+	int error;
+	uint8_t *buf = NULL;
+	size_t buf_size;
+	fwimg_ctx_t ctx;
+
+	if (NULL == file_name || NULL == img ||
+	    0 > fmt || FWIMG_FMT__COUNT__ <= fmt)
+		return (EINVAL);
+	memset(img, 0x00, sizeof(fwimg_t));
+	memset(&ctx, 0x00, sizeof(ctx));
+	ctx.img = img;
+	ctx.data_size_max = data_size_max;
+
+	error = dumpio_read_file(file_name, 0, 0,
+	    ((FWIMG_FMT_RAW == fmt) ? data_size_max : FWIMG_FILE_SIZE_MAX),
+	    &buf, &buf_size);
+	if (0 != error)
+		return (error);
+	switch (fmt) {
+	case FWIMG_FMT_RAW: /* Single segment, no copy. */
+		error = realloc_items((void**)&img->segs, sizeof(mp_range_t),
+		    &ctx.segs_allocated, 1, 0);
+		if (0 != error)
+			break;
+		img->data = buf;
+		img->data_size = buf_size;
+		img->segs[0].address = 0;
+		img->segs[0].size = buf_size;
+		img->segs[0].offset = 0;
+		img->count = ((0 != buf_size) ? 1 : 0);
+		buf = NULL;
+		break;
+	case FWIMG_FMT_IHEX:
+		error = fwimg_ihex_parse(&ctx, buf, buf_size);
+		break;
+	case FWIMG_FMT_SREC:
+		error = fwimg_srec_parse(&ctx, buf, buf_size);
+		break;
+	case FWIMG_FMT_ELF:
+		error = fwimg_elf_parse(&ctx, buf, buf_size);
+		break;
+	}
+	free(buf);
+	if (0 == error) {
+		error = fwimg_finish(img);
+	}
+	if (0 != error) {
+		fwimg_free(img);
+	}
+
+	return (error);
+}
+
+void
+fwimg_free(fwimg_p img) {
+
+	if (NULL == img)
+		return;
+	free(img->data);
+	free(img->segs);
+	memset(img, 0x00, sizeof(fwimg_t));
+}
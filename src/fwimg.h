@@ -0,0 +1,40 @@
+#ifndef __FWIMG_H
+#define __FWIMG_H
+
+#include <sys/types.h>
+#include <inttypes.h>
+
+#include "minipro.h"
+
+
+/* Firmware build output formats: only populated segments are stored,
+ * segment addresses are chip page addresses. */
+#define FWIMG_FMT_RAW		0
+#define FWIMG_FMT_IHEX		1	/* Intel HEX, record types 00..05. */
+#define FWIMG_FMT_SREC		2	/* Motorola S-record, S0..S9. */
+#define FWIMG_FMT_ELF		3	/* ELF32/64, PT_LOAD at p_paddr. */
+#define FWIMG_FMT__COUNT__	4
+static const char *fwimg_fmt_str[] = {
+	"raw",
+	"ihex",
+	"srec",
+	"elf",
+	NULL
+};
+
+typedef struct fwimg_s {
+	uint8_t		*data;		/* Segments data. */
+	size_t		data_size;
+	mp_range_p	segs;		/* Sorted by address, not overlapped, */
+	size_t		count;		/* adjacent merged; offset in data. */
+} fwimg_t, *fwimg_p;
+
+
+/* By file name extension, FWIMG_FMT_RAW if unknown. */
+int	fwimg_fmt_detect(const char *file_name);
+
+int	fwimg_load(const char *file_name, int fmt, size_t data_size_max,
+	    fwimg_p img);
+void	fwimg_free(fwimg_p img);
+
+#endif
@@ -0,0 +1,457 @@
+#include <sys/types.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <errno.h>
+
+#include "utils/macro.h"
+#include "utils/mem_utils.h"
+#include "utils/strh2num.h"
+#include "utils/sys.h"
+#include "utils/ini.h"
+
+#include "job.h"
+#include "dumpio.h"
+
+
+#define JOB_STEPS_PREALLOC	16
+#define JOB_IMAGE_SIZE_MAX	(1024 * 1024 * 1024) /* 1Gb */
+
+
+static uint64_t
+job_time_us(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ((((uint64_t)ts.tv_sec) * 1000000) +
+	    (((uint64_t)ts.tv_nsec) / 1000));
+}
+
+static int
+job_str_cpy(char *dst, size_t dst_size, const uint8_t *val,
+    size_t val_size) {
+
+	if (dst_size <= val_size)
+		return (ENAMETOOLONG);
+	memcpy(dst, val, val_size);
+	dst[val_size] = 0;
+
+	return (0);
+}
+
+/* Index of val in NULL terminated strings array, -1 - not found. */
+static int
+job_str_idx(const char **strs, const uint8_t *val, size_t val_size) {
+	int i;
+
+	for (i = 0; NULL != strs[i]; i ++) {
+		if (0 == mem_cmpn_cstr(strs[i], val, val_size))
+			return (i);
+	}
+
+	return (-1);
+}
+
+static int
+job_step_parse(ini_p ini, size_t soff, job_step_p step) {
+	int error = 0;
+	const uint8_t *vn, *val;
+	size_t voff, vn_sz, val_size;
+
+	step->action = -1;
+	step->page = MP_CHIP_PAGE_CODE;
+	step->chip_id_check = 1;
+	step->post_wr_verify = 1;
+	voff = 0;
+	while (0 == error && 0 == ini_sect_val_enum(ini, soff, &voff,
+	    &vn, &vn_sz, &val, &val_size)) {
+		if (0 == mem_cmpn_cstr("action", vn, vn_sz)) {
+			step->action = job_str_idx(job_act_str, val, val_size);
+			if (-1 == step->action) {
+				error = EINVAL;
+			}
+		} else if (0 == mem_cmpn_cstr("chip", vn, vn_sz)) {
+			error = job_str_cpy(step->chip_name,
+			    sizeof(step->chip_name), val, val_size);
+		} else if (0 == mem_cmpn_cstr("chip_id_check", vn, vn_sz)) {
+			step->chip_id_check = (0 != ustrh2u8(val, val_size));
+		} else if (0 == mem_cmpn_cstr("file", vn, vn_sz)) {
+			error = job_str_cpy(step->file_name,
+			    sizeof(step->file_name), val, val_size);
+		} else if (0 == mem_cmpn_cstr("page", vn, vn_sz)) {
+			step->page = job_str_idx(mp_chip_page_str, val,
+			    val_size);
+			if (-1 == step->page) {
+				error = EINVAL;
+			}
+		} else if (0 == mem_cmpn_cstr("addr", vn, vn_sz)) {
+			step->address = ustrh2u32(val, val_size);
+		} else if (0 == mem_cmpn_cstr("size", vn, vn_sz)) {
+			step->size = ustrh2usize(val, val_size);
+		} else if (0 == mem_cmpn_cstr("file_offset", vn, vn_sz)) {
+			step->file_offset = (off_t)ustrh2u64(val, val_size);
+		} else if (0 == mem_cmpn_cstr("no_erase", vn, vn_sz)) {
+			if (0 != ustrh2u8(val, val_size)) {
+				step->write_flags |= MP_PAGE_WR_F_NO_ERASE;
+			}
+		} else if (0 == mem_cmpn_cstr("no_pre_unprotect", vn, vn_sz)) {
+			if (0 != ustrh2u8(val, val_size)) {
+				step->write_flags |= MP_PAGE_WR_F_PRE_NO_UNPROTECT;
+			}
+		} else if (0 == mem_cmpn_cstr("no_post_protect", vn, vn_sz)) {
+			if (0 != ustrh2u8(val, val_size)) {
+				step->write_flags |= MP_PAGE_WR_F_POST_NO_PROTECT;
+			}
+		} else if (0 == mem_cmpn_cstr("no_verify", vn, vn_sz)) {
+			step->post_wr_verify = (0 == ustrh2u8(val, val_size));
+		} else {
+			error = EINVAL;
+		}
+		voff ++;
+	}
+	if (0 != error) {
+		fprintf(stderr, "Job step \"%s\": bad value: %.*s = %.*s\n",
+		    step->name, (int)vn_sz, vn, (int)val_size, val);
+		return (error);
+	}
+	/* Required fields. */
+	if (-1 == step->action) {
+		fprintf(stderr, "Job step \"%s\": action not set.\n",
+		    step->name);
+		return (EINVAL);
+	}
+	if (JOB_ACT_FUSES == step->action) {
+		step->page = MP_CHIP_PAGE_CONFIG;
+	}
+	switch (step->action) {
+	case JOB_ACT_CHIP:
+		if (0 != step->chip_name[0])
+			break;
+		fprintf(stderr, "Job step \"%s\": chip not set.\n",
+		    step->name);
+		return (EINVAL);
+	case JOB_ACT_READ:
+	case JOB_ACT_VERIFY:
+	case JOB_ACT_WRITE:
+	case JOB_ACT_FUSES:
+		if (0 != step->file_name[0])
+			break;
+		fprintf(stderr, "Job step \"%s\": file not set.\n",
+		    step->name);
+		return (EINVAL);
+	}
+
+	return (0);
+}
+
+
+int
+job_load(const char *file_name, job_p job) {
+	int error;
+	uint8_t *buf = NULL;
+	const uint8_t *sname;
+	size_t buf_size, soff, sname_sz, allocated = 0;
+	ini_p ini = NULL;
+
+	if (NULL == file_name || NULL == job)
+		return (EINVAL);
+	memset(job, 0x00, sizeof(job_t));
+	error = read_file(file_name, 0, 0, 0, JOB_FILE_SIZE_MAX,
+	    &buf, &buf_size);
+	if (0 != error)
+		return (error);
+	error = ini_create(&ini);
+	if (0 != error)
+		goto err_out;
+	error = ini_buf_parse(ini, buf, buf_size);
+	if (0 != error)
+		goto err_out;
+	soff = 0;
+	while (0 == ini_sect_enum(ini, &soff, &sname, &sname_sz)) {
+		error = realloc_items((void**)&job->steps,
+		    sizeof(job_step_t), &allocated,
+		    JOB_STEPS_PREALLOC, job->count);
+		if (0 != error)
+			goto err_out;
+		memset(&job->steps[job->count], 0x00, sizeof(job_step_t));
+		sname_sz = MIN(sname_sz, (CHIP_NAME_MAX - 1));
+		memcpy(job->steps[job->count].name, sname, sname_sz);
+		error = job_step_parse(ini, soff, &job->steps[job->count]);
+		if (0 != error)
+			goto err_out;
+		job->count ++;
+		soff ++;
+	}
+	if (0 == job->count) {
+		error = ENOENT;
+	}
+
+err_out:
+	if (0 != error) {
+		job_free(job);
+	}
+	ini_destroy(ini);
+	free(buf);
+
+	return (error);
+}
+
+void
+job_free(job_p job) {
+
+	if (NULL == job)
+		return;
+	free(job->steps);
+	job->steps = NULL;
+	job->count = 0;
+}
+
+
+/* Select chip, check ID. */
+static int
+job_chip_set(minipro_p mp, chip_p chips_db, uint8_t icsp,
+    job_step_p step) {
+	int error;
+	chip_p chip;
+	uint32_t chip_id_type, chip_id, chip_id_rev;
+	uint8_t chip_id_size;
+
+	chip = chip_db_get_by_name(chips_db, step->chip_name);
+	if (NULL == chip) {
+		fprintf(stderr, "Chip \"%s\" not found.\n", step->chip_name);
+		return (ENOENT);
+	}
+	error = minipro_chip_set(mp, chip, icsp);
+	if (0 != error)
+		return (error);
+	if (0 == step->chip_id_check ||
+	    ((0 == chip->chip_id_size || 0 == chip->chip_id) &&
+	     0 == (CHIP_OPT4_CHIP_ID & chip->opts4)))
+		return (0);
+	error = minipro_get_chip_id(mp, &chip_id_type, &chip_id,
+	    &chip_id_size, &chip_id_rev);
+	if (0 != error)
+		return (error);
+	if (0 == is_chip_id_prob_eq(chip, chip_id, chip_id_size)) {
+		fprintf(stderr, "Invalid Chip ID: expected 0x%02x, "
+		    "got 0x%02x rev 0x%02x.\n",
+		    chip->chip_id, chip_id, chip_id_rev);
+		return (-1);
+	}
+
+	return (0);
+}
+
+/* Step size: up to page end if not set, config: 0 - all file. */
+static int
+job_size_get(chip_p chip, job_step_p step, size_t *size) {
+	size_t chip_size;
+
+	if (MP_CHIP_PAGE_CONFIG == step->page) {
+		if (0 != step->address || 0 != step->size)
+			return (EINVAL);
+		(*size) = 0;
+		return (0);
+	}
+	chip_size = ((MP_CHIP_PAGE_CODE == step->page) ?
+	    chip->code_memory_size : chip->data_memory_size);
+	if (step->address >= chip_size)
+		return (EINVAL);
+	(*size) = ((0 != step->size) ? step->size :
+	    (chip_size - step->address));
+	if ((*size) > (chip_size - step->address))
+		return (EINVAL);
+
+	return (0);
+}
+
+static int
+job_verify(minipro_p mp, job_step_p step, const uint8_t *buf,
+    size_t buf_size, const char *status_msg, minipro_progress_cb cb) {
+	int error;
+	size_t err_offset;
+	uint32_t buf_val, chip_val;
+
+	error = minipro_page_verify(mp, step->page, step->address,
+	    buf, buf_size, &err_offset, &buf_val, &chip_val,
+	    cb, (void*)status_msg);
+	if (0 != error)
+		return (error);
+	if (err_offset >= buf_size)
+		return (0);
+	fprintf(stderr, "\nVerification failed at 0x%02zx, "
+	    "written: 0x%02x, readed: 0x%02x.\n",
+	    err_offset, buf_val, chip_val);
+
+	return (-1);
+}
+
+static int
+job_step_run(minipro_p mp, chip_p chips_db, uint8_t icsp,
+    job_step_p step, minipro_progress_cb cb) {
+	int error = 0, cerror;
+	dumpio_p dio;
+	chip_p chip = minipro_chip_get(mp);
+	uint8_t *buf = NULL;
+	size_t size, buf_size = 0, i;
+	off_t file_size;
+	char status_msg[64];
+
+	if (JOB_ACT_CHIP == step->action)
+		return (job_chip_set(mp, chips_db, icsp, step));
+	if (NULL == chip) {
+		fprintf(stderr, "Chip not selected.\n");
+		return (EINVAL);
+	}
+	if (JOB_ACT_ERASE == step->action) {
+		if (0 == (CHIP_OPT4_ERASE & chip->opts4))
+			return (EOPNOTSUPP);
+		return (minipro_erase(mp));
+	}
+	error = job_size_get(chip, step, &size);
+	if (0 != error) {
+		fprintf(stderr, "Address / size out of chip page.\n");
+		return (error);
+	}
+	snprintf(status_msg, sizeof(status_msg), "%s %s... ",
+	    job_act_str[step->action], mp_chip_page_str[step->page]);
+
+	switch (step->action) {
+	case JOB_ACT_READ:
+		error = minipro_page_read(mp, step->page, step->address, size,
+		    &buf, &buf_size, cb, status_msg);
+		if (0 != error)
+			break;
+		error = dumpio_open(step->file_name, 0, &dio);
+		if (0 != error)
+			break;
+		error = dumpio_write(dio, step->file_offset, buf, buf_size);
+		cerror = dumpio_close(dio);
+		if (0 == error) {
+			error = cerror;
+		}
+		break;
+	case JOB_ACT_BLANK:
+		if (MP_CHIP_PAGE_CONFIG == step->page)
+			return (EINVAL);
+		error = minipro_page_read(mp, step->page, step->address, size,
+		    &buf, &buf_size, cb, status_msg);
+		if (0 != error)
+			break;
+		for (i = 0; i < buf_size; i ++) {
+			if (0xff == buf[i])
+				continue;
+			fprintf(stderr, "\nNot blank at 0x%02zx: 0x%02x.\n",
+			    ((size_t)step->address + i), buf[i]);
+			error = -1;
+			break;
+		}
+		break;
+	case JOB_ACT_VERIFY:
+	case JOB_ACT_WRITE:
+	case JOB_ACT_FUSES:
+		/* Up to page end: not more than file have. */
+		if (0 != size && 0 == step->size) {
+			error = dumpio_file_size_get(step->file_name,
+			    &file_size);
+			if (0 != error)
+				break;
+			if (file_size <= step->file_offset) {
+				error = EINVAL;
+				break;
+			}
+			size = MIN(size,
+			    (size_t)(file_size - step->file_offset));
+		}
+		error = dumpio_read_file(step->file_name, step->file_offset,
+		    size, JOB_IMAGE_SIZE_MAX, &buf, &buf_size);
+		if (0 != error)
+			break;
+		if (JOB_ACT_VERIFY == step->action) {
+			error = job_verify(mp, step, buf, buf_size,
+			    status_msg, cb);
+			break;
+		}
+		error = minipro_page_write(mp, step->write_flags, step->page,
+		    step->address, buf, buf_size, cb, status_msg);
+		if (0 != error || 0 == step->post_wr_verify)
+			break;
+		snprintf(status_msg, sizeof(status_msg), "verify %s... ",
+		    mp_chip_page_str[step->page]);
+		error = job_verify(mp, step, buf, buf_size, status_msg, cb);
+		break;
+	default:
+		return (EINVAL);
+	}
+	if (0 == error) {
+		step->bytes = buf_size;
+	}
+	free(buf);
+
+	return (error);
+}
+
+int
+job_run(minipro_p mp, chip_p chips_db, chip_p chip, uint8_t icsp,
+    job_p job, minipro_progress_cb cb) {
+	int error = 0;
+	size_t i;
+	uint64_t tm;
+
+	if (NULL == mp || NULL == job)
+		return (EINVAL);
+	if (NULL != chip) {
+		error = minipro_chip_set(mp, chip, icsp);
+		if (0 != error)
+			return (error);
+	}
+	for (i = 0; i < job->count; i ++) {
+		tm = job_time_us();
+		error = job_step_run(mp, chips_db, icsp, &job->steps[i], cb);
+		job->steps[i].time_us = (job_time_us() - tm);
+		job->steps[i].done = 1;
+		job->steps[i].error = error;
+		if (0 != error)
+			break;
+	}
+
+	return (error);
+}
+
+void
+job_print(FILE *fp, const job_p job) {
+	size_t i;
+	uint64_t total_us = 0;
+	job_step_p step;
+
+	if (NULL == fp || NULL == job)
+		return;
+	fprintf(fp, "%-4s %-20s %-7s %-7s %10s %10s  %s\n",
+	    "step", "name", "action", "page", "bytes", "ms", "result");
+	for (i = 0; i < job->count; i ++) {
+		step = &job->steps[i];
+		total_us += step->time_us;
+		fprintf(fp, "%-4zu %-20s %-7s %-7s %10zu %10"PRIu64"  ",
+		    (i + 1), step->name, job_act_str[step->action],
+		    ((JOB_ACT_CHIP == step->action ||
+		      JOB_ACT_ERASE == step->action) ?
+		    "-" : mp_chip_page_str[step->page]),
+		    step->bytes, (step->time_us / 1000));
+		if (0 == step->done) {
+			fprintf(fp, "skipped\n");
+		} else if (0 == step->error) {
+			fprintf(fp, "ok\n");
+		} else if (-1 == step->error) {
+			fprintf(fp, "fail\n");
+		} else {
+			fprintf(fp, "error %i - %s\n",
+			    step->error, strerror(step->error));
+		}
+	}
+	fprintf(fp, "Total: %"PRIu64" ms.\n", (total_us / 1000));
+}
@@ -0,0 +1,81 @@
+#ifndef __JOB_H
+#define __JOB_H
+
+#include <sys/types.h>
+#include <inttypes.h>
+#include <stdio.h>
+
+#include "minipro.h"
+#include "database.h"
+
+
+#define JOB_FILE_SIZE_MAX	(1024 * 1024)
+#define JOB_STR_MAX		1024
+
+/* Job file is ini, each section is step, run in file order:
+ * [<step_name>]
+ * action = chip | read | verify | write | blank | erase | fuses
+ * chip = <chip_name>		chip: select chip, following steps use it
+ * chip_id_check = 0		chip: do not read and check chip ID
+ * file = <file_name>		read/verify/write/fuses
+ * page = code | data | config	read/verify/write/blank, default: code
+ * addr = <hex>			read/verify/write/blank
+ * size = <hex>			0 - up to page end
+ * file_offset = <hex>
+ * no_erase = 1, no_pre_unprotect = 1, no_post_protect = 1,
+ * no_verify = 1		write/fuses
+ * fuses - write config page from file. */
+#define JOB_ACT_CHIP		0
+#define JOB_ACT_READ		1
+#define JOB_ACT_VERIFY		2
+#define JOB_ACT_WRITE		3
+#define JOB_ACT_BLANK		4
+#define JOB_ACT_ERASE		5
+#define JOB_ACT_FUSES		6
+#define JOB_ACT__COUNT__	7
+static const char *job_act_str[] = {
+	"chip",
+	"read",
+	"verify",
+	"write",
+	"blank",
+	"erase",
+	"fuses",
+	NULL
+};
+
+typedef struct job_step_s {
+	char		name[CHIP_NAME_MAX];
+	int		action;		/* JOB_ACT_*. */
+	char		chip_name[CHIP_NAME_MAX];
+	int		chip_id_check;
+	char		file_name[JOB_STR_MAX];
+	int		page;		/* MP_CHIP_PAGE_*. */
+	uint32_t	address;
+	size_t		size;
+	off_t		file_offset;
+	uint32_t	write_flags;	/* MP_PAGE_WR_F_*. */
+	int		post_wr_verify;
+	/* Result. */
+	int		done;		/* Step was run. */
+	int		error;		/* -1: check fail. */
+	size_t		bytes;
+	uint64_t	time_us;
+} job_step_t, *job_step_p;
+
+typedef struct job_s {
+	job_step_p	steps;
+	size_t		count;
+} job_t, *job_p;
+
+
+int	job_load(const char *file_name, job_p job);
+void	job_free(job_p job);
+
+/* Run steps until first fail, chip: initial, may be NULL.
+ * cb: progress, udata is status message string. */
+int	job_run(minipro_p mp, chip_p chips_db, chip_p chip, uint8_t icsp,
+	    job_p job, minipro_progress_cb cb);
+void	job_print(FILE *fp, const job_p job);
+
+#endif
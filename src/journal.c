@@ -0,0 +1,187 @@
+#include <sys/types.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include "utils/macro.h"
+#include "utils/mem_utils.h"
+#include "utils/strh2num.h"
+#include "utils/sys.h"
+
+#include "journal.h"
+
+
+#define JOURNAL_FILE_SIZE_MAX	4096
+
+
+/* FNV-1a 64. */
+uint64_t
+journal_hash(const uint8_t *buf, size_t buf_size) {
+	register size_t i;
+	register uint64_t hash = 0xcbf29ce484222325ull;
+
+	if (NULL == buf)
+		return (0);
+	for (i = 0; i < buf_size; i ++) {
+		hash ^= buf[i];
+		hash *= 0x100000001b3ull;
+	}
+
+	return (hash);
+}
+
+
+int
+journal_load(const char *file_name, journal_p jr) {
+	int error;
+	uint8_t *buf = NULL;
+	const uint8_t *ptr, *end, *eol, *val;
+	size_t buf_size, name_size, val_size;
+
+	if (NULL == file_name || NULL == jr)
+		return (EINVAL);
+
+	error = read_file(file_name, 0, 0, 0, JOURNAL_FILE_SIZE_MAX,
+	    &buf, &buf_size);
+	if (0 != error)
+		return (error);
+	memset(jr, 0x00, sizeof(journal_t));
+	jr->action = -1;
+	jr->page = -1;
+
+	/* Parse "name=value" lines. */
+	end = (buf + buf_size);
+	for (ptr = buf; ptr < end; ptr = (eol + 1)) {
+		eol = mem_chr_ptr(ptr, buf, buf_size, 0x0a/* LF */);
+		if (NULL == eol) {
+			eol = end;
+		}
+		val = mem_chr_ptr(ptr, buf, (size_t)(eol - buf), '=');
+		if (NULL == val)
+			continue;
+		name_size = (size_t)(val - ptr);
+		val ++;
+		val_size = (size_t)(eol - val);
+		if (0 < val_size && 0x0d == val[(val_size - 1)]) { /* CR */
+			val_size --;
+		}
+		if (0 == mem_cmpn_cstr("action", ptr, name_size)) {
+			jr->action = (int)ustrh2u32(val, val_size);
+		} else if (0 == mem_cmpn_cstr("page", ptr, name_size)) {
+			jr->page = (int)ustrh2u32(val, val_size);
+		} else if (0 == mem_cmpn_cstr("address", ptr, name_size)) {
+			jr->address = ustrh2u32(val, val_size);
+		} else if (0 == mem_cmpn_cstr("size", ptr, name_size)) {
+			jr->size = ustrh2usize(val, val_size);
+		} else if (0 == mem_cmpn_cstr("chip_name", ptr, name_size)) {
+			val_size = MIN(val_size, (sizeof(jr->chip_name) - 1));
+			memcpy(jr->chip_name, val, val_size);
+			jr->chip_name[val_size] = 0;
+		} else if (0 == mem_cmpn_cstr("serial", ptr, name_size)) {
+			val_size = MIN(val_size, (sizeof(jr->serial) - 1));
+			memcpy(jr->serial, val, val_size);
+			jr->serial[val_size] = 0;
+		} else if (0 == mem_cmpn_cstr("chip_id", ptr, name_size)) {
+			jr->chip_id = ustrh2u32(val, val_size);
+		} else if (0 == mem_cmpn_cstr("image_hash", ptr, name_size)) {
+			jr->image_hash = ustrh2u64(val, val_size);
+		} else if (0 == mem_cmpn_cstr("done", ptr, name_size)) {
+			jr->done = ustrh2usize(val, val_size);
+		}
+	}
+	free(buf);
+	/* Is all required fields set? */
+	if (-1 == jr->action ||
+	    -1 == jr->page ||
+	    0 == jr->size ||
+	    jr->done > jr->size)
+		return (EINVAL);
+
+	return (0);
+}
+
+/* Write to temp file and rename it: journal always stay consistent. */
+int
+journal_save(const char *file_name, const journal_p jr) {
+	int error = 0, fd;
+	char tmp_name[1024], buf[JOURNAL_FILE_SIZE_MAX];
+	size_t buf_size;
+
+	if (NULL == file_name || NULL == jr)
+		return (EINVAL);
+
+	if ((int)sizeof(tmp_name) <= snprintf(tmp_name, sizeof(tmp_name),
+	    "%s.tmp", file_name))
+		return (ENAMETOOLONG);
+	buf_size = (size_t)snprintf(buf, sizeof(buf),
+	    "action=0x%x\n"
+	    "page=0x%x\n"
+	    "address=0x%08"PRIx32"\n"
+	    "size=0x%zx\n"
+	    "chip_name=%s\n"
+	    "serial=%s\n"
+	    "chip_id=0x%08"PRIx32"\n"
+	    "image_hash=0x%016"PRIx64"\n"
+	    "done=0x%zx\n",
+	    jr->action,
+	    jr->page,
+	    jr->address,
+	    jr->size,
+	    jr->chip_name,
+	    jr->serial,
+	    jr->chip_id,
+	    jr->image_hash,
+	    jr->done);
+	if (sizeof(buf) <= buf_size)
+		return (EOVERFLOW);
+
+	fd = open(tmp_name, (O_WRONLY | O_CREAT | O_TRUNC), 0600);
+	if (-1 == fd)
+		return (errno);
+	if (buf_size != (size_t)write(fd, buf, buf_size) ||
+	    0 != fsync(fd)) {
+		error = errno;
+	}
+	close(fd);
+	if (0 == error &&
+	    0 != rename(tmp_name, file_name)) {
+		error = errno;
+	}
+	if (0 != error) {
+		unlink(tmp_name);
+	}
+
+	return (error);
+}
+
+void
+journal_remove(const char *file_name) {
+
+	if (NULL == file_name)
+		return;
+	unlink(file_name);
+}
+
+
+int
+journal_is_match(const journal_p jr, const journal_p cur) {
+
+	if (NULL == jr || NULL == cur)
+		return (0);
+	if (jr->action != cur->action ||
+	    jr->page != cur->page ||
+	    jr->address != cur->address ||
+	    jr->size != cur->size ||
+	    jr->chip_id != cur->chip_id ||
+	    jr->image_hash != cur->image_hash ||
+	    0 != strncmp(jr->chip_name, cur->chip_name,
+	    sizeof(jr->chip_name)) ||
+	    0 != strncmp(jr->serial, cur->serial, sizeof(jr->serial)))
+		return (0);
+
+	return (1);
+}
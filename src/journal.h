@@ -0,0 +1,36 @@
+#ifndef __JOURNAL_H
+#define __JOURNAL_H
+
+#include <sys/types.h>
+#include <inttypes.h>
+
+#include "database.h"
+
+
+/* Blocks count per journal record: chunk size is
+ * (MAX(read_block_size, write_block_size) * JOURNAL_CHUNK_BLOCKS). */
+#define JOURNAL_CHUNK_BLOCKS	64
+
+
+typedef struct journal_s {
+	int		action;
+	int		page;
+	uint32_t	address;
+	size_t		size;
+	char		chip_name[CHIP_NAME_MAX];
+	char		serial[32];	/* Programmer serial number. */
+	uint32_t	chip_id;	/* Readed from chip, 0 if not checked. */
+	uint64_t	image_hash;	/* Image fingerprint, 0 for read. */
+	size_t		done;		/* Completed bytes count from address. */
+} journal_t, *journal_p;
+
+
+uint64_t journal_hash(const uint8_t *buf, size_t buf_size);
+
+int	journal_load(const char *file_name, journal_p jr);
+int	journal_save(const char *file_name, const journal_p jr);
+void	journal_remove(const char *file_name);
+
+int	journal_is_match(const journal_p jr, const journal_p cur);
+
+#endif
@@ -20,10 +20,22 @@
 #endif /* BSD specific code. */
 
 #include "utils/macro.h"
+#include "utils/mem_utils.h"
 #include "utils/strh2num.h"
 #include "utils/sys.h"
 #include "minipro.h"
 #include "database.h"
+#include "journal.h"
+#include "job.h"
+#include "serial.h"
+#include "fwimg.h"
+#include "dumpio.h"
+#include "xform.h"
+#include "tune.h"
+#include "plan.h"
+#include "pipeline.h"
+#include "progress.h"
+#include "metrics.h"
 #include "config.h"
 
 
@@ -66,8 +78,40 @@ typedef struct command_line_options_s {
 	int		size_error;
 	int		size_error_no_warn;
 	int		quiet;
+	int		wr_fill;
+	uint8_t		wr_fill_val;
+	const char	*wr_fill_file_name;
+	const char	*journal_file_name;
+	int		resume;
+	int		resume_no_id;	/* Allow write resume without chip ID. */
+	uint32_t	tmo[MP_TMO__COUNT__];
+	int		calibrate;
+	const char	*tune_cache_file_name;
+	int		tune_disable;
+	int		progress_fd;
+	const char	*metrics_file_name;
+	int		metrics_fmt;
+	int		profile;
+	int		plan;
+	const char	*image_file_name[MP_CHIP_PAGE__COUNT__];
+	size_t		image_count;	/* Pages in job. */
+	const char	*job_file_name;
+	const char	*ranges_str;
+	mp_range_p	ranges;
+	size_t		ranges_count;
+	const char	*vr_mask_file_name;
+	const char	*vr_skip_str;
+	const char	*serial_str;
+	const char	*serial_counter_file_name;
+	int		file_fmt;	/* FWIMG_FMT_*, -1: by file name. */
+	fwimg_t		fwimg;		/* Segmented file for verify/write. */
+	uint32_t	dump_flags;	/* DUMPIO_F_*. */
+	const char	*xform_str;
+	xform_t		xform;
 } cmd_opts_t, *cmd_opts_p;
 
+static progress_p progress_out = NULL; /* Used by progress_cb(). */
+
 
 static struct option lopts[] = {
 	{ "read",	required_argument,	NULL,	'r'	},
@@ -92,6 +136,30 @@ static struct option lopts[] = {
 	{ "no-size-error", no_argument,		NULL,	's'	},
 	{ "no-size-error-warn", no_argument,	NULL,	'S'	},
 	{ "quiet",	no_argument,		NULL,	0	},
+	{ "fill",	required_argument,	NULL,	0	},
+	{ "fill-from",	required_argument,	NULL,	0	},
+	{ "journal",	required_argument,	NULL,	0	},
+	{ "resume",	no_argument,		NULL,	0	},
+	{ "timeout",	required_argument,	NULL,	0	},
+	{ "calibrate",	no_argument,		NULL,	0	},
+	{ "tune-cache",	required_argument,	NULL,	0	},
+	{ "no-tune",	no_argument,		NULL,	0	},
+	{ "progress-fd", required_argument,	NULL,	0	},
+	{ "metrics",	required_argument,	NULL,	0	},
+	{ "metrics-format", required_argument,	NULL,	0	},
+	{ "profile",	no_argument,		NULL,	0	},
+	{ "plan",	no_argument,		NULL,	0	},
+	{ "image",	required_argument,	NULL,	0	},
+	{ "job",	required_argument,	NULL,	0	},
+	{ "ranges",	required_argument,	NULL,	0	},
+	{ "verify-mask", required_argument,	NULL,	0	},
+	{ "verify-skip", required_argument,	NULL,	0	},
+	{ "serial",	required_argument,	NULL,	0	},
+	{ "serial-counter", required_argument,	NULL,	0	},
+	{ "file-format", required_argument,	NULL,	0	},
+	{ "sparse",	no_argument,		NULL,	0	},
+	{ "xform",	required_argument,	NULL,	0	},
+	{ "resume-no-id", no_argument,		NULL,	0	},
 	{ "help",	no_argument,		NULL,	'?'	},
 	{ NULL,		0,			NULL,	0	}
 };
@@ -120,6 +188,60 @@ static const char *lopts_descr[] = {
 	"		Do NOT error on file size mismatch (only a warning)",
 	"	No warning message for file size mismatch (can't combine with -s)",
 	"				Less verboce",
+	"<byte>			Pad unaligned write head/tail with byte (hex)\n"
+	"					instead of read back chip content",
+	"<file_name>	Pad unaligned write head/tail from page image\n"
+	"					file, rest padded with -fill byte (def: ff)",
+	"<file_name>	Record completed blocks to journal file",
+	"			Continue job from journal (requires -journal)",
+	"<class>=<ms>	USB transfer deadline override, can be repeated\n"
+	"					Possible classes: cmd, read, write, erase",
+	"			Find fastest read block size for chip, store it\n"
+	"					to tune cache (use known good chip with\n"
+	"					programmed, not blank, data)",
+	"<file_name>	Tune cache file, default: ~/"TUNE_CACHE_FILE_DEF,
+	"			Do NOT use tune cache",
+	"<fd>		Write progress events as JSON lines to fd",
+	"<file_name>	Write job metrics record to file",
+	"<format>	Metrics file format, default: json\n"
+	"					Possible values: json (append line),\n"
+	"					prom (Prometheus textfile, replace)",
+	"			Print job phases time, CPU time and peak RSS",
+	"			Estimate job duration and USB round trips,\n"
+	"					do not touch device",
+	"<page>=<file_name>	Add page to read/verify/write job, can\n"
+	"					be repeated: all pages in one session,\n"
+	"					single erase and protect cycle",
+	"<file_name>		Run steps from job file in one session,\n"
+	"					see job.h for format",
+	"<list>		Read/verify only ranges, list:\n"
+	"					<addr>:<size>[:<file_offset>],... (hex)\n"
+	"					or @<map_file> with same items, file\n"
+	"					offset default: addr",
+	"<file_name>	Verify compare mask, page image: only bits\n"
+	"					set are compared, 00 - don't care byte",
+	"<list>	Don't care on verify, list:\n"
+	"					<addr>:<size>,... (hex) or @<map_file>",
+	"<list>		Patch per unit data over write image, list:\n"
+	"					<addr>:<size>:<format>[:<base>],... (hex)\n"
+	"					formats: le, be, bcd, ascii, value is\n"
+	"					base + counter; <addr>:4:crc32:<start>:<size>\n"
+	"					- CRC fix-up, see serial.h",
+	"<file_name>	Serial counter file, locked while taking\n"
+	"					next value (required by -serial)",
+	"<format>	Verify/write file format, default: by file\n"
+	"					name extension, raw if unknown\n"
+	"					Possible values: raw, ihex, srec, elf\n"
+	"					Only populated segments are written",
+	"			Read: do not write zero blocks, sparse file\n"
+	"					Files *.gz: gzip on read, unpacked on\n"
+	"					verify/write",
+	"<list>		Transform image from file to chip, reverse on\n"
+	"					read, list: bswap16, bswap32, bitrev,\n"
+	"					lane:<n>:<i> (byte i of each n, first)\n"
+	"					applied in order, see xform.h",
+	"		Allow -resume of write without chip ID read:\n"
+	"					chip may be other unit, not erased",
 	"			Show help",
 	NULL
 };
@@ -128,14 +250,18 @@ static const char *lopts_descr[] = {
 static int
 cmd_opts_parse(int argc, char **argv, cmd_opts_p cmd_opts) {
 	int i, ch, opt_idx;
-	char opts_str[1024], tmbuf[16];
+	size_t tm;
+	char opts_str[1024], tmbuf[16], *tmptr;
 
 
 	memset(cmd_opts, 0x00, sizeof(cmd_opts_t));
 	cmd_opts->action = -1;
 	cmd_opts->page = MP_CHIP_PAGE_CODE;
+	cmd_opts->file_fmt = -1;
 	cmd_opts->post_wr_verify = 1;
 	cmd_opts->size_error = 1;
+	cmd_opts->wr_fill_val = 0xff;
+	cmd_opts->progress_fd = -1;
 
 	/* Process command line. */
 	/* Generate opts string from long options. */
@@ -257,11 +383,221 @@ restart_opts:
 		case 21: /* quiet */
 			cmd_opts->quiet = 1;
 			break;
+		case 22: /* fill */
+			cmd_opts->wr_fill = 1;
+			cmd_opts->wr_fill_val = (uint8_t)strh2u32(optarg,
+			    sstrlen(optarg));
+			break;
+		case 23: /* fill-from */
+			cmd_opts->wr_fill = 1;
+			cmd_opts->wr_fill_file_name = optarg;
+			break;
+		case 24: /* journal */
+			cmd_opts->journal_file_name = optarg;
+			break;
+		case 25: /* resume */
+			cmd_opts->resume = 1;
+			break;
+		case 26: /* timeout */
+			for (i = 0; MP_TMO__COUNT__ > i; i ++) {
+				tm = strlen(mp_tmo_str[i]);
+				if (strncasecmp(mp_tmo_str[i], optarg, tm) ||
+				    '=' != optarg[tm])
+					continue;
+				cmd_opts->tmo[i] = (uint32_t)strtoul(
+				    (optarg + tm + 1), NULL, 10);
+				break;
+			}
+			if (MP_TMO__COUNT__ == i) {
+				fprintf(stderr,
+				    "Unknown timeout: \"%s\".\n",
+				    optarg);
+				return (EINVAL);
+			}
+			break;
+		case 27: /* calibrate */
+			cmd_opts->calibrate = 1;
+			break;
+		case 28: /* tune-cache */
+			cmd_opts->tune_cache_file_name = optarg;
+			break;
+		case 29: /* no-tune */
+			cmd_opts->tune_disable = 1;
+			break;
+		case 30: /* progress-fd */
+			cmd_opts->progress_fd = (int)strtol(optarg, &tmptr, 10);
+			if (optarg == tmptr || 0 != (*tmptr) ||
+			    0 > cmd_opts->progress_fd ||
+			    -1 == fcntl(cmd_opts->progress_fd, F_GETFD)) {
+				fprintf(stderr, "Invalid progress fd: "
+				    "\"%s\".\n", optarg);
+				return (EINVAL);
+			}
+			break;
+		case 31: /* metrics */
+			cmd_opts->metrics_file_name = optarg;
+			break;
+		case 32: /* metrics-format */
+			for (i = 0; METRICS_FMT__COUNT__ > i; i ++) {
+				if (0 == strcasecmp(metrics_fmt_str[i], optarg))
+					break;
+			}
+			if (METRICS_FMT__COUNT__ == i) {
+				fprintf(stderr,
+				    "Unknown metrics format: \"%s\".\n",
+				    optarg);
+				return (EINVAL);
+			}
+			cmd_opts->metrics_fmt = i;
+			break;
+		case 33: /* profile */
+			cmd_opts->profile = 1;
+			break;
+		case 34: /* plan */
+			cmd_opts->plan = 1;
+			break;
+		case 35: /* image */
+			for (i = MP_CHIP_PAGE_CODE;
+			    MP_CHIP_PAGE__COUNT__ > i;
+			    i ++) {
+				tm = strlen(mp_chip_page_str[i]);
+				if (strncasecmp(mp_chip_page_str[i], optarg, tm) ||
+				    '=' != optarg[tm])
+					continue;
+				break;
+			}
+			if (MP_CHIP_PAGE__COUNT__ == i) {
+				fprintf(stderr,
+				    "Unknown memory type in image: \"%s\".\n",
+				    optarg);
+				return (EINVAL);
+			}
+			if (NULL != cmd_opts->image_file_name[i]) {
+				fprintf(stderr,
+				    "Image for page \"%s\" already set.\n",
+				    mp_chip_page_str[i]);
+				return (EINVAL);
+			}
+			cmd_opts->image_file_name[i] = (optarg + tm + 1);
+			cmd_opts->image_count ++;
+			break;
+		case 36: /* job */
+			cmd_opts->job_file_name = optarg;
+			break;
+		case 37: /* ranges */
+			cmd_opts->ranges_str = optarg;
+			break;
+		case 38: /* verify-mask */
+			cmd_opts->vr_mask_file_name = optarg;
+			break;
+		case 39: /* verify-skip */
+			cmd_opts->vr_skip_str = optarg;
+			break;
+		case 40: /* serial */
+			cmd_opts->serial_str = optarg;
+			break;
+		case 41: /* serial-counter */
+			cmd_opts->serial_counter_file_name = optarg;
+			break;
+		case 42: /* file-format */
+			for (i = 0; FWIMG_FMT__COUNT__ > i; i ++) {
+				if (0 == strcasecmp(fwimg_fmt_str[i], optarg))
+					break;
+			}
+			if (FWIMG_FMT__COUNT__ == i) {
+				fprintf(stderr,
+				    "Unknown file format: \"%s\".\n",
+				    optarg);
+				return (EINVAL);
+			}
+			cmd_opts->file_fmt = i;
+			break;
+		case 43: /* sparse */
+			cmd_opts->dump_flags |= DUMPIO_F_SPARSE;
+			break;
+		case 44: /* xform */
+			cmd_opts->xform_str = optarg;
+			break;
+		case 45: /* resume-no-id */
+			cmd_opts->resume_no_id = 1;
+			break;
 		default:
 			return (EINVAL);
 		}
 		opt_idx = -1;
 	}
+	/* Action file is image for -page. */
+	if (0 != cmd_opts->image_count &&
+	    -1 != cmd_opts->action && 3 != cmd_opts->action) {
+		if (NULL != cmd_opts->image_file_name[cmd_opts->page]) {
+			fprintf(stderr,
+			    "Image for page \"%s\" already set.\n",
+			    mp_chip_page_str[cmd_opts->page]);
+			return (EINVAL);
+		}
+		cmd_opts->image_file_name[cmd_opts->page] =
+		    cmd_opts->file_name;
+		cmd_opts->image_count ++;
+	}
+	/* Segmented formats: only for single page verify/write. */
+	if ((1 == cmd_opts->action || 2 == cmd_opts->action) &&
+	    0 == cmd_opts->image_count) {
+		if (-1 == cmd_opts->file_fmt) {
+			cmd_opts->file_fmt = fwimg_fmt_detect(
+			    cmd_opts->file_name);
+		}
+	} else if (0 < cmd_opts->file_fmt) {
+		fprintf(stderr, "File format can be set only for verify / "
+		    "write without images.\n");
+		return (EINVAL);
+	} else {
+		cmd_opts->file_fmt = FWIMG_FMT_RAW;
+	}
+	/* Dump file: new file written from start. */
+	if (0 == cmd_opts->action &&
+	    (0 != cmd_opts->dump_flags ||
+	     0 != dumpio_is_gzip(cmd_opts->file_name))) {
+		if (NULL != cmd_opts->journal_file_name) {
+			fprintf(stderr, "Journal can not be used for sparse "
+			    "or gzip dump.\n");
+			return (EINVAL);
+		}
+		if (0 != dumpio_is_gzip(cmd_opts->file_name) &&
+		    (0 != cmd_opts->file_offset ||
+		     0 != cmd_opts->dump_flags)) {
+			fprintf(stderr, "gzip dump does not allow to set "
+			    "options: file-offset, sparse.\n");
+			return (EINVAL);
+		}
+	} else if (0 != cmd_opts->dump_flags &&
+	    0 != cmd_opts->action) {
+		fprintf(stderr, "Sparse can be set only for read.\n");
+		return (EINVAL);
+	}
+	/* Transforms: single code/data page read/verify/write. */
+	if (NULL != cmd_opts->xform_str) {
+		if (0 > cmd_opts->action || 2 < cmd_opts->action ||
+		    MP_CHIP_PAGE_CONFIG == cmd_opts->page ||
+		    0 != cmd_opts->image_count ||
+		    NULL != cmd_opts->ranges_str ||
+		    NULL != cmd_opts->journal_file_name ||
+		    FWIMG_FMT_RAW != cmd_opts->file_fmt) {
+			fprintf(stderr, "Transforms can be used only for "
+			    "code / data page read / verify / write "
+			    "without: image, ranges, journal, file-format.\n");
+			return (EINVAL);
+		}
+		if (0 != xform_parse(cmd_opts->xform_str, &cmd_opts->xform))
+			return (EINVAL);
+		if (0 == cmd_opts->action &&
+		    1 != cmd_opts->xform.ratio &&
+		    (0 != cmd_opts->dump_flags ||
+		     0 != dumpio_is_gzip(cmd_opts->file_name))) {
+			fprintf(stderr, "Lane read updates file in place: "
+			    "sparse and gzip dump are not supported.\n");
+			return (EINVAL);
+		}
+	}
 
 	return (0);
 }
@@ -290,284 +626,1749 @@ static void
 progress_cb(minipro_p mp __unused, size_t done, size_t total,
     const void *udata) {
 
-	if (done == total) {
-		printf("\r\e[K%sOK.\n", (const char*)udata);
-	} else {
-		printf("\r\e[K%s%zu / %zu bytes - %zu%%",
-		    (const char*)udata, done, total,
-		    ((done * 100) / total));
-	}
-	fflush(stdout);
+	progress_update(progress_out, (const char*)udata, done, total);
 }
 
-int
-main(int argc, char **argv) {
-	int error = 0;
-	cmd_opts_t cmd_opts;
-	minipro_p mp = NULL;
-	chip_p chips_db = NULL, chip = NULL;
-	int fd;
-	uint32_t chip_id_type, chip_id, chip_id_rev, chip_val, buf_val;
-	uint8_t chip_id_size, *file_data = NULL, *chip_data = NULL;
-	size_t file_data_size, chip_data_size;
-	size_t chip_size = 0, tr_size, err_offset, chips_db_count = 0;
+typedef struct progress_chunk_s {
+	const char	*msg;
+	size_t		base;	/* Done before current chunk. */
+	size_t		total;
+} progress_chunk_t, *progress_chunk_p;
+
+static void
+progress_chunk_cb(minipro_p mp, size_t done, size_t total __unused,
+    const void *udata) {
+	const progress_chunk_t *pc = udata;
+
+	progress_cb(mp, (pc->base + done), pc->total, pc->msg);
+}
+
+/* Chip page dump to file, runs in pipeline worker. */
+typedef struct file_sink_s {
+	dumpio_p	dio;
+	off_t		offset;		/* File offset of address. */
+	uint32_t	address;
+} file_sink_t, *file_sink_p;
+
+static int
+file_sink_cb(void *udata, uint32_t addr, const uint8_t *buf,
+    size_t size) {
+	const file_sink_t *fs = udata;
+
+	return (dumpio_write(fs->dio, (fs->offset +
+	    (off_t)(addr - fs->address)), buf, size));
+}
+
+static int
+pipeline_data_cb(minipro_p mp __unused, uint32_t addr,
+    const uint8_t *buf, size_t size, void *udata) {
+
+	return (pipeline_push(udata, addr, buf, size));
+}
+
+static int
+journal_init(minipro_p mp, cmd_opts_p cmd_opts, chip_p chip,
+    uint32_t chip_id, const uint8_t *img, size_t size, journal_p jr) {
+	size_t i, j = 0;
+	journal_t jr_old;
 	off_t file_size;
-	char status_msg[64];
+	minipro_ver_p ver = minipro_ver_get(mp);
 
-	error = cmd_opts_parse(argc, argv, &cmd_opts);
-	if (0 != error) {
-		if (-1 == error)
-			return (0); /* Handled action. */
-		print_usage(argv[0]);
-		return (error);
+	memset(jr, 0x00, sizeof(journal_t));
+	jr->action = cmd_opts->action;
+	jr->page = cmd_opts->page;
+	jr->address = cmd_opts->address;
+	jr->size = size;
+	snprintf(jr->chip_name, sizeof(jr->chip_name), "%s", chip->name);
+	for (i = 0; i < sizeof(ver->serial_num) && 0 != ver->serial_num[i] &&
+	    (j + 1) < sizeof(jr->serial); i ++) {
+		if (0x20 >= ver->serial_num[i] || 0x7e < ver->serial_num[i])
+			continue; /* Printable only, no spaces. */
+		jr->serial[j ++] = (char)ver->serial_num[i];
 	}
+	jr->chip_id = chip_id;
+	jr->image_hash = journal_hash(img, size);
 
-	if (NULL != cmd_opts.chip_name ||
-	    0 != cmd_opts.chip_id_size) {
-		/* Load chips database from file. */
-		printf("Chips DB loading...");
-		if (NULL == cmd_opts.db_file_name) {
-			cmd_opts.db_file_name = DB_FILE_DEF;
+	if (0 == cmd_opts->resume)
+		return (0);
+	if (0 != journal_load(cmd_opts->journal_file_name, &jr_old) ||
+	    0 == journal_is_match(&jr_old, jr)) {
+		printf("Journal not found or does not match job, "
+		    "starting from begin.\n");
+		return (0);
+	}
+	if (0 == jr->action) { /* Is readed data still in file? */
+		if (0 != file_size_get(cmd_opts->file_name, 0, &file_size) ||
+		    (size_t)file_size < ((size_t)cmd_opts->file_offset + jr_old.done)) {
+			printf("Output file is shorter than journal, "
+			    "starting from begin.\n");
+			return (0);
 		}
-		error = chip_db_load(cmd_opts.db_file_name, 0,
-		    &chips_db, &chips_db_count);
-		if (0 != error) {
-			LOG_ERR_FMT(error, "Fail on chips DB load: %s",
-			    cmd_opts.db_file_name);
+	}
+	/* Resumed write skip erase: other unit of same type can not be
+	 * detected without chip ID. */
+	if (2 == jr->action && 0 == chip_id && 0 != jr_old.done &&
+	    0 == cmd_opts->resume_no_id) {
+		fprintf(stderr, "Write can not be resumed without chip ID "
+		    "check, use -resume-no-id to force.\n");
+		return (EPERM);
+	}
+	jr->done = jr_old.done;
+	printf("Resuming from: 0x%08zx, %zu / %zu bytes done.\n",
+	    ((size_t)jr->address + jr->done), jr->done, jr->size);
+
+	return (0);
+}
+
+/* Do page action by chunks, record completed chunks to journal. */
+static int
+journal_page_run(minipro_p mp, cmd_opts_p cmd_opts, journal_p jr,
+    const uint8_t *file_data, const char *status_msg,
+    size_t *err_offset, uint32_t *buf_val, uint32_t *chip_val) {
+	int error = 0, fd = -1;
+	chip_p chip = minipro_chip_get(mp);
+	uint8_t *chip_data = NULL;
+	uint32_t flags = 0;
+	size_t chunk_size, tm, chip_data_size;
+	progress_chunk_t pc;
+
+	chunk_size = (MAX(chip->read_block_size, chip->write_block_size) *
+	    JOURNAL_CHUNK_BLOCKS);
+	pc.msg = status_msg;
+	pc.total = jr->size;
+
+	switch (jr->action) {
+	case 0: /* read. */
+		fd = open(cmd_opts->file_name, (O_WRONLY | O_CREAT), 0600);
+		if (-1 == fd) {
+			error = errno;
+			LOG_ERR(error,
+			    "Fail on file open for chip dump writing.");
 			return (error);
 		}
-		printf("done, %zu loaded.\n", chips_db_count);
-
-		/* Find chip. */
-		if (NULL != cmd_opts.chip_name) { /* By name. */
-			chip = chip_db_get_by_name(chips_db, cmd_opts.chip_name);
-			if (NULL == chip) {
-				fprintf(stderr,
-				    "Chip \"%s\" not found, "
-				    "try one of listed "
-				    "below or type: "
-				    "%s --db-dump | grep %s\n",
-				    cmd_opts.chip_name, basename(argv[0]),
-				    cmd_opts.chip_name);
-				chip_db_dump_flt(chips_db, cmd_opts.chip_name);
-				return (-1);
+		break;
+	case 2: /* write. */
+		/* Resume skip erase: done part must be on chip, chip ID does
+		 * not identify unit, it may be swapped. */
+		if (0 != jr->done) {
+			pc.msg = "Checking written part... ";
+			pc.base = 0;
+			pc.total = jr->done;
+			error = minipro_page_verify(mp, jr->page, jr->address,
+			    file_data, jr->done, err_offset, buf_val,
+			    chip_val, progress_chunk_cb, &pc);
+			if (0 != error) {
+				LOG_ERR(error, "Fail on chip read.");
+				return (error);
 			}
-		} else if (0 != cmd_opts.chip_id_size) { /* By ID. */
-			chip = chip_db_get_by_id(chips_db, cmd_opts.chip_id,
-			    cmd_opts.chip_id_size);
-			if (NULL == chip) {
-				fprintf(stderr, "Chip not found.\n");
-				return (-1);
+			if ((*err_offset) < jr->done) {
+				printf("Written part does not match image at "
+				    "0x%08zx, starting from begin.\n",
+				    ((size_t)jr->address + (*err_offset)));
+				jr->done = 0;
 			}
+			pc.msg = status_msg;
+			pc.total = jr->size;
 		}
-		/* Display chip info. */
-		if (0 == cmd_opts.quiet) {
-			chip_db_print_info(chip);
+		/* Erase only once, before first chunk. */
+		flags = (cmd_opts->write_flags | MP_PAGE_WR_F_NO_ERASE |
+		    MP_PAGE_WR_F_POST_NO_PROTECT);
+		if (0 == jr->done &&
+		    0 == (MP_PAGE_WR_F_NO_ERASE & cmd_opts->write_flags) &&
+		    0 != (CHIP_OPT4_ERASE & chip->opts4)) {
+			progress_cb(mp, 0, 100, "Erasing... ");
+			error = minipro_erase(mp);
+			if (0 != error) {
+				LOG_ERR(error, "Fail on chip erase.");
+				return (error);
+			}
+			progress_cb(mp, 100, 100, "Erasing... ");
 		}
+		break;
 	}
 
-	/* Try to increase process priority. */
-	setpriority(PRIO_PROCESS, 0, PROCESS_PRIORITY);
-#ifdef BSD /* BSD specific code. */
-	struct rtprio rtp;
-	rtp.type = RTP_PRIO_REALTIME;
-	rtp.prio = (u_short)PROCESS_PRIORITY;
-	rtprio(RTP_SET, 0, &rtp);
-#endif
-
-	/* Open MiniPro. */
-	error = minipro_open(MP_TL866_VID, MP_TL866_PID,
-	    (0 == cmd_opts.quiet), &mp);
-	if (0 != error)
-		return (error);
-	/* Check and print device info. */
-	error = minipro_is_version_info_ok(mp);
-	if (0 == cmd_opts.quiet || 0 != error) {
-		minipro_print_info(mp);
+	(*err_offset) = jr->size;
+	while (jr->done < jr->size) {
+		/* Chunks are aligned to chunk_size by chip address. */
+		tm = (chunk_size - (((size_t)jr->address + jr->done) % chunk_size));
+		tm = MIN(tm, (jr->size - jr->done));
+		pc.base = jr->done;
+		switch (jr->action) {
+		case 0: /* read. */
+			error = minipro_page_read(mp, jr->page,
+			    (jr->address + (uint32_t)jr->done), tm,
+			    &chip_data, &chip_data_size,
+			    progress_chunk_cb, &pc);
+			if (0 != error) {
+				LOG_ERR(error, "Fail on chip read.");
+				break;
+			}
+			if (chip_data_size != (size_t)pwrite(fd,
+			    chip_data, chip_data_size,
+			    (cmd_opts->file_offset + (off_t)jr->done))) {
+				error = errno;
+				LOG_ERR(error,
+				    "Fail on chip write data to file.");
+			}
+			free(chip_data);
+			chip_data = NULL;
+			break;
+		case 1: /* verify. */
+			error = minipro_page_verify(mp, jr->page,
+			    (jr->address + (uint32_t)jr->done),
+			    (file_data + jr->done), tm,
+			    err_offset, buf_val, chip_val,
+			    progress_chunk_cb, &pc);
+			if (0 != error) {
+				LOG_ERR(error, "Fail on chip read.");
+				break;
+			}
+			if ((*err_offset) < tm) { /* Not euqual. */
+				(*err_offset) += jr->done;
+				goto err_out;
+			}
+			(*err_offset) = jr->size;
+			break;
+		case 2: /* write. */
+			if ((jr->done + tm) == jr->size &&
+			    0 == (MP_PAGE_WR_F_POST_NO_PROTECT & cmd_opts->write_flags)) {
+				flags &= ~MP_PAGE_WR_F_POST_NO_PROTECT;
+			}
+			error = minipro_page_write(mp, flags,
+			    jr->page, (jr->address + (uint32_t)jr->done),
+			    (file_data + jr->done), tm,
+			    progress_chunk_cb, &pc);
+			if (0 != error) {
+				LOG_ERR(error, "Fail on chip write.");
+				break;
+			}
+			/* Unprotect only before first chunk. */
+			flags |= MP_PAGE_WR_F_PRE_NO_UNPROTECT;
+			break;
+		default:
+			error = EINVAL;
+		}
+		if (0 != error)
+			goto err_out;
+		jr->done += tm;
+		error = journal_save(cmd_opts->journal_file_name, jr);
+		if (0 != error) {
+			LOG_ERR(error, "Fail on journal save.");
+			goto err_out;
+		}
 	}
-	if (0 != error)
-		goto err_out;
 
-	if (3 == cmd_opts.action) { /* hw test. */
-		err_offset = 0;
-		error = minipro_hardware_check(mp, &err_offset);
-		printf("HW test done, error = %i, "
-		    "HW errors count = %zu.\n",
-		    error, err_offset);
-		goto err_out;
+err_out:
+	if (-1 != fd) {
+		close(fd);
 	}
+	return (error);
+}
 
-	/* Check some command line options before continue. */
-	if (NULL == chip) { /* Is chip specified? */
-		fprintf(stderr,
-		    "Chip not specified, can not continue.\n");
-		error = -1;
-		goto err_out;
-	}
-	switch (cmd_opts.page) {
+/* Single page job: check addr/size against chip page. */
+static int
+page_check(cmd_opts_p cmd_opts, chip_p chip, size_t *tr_size) {
+	size_t chip_size;
+
+	switch (cmd_opts->page) {
 	case MP_CHIP_PAGE_CODE:
 	case MP_CHIP_PAGE_DATA:
-		chip_size = ((MP_CHIP_PAGE_CODE == cmd_opts.page) ?
+		chip_size = ((MP_CHIP_PAGE_CODE == cmd_opts->page) ?
 		    chip->code_memory_size :
 		    chip->data_memory_size);
 		if (0 == chip_size) {
 			fprintf(stderr,
 			    "chip page \"%s\" size = 0 - does not exist.\n",
-			    mp_chip_page_str[cmd_opts.page]);
-			error = EINVAL;
-			goto err_out;
+			    mp_chip_page_str[cmd_opts->page]);
+			return (EINVAL);
 		}
-		if (0 != cmd_opts.address &&
-		    0 != cmd_opts.size) {
-			if ((cmd_opts.size - cmd_opts.address) > chip_size) {
+		if (0 != cmd_opts->address &&
+		    0 != cmd_opts->size) {
+			if ((cmd_opts->size - cmd_opts->address) > chip_size) {
 				fprintf(stderr,
 				    "options error: chip page \"%s\" "
 				    "size = %zu, (addr + size) = %zu + "
 				    "%zu = %zu.\n",
-				    mp_chip_page_str[cmd_opts.page],
+				    mp_chip_page_str[cmd_opts->page],
 				    chip_size,
-				    (size_t)cmd_opts.address,
-				    cmd_opts.size,
-				    ((size_t)cmd_opts.address + cmd_opts.size));
-				error = EINVAL;
-				goto err_out;
+				    (size_t)cmd_opts->address,
+				    cmd_opts->size,
+				    ((size_t)cmd_opts->address + cmd_opts->size));
+				return (EINVAL);
 			}
-		} else if (0 != cmd_opts.address) {
-			if (cmd_opts.address > chip_size) {
+		} else if (0 != cmd_opts->address) {
+			if (cmd_opts->address > chip_size) {
 				fprintf(stderr,
 				    "options error: chip page \"%s\" "
 				    "size = %zu, addr = %zu is out of "
 				    "range.\n",
-				    mp_chip_page_str[cmd_opts.page],
+				    mp_chip_page_str[cmd_opts->page],
 				    chip_size,
-				    (size_t)cmd_opts.address);
-				error = EINVAL;
-				goto err_out;
+				    (size_t)cmd_opts->address);
+				return (EINVAL);
 			}
-		} else if (0 != cmd_opts.size) {
-			if (cmd_opts.size > chip_size) {
+		} else if (0 != cmd_opts->size) {
+			if (cmd_opts->size > chip_size) {
 				fprintf(stderr,
 				    "options error: chip page \"%s\" "
 				    "size = %zu, size = %zu is out of "
 				    "range.\n",
-				    mp_chip_page_str[cmd_opts.page],
+				    mp_chip_page_str[cmd_opts->page],
 				    chip_size,
-				    cmd_opts.size);
-				error = EINVAL;
-				goto err_out;
+				    cmd_opts->size);
+				return (EINVAL);
 			}
 		}
-		if (0 == cmd_opts.size) { /* Fixup size. */
-			tr_size = (chip_size - cmd_opts.address);
+		if (0 == cmd_opts->size) { /* Fixup size. */
+			(*tr_size) = (chip_size - cmd_opts->address);
 		} else {
-			tr_size = cmd_opts.size;
+			(*tr_size) = cmd_opts->size;
 		}
-		if (0 == tr_size) {
+		if (0 == (*tr_size)) {
 			fprintf(stderr,
 			    "Data to transfer size set to 0, nothink "
 			    "to do.\n");
-			error = -1;
-			goto err_out;
+			return (-1);
 		}
 		printf("Will transfer: %zu bytes, starting from: "
 		    "0x%08x.\n",
-		    tr_size, cmd_opts.address);
+		    (*tr_size), cmd_opts->address);
 		break;
 	case MP_CHIP_PAGE_CONFIG:
-		if (0 != cmd_opts.file_offset ||
-		    0 != cmd_opts.address ||
-		    0 != cmd_opts.size) {
+		if (0 != cmd_opts->file_offset ||
+		    0 != cmd_opts->address ||
+		    0 != cmd_opts->size) {
 			fprintf(stderr,
 			    "chip page \"%s\" does not allow to set "
 			    "options: file-offset, addr, size.\n",
 			     mp_chip_page_str[MP_CHIP_PAGE_CONFIG]);
-			error = EINVAL;
-			goto err_out;
+			return (EINVAL);
+		}
+		(*tr_size) = 0; /* Autodetect from file size. */
+		if (NULL != cmd_opts->journal_file_name) {
+			printf("Journal is not supported for chip page "
+			    "\"%s\", ignored.\n",
+			    mp_chip_page_str[MP_CHIP_PAGE_CONFIG]);
+			cmd_opts->journal_file_name = NULL;
 		}
-		tr_size = 0; /* Autodetect from file size. */
 		break;
 	default:
-		error = EINVAL;
-		goto err_out;
+		return (EINVAL);
 	}
 
-	/* Set chip info. */
-	error = minipro_chip_set(mp, chip, cmd_opts.icsp);
-	if (0 != error)
-		goto err_out;
+	return (0);
+}
 
-	/* Verify Chip ID (if applicable). */
-	if (0 == cmd_opts.chip_id_check_disable &&
-	    ((0 != chip->chip_id_size && 0 != chip->chip_id) ||
-	     0 != (CHIP_OPT4_CHIP_ID & chip->opts4))) {
-		error = minipro_get_chip_id(mp, &chip_id_type,
-		    &chip_id, &chip_id_size, &chip_id_rev);
-		if (0 != error) {
-			LOG_ERR(error, "Fail on chip ID read.");
-			goto err_out;
-		}
-		if (is_chip_id_prob_eq(chip, chip_id, chip_id_size)) {
-			printf("Chip ID OK: expected 0x%02x, "
-			    "got 0x%02x rev 0x%02x.\n",
-			    chip->chip_id, chip_id, chip_id_rev);
-		} else {
-			if (0 != cmd_opts.chip_id_check_no_fail) {
-				printf("WARNING: Chip ID mismatch: "
-				    "expected 0x%02x, "
-				    "got 0x%02x rev 0x%02x.\n",
-				    chip->chip_id, chip_id,
-				    chip_id_rev);
-				chip_db_print_info(chip_db_get_by_id(
-				    chips_db, chip_id, chip_id_size));
-			} else {
-				fprintf(stderr,
-				    "Invalid Chip ID: expected 0x%02x, "
-				    "got 0x%02x rev 0x%02x\n"
-				    "(use '-y' to continue anyway at "
-				    "your own risk).\n",
-				    chip->chip_id, chip_id,
-				    chip_id_rev);
-				chip_db_print_info(chip_db_get_by_id(
-				    chips_db, chip_id, chip_id_size));
-				error = -1;
+/* Code/data page size, 0 - no page. */
+static size_t
+page_size_get(chip_p chip, int page) {
+
+	switch (page) {
+	case MP_CHIP_PAGE_CODE:
+		return (chip->code_memory_size);
+	case MP_CHIP_PAGE_DATA:
+		return (chip->data_memory_size);
+	}
+
+	return (0);
+}
+
+/* Multi page job: whole pages only, all must exist. */
+static int
+pages_check(cmd_opts_p cmd_opts, chip_p chip) {
+	int page;
+
+	if (0 > cmd_opts->action || 2 < cmd_opts->action) {
+		fprintf(stderr,
+		    "Images set, but read / verify / write - not "
+		    "specified.\n");
+		return (-1);
+	}
+	if (0 != cmd_opts->file_offset ||
+	    0 != cmd_opts->address ||
+	    0 != cmd_opts->size ||
+	    NULL != cmd_opts->wr_fill_file_name ||
+	    NULL != cmd_opts->journal_file_name ||
+	    NULL != cmd_opts->vr_mask_file_name ||
+	    NULL != cmd_opts->vr_skip_str) {
+		fprintf(stderr,
+		    "Multi page job does not allow to set options: "
+		    "file-offset, addr, size, fill-from, journal, "
+		    "verify-mask, verify-skip.\n");
+		return (EINVAL);
+	}
+	for (page = MP_CHIP_PAGE_CODE; MP_CHIP_PAGE__COUNT__ > page;
+	    page ++) {
+		if (NULL == cmd_opts->image_file_name[page])
+			continue;
+		if ((MP_CHIP_PAGE_CONFIG == page) ?
+		    (NULL == chip->fuses) :
+		    (0 == page_size_get(chip, page))) {
+			fprintf(stderr,
+			    "chip page \"%s\" does not exist.\n",
+			    mp_chip_page_str[page]);
+			return (EINVAL);
+		}
+	}
+	if (0 != chip->data_memory2_size) {
+		printf("Warning: chip second data memory (%"PRIu32" "
+		    "bytes) is not supported, skipped.\n",
+		    chip->data_memory2_size);
+	}
+
+	return (0);
+}
+
+/* Load page image for verify/write, code/data: not more than page. */
+static int
+pages_image_load(cmd_opts_p cmd_opts, chip_p chip, int page,
+    uint8_t **buf, size_t *buf_size) {
+	int error;
+	off_t file_size;
+	size_t page_size = page_size_get(chip, page), tr_size = 0;
+	const char *file_name = cmd_opts->image_file_name[page];
+
+	if (0 != page_size) {
+		error = dumpio_file_size_get(file_name, &file_size);
+		if (0 != error) {
+			LOG_ERR_FMT(error, "Fail on get file size: %s",
+			    file_name);
+			return (error);
+		}
+		tr_size = page_size;
+		if ((size_t)file_size < page_size) {
+			if (0 != cmd_opts->size_error) {
+				fprintf(stderr,
+				    "Incorrect file size: %s: %zu, needed "
+				    "%zu for page \"%s\".\n",
+				    file_name, (size_t)file_size, page_size,
+				    mp_chip_page_str[page]);
+				return (-1);
+			} else if (0 == cmd_opts->size_error_no_warn) {
+				printf("Warning: Incorrect file size: %s: "
+				    "%zu, needed %zu for page \"%s\".\n",
+				    file_name, (size_t)file_size, page_size,
+				    mp_chip_page_str[page]);
+			}
+			tr_size = 0; /* All file. */
+		}
+	}
+	error = dumpio_read_file(file_name, 0, tr_size, MAX_CHIP_FILE_SIZE,
+	    buf, buf_size);
+	LOG_ERR_FMT(error, "Fail on file read: %s", file_name);
+
+	return (error);
+}
+
+/* Multi page job in one session: code, data, config order, so fuses
+ * and lock bits written last. Write: single erase before first page,
+ * unprotect before first and protect after last page. */
+static int
+pages_run(minipro_p mp, cmd_opts_p cmd_opts, metrics_p metrics) {
+	int error = 0, cerror, page, last = 0;
+	chip_p chip = minipro_chip_get(mp);
+	dumpio_p dio;
+	uint8_t *data[MP_CHIP_PAGE__COUNT__];
+	size_t data_size[MP_CHIP_PAGE__COUNT__], err_offset;
+	uint32_t flags, buf_val, chip_val;
+	char status_msg[64];
+
+	memset(data, 0x00, sizeof(data));
+	memset(data_size, 0x00, sizeof(data_size));
+	metrics->bytes = 0;
+	for (page = MP_CHIP_PAGE_CODE; MP_CHIP_PAGE__COUNT__ > page;
+	    page ++) {
+		if (NULL != cmd_opts->image_file_name[page]) {
+			last = page;
+		}
+	}
+
+	if (0 == cmd_opts->action) { /* read. */
+		metrics_phase_set(metrics, METRICS_PH_READ);
+		for (page = MP_CHIP_PAGE_CODE; MP_CHIP_PAGE__COUNT__ > page;
+		    page ++) {
+			if (NULL == cmd_opts->image_file_name[page])
+				continue;
+			snprintf(status_msg, sizeof(status_msg),
+			    "Reading %s... ", mp_chip_page_str[page]);
+			error = minipro_page_read(mp, page, 0,
+			    page_size_get(chip, page),
+			    &data[page], &data_size[page],
+			    progress_cb, (void*)status_msg);
+			if (0 != error) {
+				LOG_ERR(error, "Fail on chip read.");
+				goto err_out;
+			}
+			metrics->bytes += data_size[page];
+			error = dumpio_open(cmd_opts->image_file_name[page],
+			    cmd_opts->dump_flags, &dio);
+			if (0 != error) {
+				LOG_ERR(error,
+				    "Fail on file open for chip dump writing.");
+				goto err_out;
+			}
+			error = dumpio_write(dio, 0, data[page],
+			    data_size[page]);
+			LOG_ERR(error, "Fail on chip write data to file.");
+			cerror = dumpio_close(dio);
+			if (0 == error) {
+				error = cerror;
+				LOG_ERR(error, "Fail on chip dump file finish.");
+			}
+			if (0 != error)
+				goto err_out;
+		}
+		goto err_out;
+	}
+
+	/* verify / write: load all images before touch chip. */
+	metrics_phase_set(metrics, METRICS_PH_FILE);
+	for (page = MP_CHIP_PAGE_CODE; MP_CHIP_PAGE__COUNT__ > page;
+	    page ++) {
+		if (NULL == cmd_opts->image_file_name[page])
+			continue;
+		error = pages_image_load(cmd_opts, chip, page,
+		    &data[page], &data_size[page]);
+		if (0 != error)
+			goto err_out;
+		metrics->bytes += data_size[page];
+	}
+
+	if (2 == cmd_opts->action) { /* write. */
+		minipro_write_fill_set(mp, cmd_opts->wr_fill,
+		    cmd_opts->wr_fill_val, NULL, 0);
+		flags = (cmd_opts->write_flags | MP_PAGE_WR_F_NO_ERASE |
+		    MP_PAGE_WR_F_POST_NO_PROTECT);
+		if (0 == (MP_PAGE_WR_F_NO_ERASE & cmd_opts->write_flags) &&
+		    0 != (CHIP_OPT4_ERASE & chip->opts4)) {
+			metrics_phase_set(metrics, METRICS_PH_ERASE);
+			progress_cb(mp, 0, 100, "Erasing... ");
+			error = minipro_erase(mp);
+			if (0 != error) {
+				LOG_ERR(error, "Fail on chip erase.");
+				goto err_out;
+			}
+			progress_cb(mp, 100, 100, "Erasing... ");
+		}
+		metrics_phase_set(metrics, METRICS_PH_WRITE);
+		for (page = MP_CHIP_PAGE_CODE; MP_CHIP_PAGE__COUNT__ > page;
+		    page ++) {
+			if (NULL == data[page])
+				continue;
+			if (last == page &&
+			    0 == (MP_PAGE_WR_F_POST_NO_PROTECT & cmd_opts->write_flags)) {
+				flags &= ~MP_PAGE_WR_F_POST_NO_PROTECT;
+			}
+			snprintf(status_msg, sizeof(status_msg),
+			    "Writing %s... ", mp_chip_page_str[page]);
+			error = minipro_page_write(mp, flags, page, 0,
+			    data[page], data_size[page],
+			    progress_cb, (void*)status_msg);
+			if (0 != error) {
+				LOG_ERR(error, "Fail on chip write.");
+				goto err_out;
+			}
+			flags |= MP_PAGE_WR_F_PRE_NO_UNPROTECT;
+		}
+		if (0 == cmd_opts->post_wr_verify) /* Verify disabled. */
+			goto err_out;
+	}
+
+	/* verify. */
+	metrics_phase_set(metrics, METRICS_PH_VERIFY);
+	for (page = MP_CHIP_PAGE_CODE; MP_CHIP_PAGE__COUNT__ > page;
+	    page ++) {
+		if (NULL == data[page])
+			continue;
+		snprintf(status_msg, sizeof(status_msg),
+		    "Verifying %s... ", mp_chip_page_str[page]);
+		error = minipro_page_verify(mp, page, 0,
+		    data[page], data_size[page],
+		    &err_offset, &buf_val, &chip_val,
+		    progress_cb, (void*)status_msg);
+		if (0 != error) {
+			LOG_ERR(error, "Fail on chip read.");
+			goto err_out;
+		}
+		if (err_offset >= data_size[page])
+			continue;
+		metrics->verify_fail = 1;
+		if (MP_CHIP_PAGE_CONFIG == page) {
+			fprintf(stderr,
+			    "\nVerification failed "
+			    "fuse 0x%02zx - %s, "
+			    "written: 0x%02x, readed: 0x%02x.\n",
+			    err_offset, chip->fuses[err_offset].name,
+			    buf_val, chip_val);
+		} else {
+			fprintf(stderr,
+			    "\nVerification failed %s "
+			    "at address: 0x%02zx, "
+			    "written: 0x%02x, readed: 0x%02x.\n",
+			    mp_chip_page_str[page],
+			    err_offset, buf_val, chip_val);
+		}
+	}
+
+err_out:
+	for (page = MP_CHIP_PAGE_CODE; MP_CHIP_PAGE__COUNT__ > page;
+	    page ++) {
+		free(data[page]);
+	}
+
+	return (error);
+}
+
+#define RANGES_MAP_SIZE_MAX	(16 * 1024 * 1024)
+#define RANGES_PREALLOC		16
+
+/* Parse "<addr>:<size>[:<file_offset>]" items, separated by comma,
+ * space or new line, '#' - comment to line end. */
+static int
+ranges_parse(const char *str, size_t str_size, mp_range_p *ranges_ret,
+    size_t *count_ret) {
+	int error = 0;
+	size_t i, tm, fcount, count = 0, allocated = 0;
+	const char *ptr, *end = (str + str_size), *item, *fld[3];
+	size_t fld_size[3];
+	mp_range_p ranges = NULL;
+
+	for (ptr = str; ptr < end;) {
+		/* Skip separators and comments. */
+		if (',' == (*ptr) || ' ' == (*ptr) || '\t' == (*ptr) ||
+		    '\r' == (*ptr) || '\n' == (*ptr)) {
+			ptr ++;
+			continue;
+		}
+		if ('#' == (*ptr)) {
+			while (ptr < end && '\n' != (*ptr)) {
+				ptr ++;
+			}
+			continue;
+		}
+		/* Item. */
+		item = ptr;
+		while (ptr < end && ',' != (*ptr) && ' ' != (*ptr) &&
+		    '\t' != (*ptr) && '\r' != (*ptr) && '\n' != (*ptr) &&
+		    '#' != (*ptr)) {
+			ptr ++;
+		}
+		for (fcount = 0, i = 0; fcount < 3; fcount ++) {
+			fld[fcount] = (item + i);
+			for (tm = 0; (i + tm) < (size_t)(ptr - item) &&
+			    ':' != item[(i + tm)]; tm ++)
+				;
+			fld_size[fcount] = tm;
+			i += (tm + 1);
+			if (i > (size_t)(ptr - item))
+				break;
+		}
+		if (3 <= fcount || 0 == fcount ||
+		    0 == fld_size[0] || 0 == fld_size[1]) {
+			fprintf(stderr, "Bad range: \"%.*s\".\n",
+			    (int)(ptr - item), item);
+			error = EINVAL;
+			goto err_out;
+		}
+		error = realloc_items((void**)&ranges, sizeof(mp_range_t),
+		    &allocated, RANGES_PREALLOC, count);
+		if (0 != error)
+			goto err_out;
+		ranges[count].address = strh2u32(fld[0], fld_size[0]);
+		ranges[count].size = strh2usize(fld[1], fld_size[1]);
+		ranges[count].offset = ((2 == fcount && 0 != fld_size[2]) ?
+		    strh2usize(fld[2], fld_size[2]) : ranges[count].address);
+		if (0 == ranges[count].size) {
+			fprintf(stderr, "Bad range: \"%.*s\": size = 0.\n",
+			    (int)(ptr - item), item);
+			error = EINVAL;
+			goto err_out;
+		}
+		count ++;
+	}
+	if (0 == count) {
+		error = ENOENT;
+		goto err_out;
+	}
+	(*ranges_ret) = ranges;
+	(*count_ret) = count;
+
+	return (0);
+
+err_out:
+	free(ranges);
+	return (error);
+}
+
+/* List from command line or "@<map_file>". */
+static int
+ranges_load(const char *str, mp_range_p *ranges_ret, size_t *count_ret) {
+	int error;
+	uint8_t *buf = NULL;
+	size_t buf_size;
+
+	if ('@' == str[0]) { /* Map file. */
+		error = read_file((str + 1), 0, 0, 0, RANGES_MAP_SIZE_MAX,
+		    &buf, &buf_size);
+		if (0 != error) {
+			LOG_ERR_FMT(error, "Fail on ranges map file read: %s",
+			    (str + 1));
+			return (error);
+		}
+		error = ranges_parse((const char*)buf, buf_size,
+		    ranges_ret, count_ret);
+		free(buf);
+	} else {
+		error = ranges_parse(str, strlen(str), ranges_ret, count_ret);
+	}
+	LOG_ERR(error, "Fail on ranges parse.");
+
+	return (error);
+}
+
+/* Ranges job: read/verify of code/data page only. */
+static int
+ranges_check(cmd_opts_p cmd_opts, chip_p chip) {
+	int error;
+	size_t i, chip_size, total = 0;
+
+	if (0 != cmd_opts->action && 1 != cmd_opts->action) {
+		fprintf(stderr, "Ranges can be used only with read / "
+		    "verify.\n");
+		return (EINVAL);
+	}
+	if (0 == cmd_opts->action &&
+	    (0 != cmd_opts->dump_flags ||
+	     0 != dumpio_is_gzip(cmd_opts->file_name))) {
+		fprintf(stderr, "Ranges read updates file in place: "
+		    "sparse and gzip dump are not supported.\n");
+		return (EINVAL);
+	}
+	if (0 != cmd_opts->file_offset ||
+	    0 != cmd_opts->address ||
+	    0 != cmd_opts->size ||
+	    0 != cmd_opts->image_count ||
+	    NULL != cmd_opts->journal_file_name) {
+		fprintf(stderr,
+		    "Ranges does not allow to set options: "
+		    "file-offset, addr, size, image, journal.\n");
+		return (EINVAL);
+	}
+	chip_size = page_size_get(chip, cmd_opts->page);
+	if (0 == chip_size) {
+		fprintf(stderr,
+		    "chip page \"%s\" does not exist or not supported "
+		    "for ranges.\n", mp_chip_page_str[cmd_opts->page]);
+		return (EINVAL);
+	}
+	error = ranges_load(cmd_opts->ranges_str, &cmd_opts->ranges,
+	    &cmd_opts->ranges_count);
+	if (0 != error)
+		return (error);
+	for (i = 0; i < cmd_opts->ranges_count; i ++) {
+		if (((size_t)cmd_opts->ranges[i].address +
+		    cmd_opts->ranges[i].size) > chip_size) {
+			fprintf(stderr,
+			    "options error: chip page \"%s\" "
+			    "size = %zu, range 0x%08x + %zu is out of "
+			    "range.\n",
+			    mp_chip_page_str[cmd_opts->page], chip_size,
+			    cmd_opts->ranges[i].address,
+			    cmd_opts->ranges[i].size);
+			return (EINVAL);
+		}
+		total += cmd_opts->ranges[i].size;
+	}
+	printf("Will transfer: %zu bytes in %zu ranges.\n",
+	    total, cmd_opts->ranges_count);
+
+	return (0);
+}
+
+static int
+ranges_run(minipro_p mp, cmd_opts_p cmd_opts, metrics_p metrics) {
+	int error = 0, fd;
+	uint8_t *buf = NULL;
+	size_t i, buf_size = 0, file_data_size, err_offset;
+	uint32_t buf_val, chip_val;
+	char status_msg[64];
+	mp_range_p r = cmd_opts->ranges;
+
+	metrics->bytes = 0;
+	for (i = 0; i < cmd_opts->ranges_count; i ++) {
+		buf_size = MAX(buf_size, (r[i].offset + r[i].size));
+		metrics->bytes += r[i].size;
+	}
+
+	if (0 == cmd_opts->action) { /* read. */
+		metrics_phase_set(metrics, METRICS_PH_READ);
+		buf = malloc(buf_size);
+		if (NULL == buf)
+			return (ENOMEM);
+		snprintf(status_msg, sizeof(status_msg),
+		    "Reading %s ranges... ",
+		    mp_chip_page_str[cmd_opts->page]);
+		error = minipro_page_read_ranges(mp, cmd_opts->page,
+		    r, cmd_opts->ranges_count, buf, buf_size,
+		    progress_cb, (void*)status_msg);
+		if (0 != error) {
+			LOG_ERR(error, "Fail on chip read.");
+			goto err_out;
+		}
+		/* Only ranges are written, rest of file is kept. */
+		fd = open(cmd_opts->file_name, (O_WRONLY | O_CREAT), 0600);
+		if (-1 == fd) {
+			error = errno;
+			LOG_ERR(error,
+			    "Fail on file open for chip dump writing.");
+			goto err_out;
+		}
+		for (i = 0; i < cmd_opts->ranges_count; i ++) {
+			if (r[i].size == (size_t)pwrite(fd,
+			    (buf + r[i].offset), r[i].size,
+			    (off_t)r[i].offset))
+				continue;
+			error = errno;
+			LOG_ERR(error, "Fail on chip write data to file.");
+			break;
+		}
+		close(fd);
+		goto err_out;
+	}
+
+	/* verify. */
+	metrics_phase_set(metrics, METRICS_PH_FILE);
+	error = dumpio_read_file(cmd_opts->file_name, 0, 0,
+	    MAX_CHIP_FILE_SIZE, &buf, &file_data_size);
+	if (0 != error) {
+		LOG_ERR(error, "Fail on file read.");
+		return (error);
+	}
+	if (file_data_size < buf_size) {
+		fprintf(stderr,
+		    "Incorrect file size: %zu, needed at least %zu "
+		    "for ranges.\n", file_data_size, buf_size);
+		error = -1;
+		goto err_out;
+	}
+	metrics_phase_set(metrics, METRICS_PH_VERIFY);
+	snprintf(status_msg, sizeof(status_msg),
+	    "Verifying %s ranges... ", mp_chip_page_str[cmd_opts->page]);
+	error = minipro_page_verify_ranges(mp, cmd_opts->page,
+	    r, cmd_opts->ranges_count, buf, buf_size,
+	    &err_offset, &buf_val, &chip_val,
+	    progress_cb, (void*)status_msg);
+	if (0 != error) {
+		LOG_ERR(error, "Fail on chip read.");
+		goto err_out;
+	}
+	if (err_offset >= buf_size)
+		goto err_out;
+	metrics->verify_fail = 1;
+	/* File offset to chip address. */
+	for (i = 0; i < cmd_opts->ranges_count; i ++) {
+		if (err_offset < r[i].offset ||
+		    err_offset >= (r[i].offset + r[i].size))
+			continue;
+		fprintf(stderr,
+		    "\nVerification failed "
+		    "at address: 0x%02zx, "
+		    "written: 0x%02x, readed: 0x%02x.\n",
+		    ((size_t)r[i].address + (err_offset - r[i].offset)),
+		    buf_val, chip_val);
+		break;
+	}
+
+err_out:
+	free(buf);
+
+	return (error);
+}
+
+/* Read: chip data to file format in place, lane: merged to other lanes
+ * of existing file part, rest is 0xff. */
+static int
+xform_file_data(cmd_opts_p cmd_opts, uint8_t *chip_data, size_t size,
+    uint8_t **buf_ret, size_t *buf_size_ret) {
+	int error;
+	uint8_t *buf, *old = NULL;
+	size_t buf_size, old_size = 0;
+	xform_p xf = &cmd_opts->xform;
+
+	if (1 == xf->ratio) {
+		(*buf_ret) = chip_data;
+		(*buf_size_ret) = size;
+		return (xform_to_file(xf, chip_data, size, NULL));
+	}
+	buf_size = (size * xf->ratio);
+	buf = malloc(buf_size);
+	if (NULL == buf)
+		return (ENOMEM);
+	memset(buf, 0xff, buf_size);
+	if (0 == dumpio_read_file(cmd_opts->file_name,
+	    cmd_opts->file_offset, 0, MAX_CHIP_FILE_SIZE,
+	    &old, &old_size)) {
+		memcpy(buf, old, MIN(old_size, buf_size));
+		free(old);
+	}
+	error = xform_to_file(xf, chip_data, size, buf);
+	if (0 != error) {
+		free(buf);
+		return (error);
+	}
+	(*buf_ret) = buf;
+	(*buf_size_ret) = buf_size;
+
+	return (0);
+}
+
+/* Segmented file: code/data page, segment addresses are page
+ * addresses. */
+static int
+segs_check(cmd_opts_p cmd_opts, chip_p chip) {
+	int error;
+	size_t page_size, end;
+	fwimg_p img = &cmd_opts->fwimg;
+
+	page_size = page_size_get(chip, cmd_opts->page);
+	if (0 == page_size) {
+		fprintf(stderr,
+		    "chip page \"%s\" does not exist or not supported "
+		    "for %s file.\n", mp_chip_page_str[cmd_opts->page],
+		    fwimg_fmt_str[cmd_opts->file_fmt]);
+		return (EINVAL);
+	}
+	if (0 != cmd_opts->file_offset ||
+	    0 != cmd_opts->address ||
+	    0 != cmd_opts->size ||
+	    NULL != cmd_opts->ranges_str ||
+	    NULL != cmd_opts->journal_file_name ||
+	    NULL != cmd_opts->serial_str) {
+		fprintf(stderr,
+		    "%s file does not allow to set options: "
+		    "file-offset, addr, size, ranges, journal, serial.\n",
+		    fwimg_fmt_str[cmd_opts->file_fmt]);
+		return (EINVAL);
+	}
+	error = fwimg_load(cmd_opts->file_name, cmd_opts->file_fmt,
+	    page_size, img);
+	if (0 != error) {
+		LOG_ERR_FMT(error, "Fail on %s file load: %s",
+		    fwimg_fmt_str[cmd_opts->file_fmt], cmd_opts->file_name);
+		return (error);
+	}
+	end = ((size_t)img->segs[(img->count - 1)].address +
+	    img->segs[(img->count - 1)].size);
+	if (end > page_size) {
+		fprintf(stderr,
+		    "options error: chip page \"%s\" size = %zu, "
+		    "file data up to 0x%08zx is out of range.\n",
+		    mp_chip_page_str[cmd_opts->page], page_size, end);
+		return (EINVAL);
+	}
+	printf("Will transfer: %zu bytes in %zu segments, "
+	    "from: 0x%08x to: 0x%08zx.\n", img->data_size, img->count,
+	    img->segs[0].address, end);
+
+	return (0);
+}
+
+/* Segments from i that share chip write blocks, returns next not
+ * shared segment index; end - coalesced range end address. */
+static size_t
+segs_coalesce(fwimg_p img, size_t i, size_t blk_size, size_t *end) {
+	mp_range_p r = img->segs;
+
+	(*end) = ((size_t)r[i].address + r[i].size);
+	for (i ++; i < img->count; i ++) {
+		if ((r[i].address / blk_size) > (((*end) - 1) / blk_size))
+			break;
+		(*end) = ((size_t)r[i].address + r[i].size);
+	}
+
+	return (i);
+}
+
+/* Coalesced segments [i, j) data to buf, gaps between segments are
+ * filled with -fill byte or chip content. */
+static int
+segs_coalesce_buf(minipro_p mp, cmd_opts_p cmd_opts, size_t i, size_t j,
+    uint8_t *buf, size_t buf_size, mp_range_p gaps) {
+	int error;
+	size_t k, gaps_cnt = 0;
+	fwimg_p img = &cmd_opts->fwimg;
+	mp_range_p r = img->segs, g;
+
+	for (k = i; k < j; k ++) {
+		memcpy((buf + (r[k].address - r[i].address)),
+		    (img->data + r[k].offset), r[k].size);
+		if ((k + 1) == j)
+			break;
+		g = &gaps[gaps_cnt];
+		g->address = (r[k].address + (uint32_t)r[k].size);
+		g->size = (r[(k + 1)].address - g->address);
+		g->offset = (g->address - r[i].address);
+		if (0 != cmd_opts->wr_fill) {
+			memset((buf + g->offset), cmd_opts->wr_fill_val,
+			    g->size);
+		} else {
+			gaps_cnt ++;
+		}
+	}
+	if (0 == gaps_cnt)
+		return (0);
+	/* Keep chip content. */
+	error = minipro_page_read_ranges(mp, cmd_opts->page,
+	    gaps, gaps_cnt, buf, buf_size, NULL, NULL);
+	if (0 != error) {
+		LOG_ERR(error, "Fail on chip read.");
+		return (error);
+	}
+
+	return (0);
+}
+
+/* Segmented file verify/write: populated segments only, single erase
+ * and protect cycle. Segments sharing write block are coalesced, gaps
+ * between them filled with -fill byte or chip content, so every block
+ * is programmed once. Unaligned edges are merged with chip content or
+ * -fill byte by minipro_write_buf(). */
+static int
+segs_run(minipro_p mp, cmd_opts_p cmd_opts, metrics_p metrics) {
+	int error = 0;
+	chip_p chip = minipro_chip_get(mp);
+	size_t i, j, n, cnt, end, run_size, err_offset;
+	size_t buf_size = 0;
+	uint32_t flags, buf_val, chip_val;
+	uint8_t *buf = NULL, *tmbuf;
+	const uint8_t *data;
+	char status_msg[64];
+	fwimg_p img = &cmd_opts->fwimg;
+	mp_range_p r = img->segs, gaps = NULL;
+
+	metrics->bytes = img->data_size;
+	if (2 == cmd_opts->action) { /* write. */
+		minipro_write_fill_set(mp, cmd_opts->wr_fill,
+		    cmd_opts->wr_fill_val, NULL, 0);
+		flags = (cmd_opts->write_flags | MP_PAGE_WR_F_NO_ERASE |
+		    MP_PAGE_WR_F_POST_NO_PROTECT);
+		if (0 == (MP_PAGE_WR_F_NO_ERASE & cmd_opts->write_flags) &&
+		    0 != (CHIP_OPT4_ERASE & chip->opts4)) {
+			metrics_phase_set(metrics, METRICS_PH_ERASE);
+			progress_cb(mp, 0, 100, "Erasing... ");
+			error = minipro_erase(mp);
+			if (0 != error) {
+				LOG_ERR(error, "Fail on chip erase.");
+				return (error);
+			}
+			progress_cb(mp, 100, 100, "Erasing... ");
+		}
+		metrics_phase_set(metrics, METRICS_PH_WRITE);
+		cnt = 0;
+		for (i = 0; i < img->count; cnt ++) {
+			i = segs_coalesce(img, i, chip->write_block_size, &end);
+		}
+		if (1 < img->count) {
+			gaps = malloc(((img->count - 1) * sizeof(mp_range_t)));
+			if (NULL == gaps)
+				return (ENOMEM);
+		}
+		for (i = 0, n = 0; i < img->count; i = j, n ++) {
+			j = segs_coalesce(img, i, chip->write_block_size, &end);
+			run_size = (end - r[i].address);
+			if ((i + 1) == j) { /* Single segment. */
+				data = (img->data + r[i].offset);
+			} else {
+				if (buf_size < run_size) {
+					tmbuf = realloc(buf, run_size);
+					if (NULL == tmbuf) {
+						error = ENOMEM;
+						goto err_out;
+					}
+					buf = tmbuf;
+					buf_size = run_size;
+				}
+				error = segs_coalesce_buf(mp, cmd_opts, i, j,
+				    buf, run_size, gaps);
+				if (0 != error)
+					goto err_out;
+				data = buf;
+			}
+			if (j == img->count &&
+			    0 == (MP_PAGE_WR_F_POST_NO_PROTECT & cmd_opts->write_flags)) {
+				flags &= ~MP_PAGE_WR_F_POST_NO_PROTECT;
+			}
+			snprintf(status_msg, sizeof(status_msg),
+			    "Writing %s %zu/%zu... ",
+			    mp_chip_page_str[cmd_opts->page], (n + 1), cnt);
+			error = minipro_page_write(mp, flags, cmd_opts->page,
+			    r[i].address, data, run_size,
+			    progress_cb, (void*)status_msg);
+			if (0 != error) {
+				LOG_ERR(error, "Fail on chip write.");
 				goto err_out;
 			}
+			flags |= MP_PAGE_WR_F_PRE_NO_UNPROTECT;
+		}
+		free(buf);
+		free(gaps);
+		buf = NULL;
+		gaps = NULL;
+		if (0 == cmd_opts->post_wr_verify) /* Verify disabled. */
+			return (0);
+	}
+
+	/* verify. */
+	metrics_phase_set(metrics, METRICS_PH_VERIFY);
+	snprintf(status_msg, sizeof(status_msg),
+	    "Verifying %s segments... ", mp_chip_page_str[cmd_opts->page]);
+	error = minipro_page_verify_ranges(mp, cmd_opts->page,
+	    r, img->count, img->data, img->data_size,
+	    &err_offset, &buf_val, &chip_val,
+	    progress_cb, (void*)status_msg);
+	if (0 != error) {
+		LOG_ERR(error, "Fail on chip read.");
+		return (error);
+	}
+	if (err_offset >= img->data_size)
+		return (0);
+	metrics->verify_fail = 1;
+	/* Data offset to chip address. */
+	for (i = 0; i < img->count; i ++) {
+		if (err_offset < r[i].offset ||
+		    err_offset >= (r[i].offset + r[i].size))
+			continue;
+		fprintf(stderr,
+		    "\nVerification failed "
+		    "at address: 0x%02zx, "
+		    "written: 0x%02x, readed: 0x%02x.\n",
+		    ((size_t)r[i].address + (err_offset - r[i].offset)),
+		    buf_val, chip_val);
+		break;
+	}
+
+	return (0);
+
+err_out:
+	free(buf);
+	free(gaps);
+
+	return (error);
+}
+
+/* Read and check chip ID if chip has it: -y - warn only, -f - skip.
+ * chip_id_checked: readed ID, unchanged if not readed. */
+static int
+chip_id_check(minipro_p mp, cmd_opts_p cmd_opts, chip_p chips_db,
+    chip_p chip, uint32_t *chip_id_checked) {
+	int error;
+	uint32_t chip_id_type, chip_id, chip_id_rev;
+	uint8_t chip_id_size;
+
+	if (0 != cmd_opts->chip_id_check_disable ||
+	    ((0 == chip->chip_id_size || 0 == chip->chip_id) &&
+	     0 == (CHIP_OPT4_CHIP_ID & chip->opts4)))
+		return (0);
+	error = minipro_get_chip_id(mp, &chip_id_type,
+	    &chip_id, &chip_id_size, &chip_id_rev);
+	if (0 != error) {
+		LOG_ERR(error, "Fail on chip ID read.");
+		return (error);
+	}
+	(*chip_id_checked) = chip_id;
+	if (is_chip_id_prob_eq(chip, chip_id, chip_id_size)) {
+		printf("Chip ID OK: expected 0x%02x, "
+		    "got 0x%02x rev 0x%02x.\n",
+		    chip->chip_id, chip_id, chip_id_rev);
+		return (0);
+	}
+	if (0 != cmd_opts->chip_id_check_no_fail) {
+		printf("WARNING: Chip ID mismatch: "
+		    "expected 0x%02x, "
+		    "got 0x%02x rev 0x%02x.\n",
+		    chip->chip_id, chip_id, chip_id_rev);
+		chip_db_print_info(chip_db_get_by_id(
+		    chips_db, chip_id, chip_id_size));
+		return (0);
+	}
+	fprintf(stderr,
+	    "Invalid Chip ID: expected 0x%02x, "
+	    "got 0x%02x rev 0x%02x\n"
+	    "(use '-y' to continue anyway at "
+	    "your own risk).\n",
+	    chip->chip_id, chip_id, chip_id_rev);
+	chip_db_print_info(chip_db_get_by_id(
+	    chips_db, chip_id, chip_id_size));
+
+	return (-1);
+}
+
+/* Serialization: single code/data page write only. */
+static int
+serial_check(cmd_opts_p cmd_opts, serial_p serial) {
+
+	if (2 != cmd_opts->action ||
+	    (MP_CHIP_PAGE_CODE != cmd_opts->page &&
+	     MP_CHIP_PAGE_DATA != cmd_opts->page)) {
+		fprintf(stderr, "Serial can be used only with code / data "
+		    "page write.\n");
+		return (EINVAL);
+	}
+	if (1 < cmd_opts->image_count ||
+	    NULL != cmd_opts->ranges_str ||
+	    NULL != cmd_opts->journal_file_name) {
+		fprintf(stderr,
+		    "Serial does not allow to set options: "
+		    "image, ranges, journal.\n");
+		return (EINVAL);
+	}
+	if (NULL == cmd_opts->serial_counter_file_name) {
+		fprintf(stderr, "Serial counter file not set.\n");
+		return (EINVAL);
+	}
+
+	return (serial_parse(cmd_opts->serial_str, serial));
+}
+
+/* Verify mask for page: from mask file, rest compared, then skip
+ * ranges cleared. */
+static int
+verify_mask_load(cmd_opts_p cmd_opts, chip_p chip, uint8_t **mask_ret,
+    size_t *mask_size_ret) {
+	int error;
+	uint8_t *mask, *buf = NULL;
+	size_t i, page_size, buf_size = 0, count = 0, skipped = 0;
+	mp_range_p ranges = NULL;
+
+	page_size = page_size_get(chip, cmd_opts->page);
+	if (0 == page_size) {
+		fprintf(stderr,
+		    "Verify mask is supported only for code and data "
+		    "pages.\n");
+		return (EINVAL);
+	}
+	if (NULL != cmd_opts->vr_mask_file_name) {
+		error = dumpio_read_file(cmd_opts->vr_mask_file_name, 0, 0,
+		    MAX_CHIP_FILE_SIZE, &buf, &buf_size);
+		if (0 != error) {
+			LOG_ERR_FMT(error, "Fail on verify mask file read: %s",
+			    cmd_opts->vr_mask_file_name);
+			return (error);
+		}
+	}
+	if (NULL != cmd_opts->vr_skip_str) {
+		error = ranges_load(cmd_opts->vr_skip_str, &ranges, &count);
+		if (0 != error) {
+			free(buf);
+			return (error);
+		}
+	}
+	mask = malloc(page_size);
+	if (NULL == mask) {
+		error = ENOMEM;
+		goto err_out;
+	}
+	buf_size = MIN(buf_size, page_size);
+	if (NULL != buf) {
+		memcpy(mask, buf, buf_size);
+	}
+	memset((mask + buf_size), 0xff, (page_size - buf_size));
+	for (i = 0; i < count; i ++) {
+		if (((size_t)ranges[i].address + ranges[i].size) > page_size) {
+			fprintf(stderr,
+			    "options error: chip page \"%s\" "
+			    "size = %zu, skip 0x%08x + %zu is out of "
+			    "range.\n",
+			    mp_chip_page_str[cmd_opts->page], page_size,
+			    ranges[i].address, ranges[i].size);
+			free(mask);
+			error = EINVAL;
+			goto err_out;
+		}
+		memset((mask + ranges[i].address), 0x00, ranges[i].size);
+	}
+	for (i = 0; i < page_size; i ++) {
+		skipped += (0x00 == mask[i]);
+	}
+	printf("Verify mask: %zu don't care bytes.\n", skipped);
+	(*mask_ret) = mask;
+	(*mask_size_ret) = page_size;
+
+err_out:
+	free(ranges);
+	free(buf);
+
+	return (error);
+}
+
+/* Estimate job from chip DB and tune cache, device not needed. */
+static int
+plan_run(cmd_opts_p cmd_opts, chip_p chip) {
+	int error;
+	off_t file_size;
+	size_t chip_size;
+	tune_t tune;
+	plan_job_t job;
+	plan_t plan;
+
+	memset(&job, 0x00, sizeof(job));
+	job.action = cmd_opts->action;
+	job.page = cmd_opts->page;
+	job.address = cmd_opts->address;
+	job.size = cmd_opts->size;
+	job.write_flags = cmd_opts->write_flags;
+	job.fill = cmd_opts->wr_fill;
+	job.post_wr_verify = cmd_opts->post_wr_verify;
+	if (0 > job.action || 2 < job.action) {
+		fprintf(stderr, "Plan: read / verify / write - not specified.\n");
+		return (-1);
+	}
+	chip_size = ((MP_CHIP_PAGE_CODE == job.page) ?
+	    chip->code_memory_size : chip->data_memory_size);
+	if (0 == job.size && chip_size > job.address) {
+		job.size = (chip_size - job.address);
+		/* Verify/write: not more than file have. */
+		if (0 != job.action &&
+		    0 == dumpio_file_size_get(cmd_opts->file_name, &file_size) &&
+		    file_size > cmd_opts->file_offset) {
+			job.size = MIN(job.size,
+			    (size_t)(file_size - cmd_opts->file_offset));
+		}
+	}
+
+	/* Firmware version unknown without device: take any. */
+	memset(&tune, 0x00, sizeof(tune));
+	if (0 == cmd_opts->tune_disable) {
+		tune_cache_get(cmd_opts->tune_cache_file_name, chip->name,
+		    TUNE_FW_VER_ANY, &tune);
+	}
+	error = plan_estimate(chip, &job, &tune, &plan);
+	if (0 != error) {
+		LOG_ERR(error, "Fail on plan estimate.");
+		return (error);
+	}
+	printf("%s %s: %zu bytes, starting from: 0x%08x.\n",
+	    lopts[job.action].name, mp_chip_page_str[job.page],
+	    job.size, job.address);
+	plan_print(stdout, &plan);
+
+	return (0);
+}
+
+
+int
+main(int argc, char **argv) {
+	int i, error = 0, pl_error;
+	cmd_opts_t cmd_opts;
+	minipro_p mp = NULL;
+	chip_p chips_db = NULL, chip = NULL;
+	uint32_t chip_val, buf_val;
+	uint32_t chip_id_checked = 0;
+	uint8_t *file_data = NULL, *chip_data = NULL;
+	uint8_t *fill_data = NULL;
+	size_t file_data_size, chip_data_size, fill_data_size = 0;
+	size_t tr_size = 0, err_offset, chips_db_count = 0;
+	off_t file_size;
+	char status_msg[64];
+	journal_t jr;
+	minipro_stats_t stats;
+	minipro_ver_p ver;
+	uint16_t fw_ver;
+	int tune_loaded = 0;
+	uint32_t tune_rbs;
+	tune_t tune;
+	char tune_file_name[1024];
+	file_sink_t fsink;
+	dumpio_p dio;
+	uint8_t *xf_data;
+	size_t xf_data_size;
+	pipeline_p pl = NULL;
+	metrics_t metrics;
+	job_t job;
+	uint8_t *vr_mask = NULL;
+	size_t vr_mask_size = 0;
+	serial_t serial;
+	uint64_t serial_val;
+
+	memset(&job, 0x00, sizeof(job));
+	metrics_init(&metrics);
+	metrics_phase_set(&metrics, METRICS_PH_OPTIONS);
+	error = cmd_opts_parse(argc, argv, &cmd_opts);
+	if (0 != error) {
+		if (-1 == error)
+			return (0); /* Handled action. */
+		print_usage(argv[0]);
+		return (error);
+	}
+	if (-1 != cmd_opts.action) {
+		metrics.action = lopts[cmd_opts.action].name;
+	}
+	metrics.page = ((1 < cmd_opts.image_count) ?
+	    "multi" : mp_chip_page_str[cmd_opts.page]);
+	if (NULL == cmd_opts.tune_cache_file_name &&
+	    NULL != getenv("HOME")) {
+		snprintf(tune_file_name, sizeof(tune_file_name),
+		    "%s/"TUNE_CACHE_FILE_DEF, getenv("HOME"));
+		cmd_opts.tune_cache_file_name = tune_file_name;
+	}
+	if (NULL == cmd_opts.tune_cache_file_name) {
+		cmd_opts.tune_disable = 1;
+	}
+
+	if (NULL != cmd_opts.job_file_name) {
+		if (-1 != cmd_opts.action || 0 != cmd_opts.plan) {
+			fprintf(stderr, "Job file can not be combined with "
+			    "read / verify / write / hwtest / plan.\n");
+			return (EINVAL);
+		}
+		error = job_load(cmd_opts.job_file_name, &job);
+		if (0 != error) {
+			LOG_ERR_FMT(error, "Fail on job file load: %s",
+			    cmd_opts.job_file_name);
+			return (error);
+		}
+		metrics.action = "job";
+	}
+
+	if (NULL != cmd_opts.chip_name ||
+	    0 != cmd_opts.chip_id_size ||
+	    NULL != cmd_opts.job_file_name) {
+		/* Load chips database from file. */
+		metrics_phase_set(&metrics, METRICS_PH_DB_LOAD);
+		printf("Chips DB loading...");
+		if (NULL == cmd_opts.db_file_name) {
+			cmd_opts.db_file_name = DB_FILE_DEF;
+		}
+		error = chip_db_load(cmd_opts.db_file_name, 0,
+		    &chips_db, &chips_db_count);
+		if (0 != error) {
+			LOG_ERR_FMT(error, "Fail on chips DB load: %s",
+			    cmd_opts.db_file_name);
+			return (error);
+		}
+		printf("done, %zu loaded.\n", chips_db_count);
+
+		/* Find chip. */
+		if (NULL == cmd_opts.chip_name &&
+		    0 == cmd_opts.chip_id_size) {
+			/* Job file: chip selected by steps. */
+		} else if (NULL != cmd_opts.chip_name) { /* By name. */
+			chip = chip_db_get_by_name(chips_db, cmd_opts.chip_name);
+			if (NULL == chip) {
+				fprintf(stderr,
+				    "Chip \"%s\" not found, "
+				    "try one of listed "
+				    "below or type: "
+				    "%s --db-dump | grep %s\n",
+				    cmd_opts.chip_name, basename(argv[0]),
+				    cmd_opts.chip_name);
+				chip_db_dump_flt(chips_db, cmd_opts.chip_name);
+				return (-1);
+			}
+		} else if (0 != cmd_opts.chip_id_size) { /* By ID. */
+			chip = chip_db_get_by_id(chips_db, cmd_opts.chip_id,
+			    cmd_opts.chip_id_size);
+			if (NULL == chip) {
+				fprintf(stderr, "Chip not found.\n");
+				return (-1);
+			}
+		}
+		/* Display chip info. */
+		if (NULL != chip && 0 == cmd_opts.quiet) {
+			chip_db_print_info(chip);
+		}
+	}
+	if (0 != cmd_opts.plan) {
+		if (NULL == chip) {
+			fprintf(stderr,
+			    "Chip not specified, can not continue.\n");
+			error = -1;
+		} else if (1 < cmd_opts.image_count ||
+		    NULL != cmd_opts.ranges_str ||
+		    FWIMG_FMT_RAW != cmd_opts.file_fmt) {
+			fprintf(stderr,
+			    "Plan: multi page, ranges and segmented file "
+			    "jobs are not supported.\n");
+			error = -1;
+		} else {
+			error = plan_run(&cmd_opts, chip);
+		}
+		chip_db_free(chips_db);
+		return (error);
+	}
+
+	/* Try to increase process priority. */
+	setpriority(PRIO_PROCESS, 0, PROCESS_PRIORITY);
+#ifdef BSD /* BSD specific code. */
+	struct rtprio rtp;
+	rtp.type = RTP_PRIO_REALTIME;
+	rtp.prio = (u_short)PROCESS_PRIORITY;
+	rtprio(RTP_SET, 0, &rtp);
+#endif
+
+	/* Progress/metrics reader may exit: get EPIPE instead of kill in
+	 * middle of chip write. */
+	signal(SIGPIPE, SIG_IGN);
+
+	/* Open MiniPro. */
+	metrics_phase_set(&metrics, METRICS_PH_OPEN);
+	error = minipro_open(MP_TL866_VID, MP_TL866_PID,
+	    (0 == cmd_opts.quiet), &mp);
+	if (0 != error)
+		goto err_out;
+	error = progress_create(0, cmd_opts.progress_fd, &progress_out);
+	if (0 != error) {
+		LOG_ERR(error, "Fail on progress create.");
+		goto err_out;
+	}
+	/* Check and print device info. */
+	error = minipro_is_version_info_ok(mp);
+	if (0 == cmd_opts.quiet || 0 != error) {
+		minipro_print_info(mp);
+	}
+	if (0 != error)
+		goto err_out;
+	for (i = 0; MP_TMO__COUNT__ > i; i ++) {
+		if (0 == cmd_opts.tmo[i])
+			continue;
+		minipro_timeout_set(mp, i, cmd_opts.tmo[i]);
+	}
+
+	if (NULL != cmd_opts.job_file_name) {
+		if (NULL != chip) { /* Initial chip: same ID check. */
+			metrics_phase_set(&metrics, METRICS_PH_CHIP_SET);
+			error = minipro_chip_set(mp, chip, cmd_opts.icsp);
+			if (0 != error)
+				goto err_out;
+			metrics_phase_set(&metrics, METRICS_PH_CHIP_ID);
+			error = chip_id_check(mp, &cmd_opts, chips_db, chip,
+			    &chip_id_checked);
+			if (0 != error)
+				goto err_out;
+		}
+		/* Chip already set. */
+		error = job_run(mp, chips_db, NULL, cmd_opts.icsp, &job,
+		    progress_cb);
+		job_print(stdout, &job);
+		chip = minipro_chip_get(mp); /* Last selected, for metrics. */
+		goto err_out;
+	}
+
+	if (3 == cmd_opts.action) { /* hw test. */
+		err_offset = 0;
+		error = minipro_hardware_check(mp, &err_offset);
+		printf("HW test done, error = %i, "
+		    "HW errors count = %zu.\n",
+		    error, err_offset);
+		goto err_out;
+	}
+
+	/* Check some command line options before continue. */
+	if (NULL == chip) { /* Is chip specified? */
+		fprintf(stderr,
+		    "Chip not specified, can not continue.\n");
+		error = -1;
+		goto err_out;
+	}
+	if (1 < cmd_opts.image_count) {
+		error = pages_check(&cmd_opts, chip);
+	} else if (NULL != cmd_opts.ranges_str) {
+		error = ranges_check(&cmd_opts, chip);
+	} else if (FWIMG_FMT_RAW != cmd_opts.file_fmt) {
+		error = segs_check(&cmd_opts, chip);
+	} else {
+		error = page_check(&cmd_opts, chip, &tr_size);
+	}
+	if (0 == error && NULL != cmd_opts.serial_str) {
+		error = serial_check(&cmd_opts, &serial);
+	}
+	if (0 != error)
+		goto err_out;
+
+	/* Set chip info. */
+	metrics_phase_set(&metrics, METRICS_PH_CHIP_SET);
+	error = minipro_chip_set(mp, chip, cmd_opts.icsp);
+	if (0 != error)
+		goto err_out;
+
+	/* Verify Chip ID (if applicable). */
+	metrics_phase_set(&metrics, METRICS_PH_CHIP_ID);
+	error = chip_id_check(mp, &cmd_opts, chips_db, chip,
+	    &chip_id_checked);
+	if (0 != error)
+		goto err_out;
+
+	/* Read transfer tuning: calibrate or load from cache. */
+	metrics_phase_set(&metrics, METRICS_PH_TUNE);
+	ver = minipro_ver_get(mp);
+	fw_ver = (uint16_t)((((uint16_t)ver->firmware_version_major) << 8) |
+	    ver->firmware_version_minor);
+	memset(&tune, 0x00, sizeof(tune));
+	if (0 == cmd_opts.tune_disable) {
+		tune_loaded = (0 == tune_cache_get(
+		    cmd_opts.tune_cache_file_name, chip->name, fw_ver, &tune));
+	}
+	if (0 != cmd_opts.calibrate) {
+		error = tune_calibrate(mp, (0 == cmd_opts.quiet), &tune);
+		if (0 != error) {
+			LOG_ERR(error, "Fail on calibrate.");
+			goto err_out;
+		}
+		printf("Calibrated: read block size: 0x%"PRIx32", "
+		    "status poll: 1/%"PRIu32".\n",
+		    tune.read_block_size, tune.status_poll_ival);
+		if (0 == cmd_opts.tune_disable) {
+			error = tune_cache_set(cmd_opts.tune_cache_file_name,
+			    chip->name, fw_ver, &tune);
+			LOG_ERR_FMT(error, "Fail on tune cache save: \"%s\".",
+			    cmd_opts.tune_cache_file_name);
+			error = 0;
 		}
+		if (-1 == cmd_opts.action)
+			goto err_out; /* Nothink more to do. */
+	} else if (0 != tune_loaded) {
+		if (0 != minipro_tune_set(mp, tune.read_block_size,
+		    tune.status_poll_ival)) {
+			printf("Tune cache entry not valid for chip, "
+			    "ignored.\n");
+		} else if (0 == cmd_opts.quiet) {
+			printf("Tuned: read block size: 0x%"PRIx32", "
+			    "status poll: 1/%"PRIu32".\n",
+			    tune.read_block_size, tune.status_poll_ival);
+		}
+	}
+
+	if (NULL != cmd_opts.vr_mask_file_name ||
+	    NULL != cmd_opts.vr_skip_str) {
+		error = verify_mask_load(&cmd_opts, chip, &vr_mask,
+		    &vr_mask_size);
+		if (0 != error)
+			goto err_out;
+		minipro_verify_mask_set(mp, vr_mask, vr_mask_size);
 	}
 
 	/* Do action/work. */
+	if (1 < cmd_opts.image_count) {
+		error = pages_run(mp, &cmd_opts, &metrics);
+		goto job_done;
+	}
+	if (NULL != cmd_opts.ranges) {
+		error = ranges_run(mp, &cmd_opts, &metrics);
+		goto job_done;
+	}
+	if (FWIMG_FMT_RAW != cmd_opts.file_fmt) {
+		error = segs_run(mp, &cmd_opts, &metrics);
+		goto job_done;
+	}
 	switch (cmd_opts.action) {
 	case 0: /* read. */
+		metrics_phase_set(&metrics, METRICS_PH_READ);
+		metrics.bytes = tr_size;
 		snprintf(status_msg, sizeof(status_msg),
 		    "Reading %s... ",
 		    mp_chip_page_str[cmd_opts.page]);
-		error = minipro_page_read(mp,
-		    cmd_opts.page, cmd_opts.address, tr_size,
-		    &chip_data, &chip_data_size, progress_cb,
-		    (void*)status_msg);
-		if (0 != error) {
-			LOG_ERR(error, "Fail on chip read.");
-			goto err_out;
+		if (NULL != cmd_opts.journal_file_name) {
+			error = journal_init(mp, &cmd_opts, chip,
+			    chip_id_checked, NULL, tr_size, &jr);
+			if (0 != error)
+				goto err_out;
+			error = journal_page_run(mp, &cmd_opts, &jr, NULL,
+			    status_msg, &err_offset, &buf_val, &chip_val);
+			if (0 != error)
+				goto err_out;
+			journal_remove(cmd_opts.journal_file_name);
+			break;
 		}
 		/* Save/update file. */
-		fd = open(cmd_opts.file_name, (O_WRONLY | O_CREAT), 0600);
-		if (-1 == fd) {
-			error = errno;
+		error = dumpio_open(cmd_opts.file_name, cmd_opts.dump_flags,
+		    &dio);
+		if (0 != error) {
 			LOG_ERR(error,
 			    "Fail on file open for chip dump writing.");
 			goto err_out;
 		}
-		if (chip_data_size != (size_t)pwrite(fd,
-		    chip_data, chip_data_size, cmd_opts.file_offset)) {
-			error = errno;
-			LOG_ERR(error,
-			    "Fail on chip write data to file.");
+		/* Code/data: write file in worker while chip is readed. */
+		if (MP_CHIP_PAGE_CONFIG != cmd_opts.page &&
+		    NULL == cmd_opts.xform_str) {
+			fsink.dio = dio;
+			fsink.offset = cmd_opts.file_offset;
+			fsink.address = cmd_opts.address;
+			error = pipeline_create(0, file_sink_cb, &fsink, &pl);
+			if (0 != error) {
+				LOG_ERR(error, "Fail on pipeline create.");
+				dumpio_close(dio);
+				goto err_out;
+			}
+			/* Buffer owned here: blocks in pipeline must stay
+			 * valid after read fail until pipeline_finish(). */
+			chip_data = malloc(tr_size + sizeof(void*));
+			if (NULL == chip_data) {
+				error = ENOMEM;
+				LOG_ERR(error, "Fail on chip data buffer.");
+				pipeline_destroy(pl);
+				pl = NULL;
+				dumpio_close(dio);
+				goto err_out;
+			}
+			minipro_data_cb_set(mp, pipeline_data_cb, pl);
+			error = minipro_read_buf(mp,
+			    ((MP_CHIP_PAGE_CODE == cmd_opts.page) ?
+			    MP_CMD_READ_CODE : MP_CMD_READ_DATA),
+			    cmd_opts.address, chip_data, tr_size,
+			    progress_cb, (void*)status_msg);
+		} else {
+			error = minipro_page_read(mp,
+			    cmd_opts.page, cmd_opts.address, tr_size,
+			    &chip_data, &chip_data_size, progress_cb,
+			    (void*)status_msg);
+		}
+		if (NULL != pl) {
+			minipro_data_cb_set(mp, NULL, NULL);
+			pl_error = pipeline_finish(pl);
+			pipeline_destroy(pl);
+			pl = NULL;
+			if (0 != pl_error) {
+				LOG_ERR(pl_error,
+				    "Fail on chip write data to file.");
+				if (0 == error) {
+					error = pl_error;
+				}
+			}
+		} else if (0 == error) {
+			xf_data = chip_data;
+			xf_data_size = chip_data_size;
+			if (NULL != cmd_opts.xform_str) {
+				error = xform_file_data(&cmd_opts, chip_data,
+				    chip_data_size, &xf_data, &xf_data_size);
+				LOG_ERR(error, "Fail on transform.");
+			}
+			if (0 == error) {
+				error = dumpio_write(dio, cmd_opts.file_offset,
+				    xf_data, xf_data_size);
+				LOG_ERR(error,
+				    "Fail on chip write data to file.");
+			}
+			if (xf_data != chip_data) {
+				free(xf_data);
+			}
+		}
+		pl_error = dumpio_close(dio);
+		if (0 != pl_error && 0 == error) {
+			error = pl_error;
+			LOG_ERR(error, "Fail on chip dump file finish.");
+		}
+		if (0 != error) {
+			LOG_ERR(error, "Fail on chip read.");
+			goto err_out;
 		}
-		close(fd);
 		break;
 	case 1: /* verify. */
 	case 2: /* write. */
-		error = file_size_get(cmd_opts.file_name, 0, &file_size);
+		metrics_phase_set(&metrics, METRICS_PH_FILE);
+		if (NULL != cmd_opts.xform_str) { /* File bytes. */
+			tr_size *= cmd_opts.xform.ratio;
+		}
+		error = dumpio_file_size_get(cmd_opts.file_name, &file_size);
 		if (0 != error) {
 			LOG_ERR(error, "Fail on get file size.");
 			goto err_out;
@@ -599,43 +2400,121 @@ main(int argc, char **argv) {
 		}
 		/* Loading file. */
 		/* file_data_size = ((0 != tr_size) ? tr_size : (file_size - cmd_opts.file_offset)); */
-		error = read_file(cmd_opts.file_name, 0,
+		error = dumpio_read_file(cmd_opts.file_name,
 		    cmd_opts.file_offset, tr_size, MAX_CHIP_FILE_SIZE,
 		    &file_data, &file_data_size);
 		if (0 != error) {
 			LOG_ERR(error, "Fail on file read.");
 			goto err_out;
 		}
+		if (NULL != cmd_opts.xform_str) {
+			error = xform_to_chip(&cmd_opts.xform, file_data,
+			    file_data_size, &file_data_size);
+			if (0 != error) {
+				fprintf(stderr, "File data size %zu does not "
+				    "fit transforms: multiple of %zu "
+				    "needed.\n", file_data_size,
+				    (cmd_opts.xform.ratio *
+				    cmd_opts.xform.align));
+				goto err_out;
+			}
+		}
 		if (2 == cmd_opts.action) { /* write. */
+			if (NULL != cmd_opts.wr_fill_file_name) {
+				error = dumpio_read_file(
+				    cmd_opts.wr_fill_file_name,
+				    0, 0, MAX_CHIP_FILE_SIZE,
+				    &fill_data, &fill_data_size);
+				if (0 != error) {
+					LOG_ERR(error, "Fail on fill file read.");
+					goto err_out;
+				}
+			}
+			minipro_write_fill_set(mp, cmd_opts.wr_fill,
+			    cmd_opts.wr_fill_val, fill_data, fill_data_size);
+			if (NULL != cmd_opts.serial_str) {
+				error = serial_counter_next(
+				    cmd_opts.serial_counter_file_name,
+				    &serial_val);
+				if (0 != error) {
+					LOG_ERR_FMT(error, "Fail on serial "
+					    "counter: %s",
+					    cmd_opts.serial_counter_file_name);
+					goto err_out;
+				}
+				error = serial_build(&serial, serial_val,
+				    file_data, cmd_opts.address,
+				    file_data_size);
+				if (0 != error)
+					goto err_out;
+				/* Also used by post write verify. */
+				minipro_overlay_set(mp, serial.ovls,
+				    serial.count);
+				printf("Serial: 0x%"PRIx64".\n", serial_val);
+			}
+			metrics_phase_set(&metrics, METRICS_PH_WRITE);
+			metrics.bytes = file_data_size;
 			snprintf(status_msg, sizeof(status_msg),
 			    "Writing %s... ",
 			    mp_chip_page_str[cmd_opts.page]);
-			error = minipro_page_write(mp,
-			    cmd_opts.write_flags,
-			    cmd_opts.page, cmd_opts.address,
-			    file_data, file_data_size,
-			    progress_cb, (void*)status_msg);
-			if (0 != error) {
-				LOG_ERR(error, "Fail on chip write.");
-				goto err_out;
+			if (NULL != cmd_opts.journal_file_name) {
+				error = journal_init(mp, &cmd_opts, chip,
+				    chip_id_checked, file_data,
+				    file_data_size, &jr);
+				if (0 != error)
+					goto err_out;
+				error = journal_page_run(mp, &cmd_opts, &jr,
+				    file_data, status_msg,
+				    &err_offset, &buf_val, &chip_val);
+			} else {
+				error = minipro_page_write(mp,
+				    cmd_opts.write_flags,
+				    cmd_opts.page, cmd_opts.address,
+				    file_data, file_data_size,
+				    progress_cb, (void*)status_msg);
+				if (0 != error) {
+					LOG_ERR(error, "Fail on chip write.");
+				}
 			}
-			if (0 == cmd_opts.post_wr_verify) /* Verify disabled. */
+			if (0 != error)
+				goto err_out;
+			if (0 == cmd_opts.post_wr_verify) { /* Verify disabled. */
+				journal_remove(cmd_opts.journal_file_name);
 				break;
+			}
 		}
 		/* verify. */
+		metrics_phase_set(&metrics, METRICS_PH_VERIFY);
+		metrics.bytes = file_data_size;
 		snprintf(status_msg, sizeof(status_msg),
 		    "Verifying %s... ",
 		    mp_chip_page_str[cmd_opts.page]);
-		error = minipro_page_verify(mp,
-		    cmd_opts.page, cmd_opts.address,
-		    file_data, file_data_size,
-		    &err_offset, &buf_val, &chip_val,
-		    progress_cb, (void*)status_msg);
-		if (0 != error) {
-			LOG_ERR(error, "Fail on chip read.");
-			goto err_out;
+		if (1 == cmd_opts.action &&
+		    NULL != cmd_opts.journal_file_name) {
+			error = journal_init(mp, &cmd_opts, chip,
+			    chip_id_checked, file_data, file_data_size, &jr);
+			if (0 != error)
+				goto err_out;
+			error = journal_page_run(mp, &cmd_opts, &jr,
+			    file_data, status_msg,
+			    &err_offset, &buf_val, &chip_val);
+			if (0 != error)
+				goto err_out;
+		} else {
+			error = minipro_page_verify(mp,
+			    cmd_opts.page, cmd_opts.address,
+			    file_data, file_data_size,
+			    &err_offset, &buf_val, &chip_val,
+			    progress_cb, (void*)status_msg);
+			if (0 != error) {
+				LOG_ERR(error, "Fail on chip read.");
+				goto err_out;
+			}
 		}
+		/* Job done, journal not needed any more. */
+		journal_remove(cmd_opts.journal_file_name);
 		if (err_offset < file_data_size) { /* Not euqual. */
+			metrics.verify_fail = 1;
 			switch (cmd_opts.page) {
 			case MP_CHIP_PAGE_CODE:
 			case MP_CHIP_PAGE_DATA:
@@ -663,13 +2542,69 @@ main(int argc, char **argv) {
 		    "nothink to do.\n");
 		error = -1;
 	}
+job_done:
+	/* Job done: record latencies for -plan, only to calibrated or
+	 * existing cache entry. */
+	if (0 == error && 0 == metrics.verify_fail &&
+	    0 == cmd_opts.tune_disable &&
+	    (0 != tune_loaded || 0 != cmd_opts.calibrate) &&
+	    0 == minipro_stats_get(mp, &stats) &&
+	    0 == minipro_tune_get(mp, &tune_rbs, NULL)) {
+		tune_lat_update(&tune, &stats,
+		    ((MP_CHIP_PAGE_CODE == cmd_opts.page) ?
+		    tune_rbs : chip->read_block_size),
+		    metrics.phase_us[METRICS_PH_OPEN],
+		    metrics.phase_us[METRICS_PH_CHIP_SET]);
+		i = tune_cache_set(cmd_opts.tune_cache_file_name,
+		    chip->name, fw_ver, &tune);
+		LOG_ERR_FMT(i, "Fail on tune cache save: \"%s\".",
+		    cmd_opts.tune_cache_file_name);
+	}
 
 
 err_out:
+	metrics_phase_set(&metrics, METRICS_PH_TEARDOWN);
+	progress_abort(progress_out, error);
+	progress_destroy(progress_out);
+	progress_out = NULL;
+	if (NULL != mp &&
+	    0 == minipro_stats_get(mp, &stats) &&
+	    0 != stats.usb_errors) {
+		printf("USB errors: %zu (timeouts: %zu, stalls: %zu, "
+		    "no device: %zu), recoveries: %zu, recovery fails: %zu, "
+		    "block retries: %zu.\n",
+		    stats.usb_errors, stats.usb_timeouts, stats.usb_stalls,
+		    stats.usb_no_device, stats.recoveries,
+		    stats.recovery_fails, stats.retries);
+	}
+	metrics.error = ((0 == error && 0 != metrics.verify_fail) ?
+	    -1 : error);
+	if (NULL != chip) {
+		snprintf(metrics.chip_name, sizeof(metrics.chip_name),
+		    "%s", chip->name);
+	}
+	metrics_device_set(&metrics, mp); /* Before handle close. */
 	free(chip_data);
 	free(file_data);
 	minipro_close(mp);
+	free(vr_mask);
+	free(fill_data);
+	job_free(&job);
+	free(cmd_opts.ranges);
+	fwimg_free(&cmd_opts.fwimg);
 	chip_db_free(chips_db);
+	metrics_phase_set(&metrics, METRICS_PH_NONE);
+	metrics_rusage_set(&metrics);
+
+	if (NULL != cmd_opts.metrics_file_name) {
+		i = metrics_write(cmd_opts.metrics_file_name,
+		    cmd_opts.metrics_fmt, &metrics);
+		LOG_ERR_FMT(i, "Fail on metrics write: \"%s\".",
+		    cmd_opts.metrics_file_name);
+	}
+	if (0 != cmd_opts.profile) {
+		metrics_profile_print(stdout, &metrics);
+	}
 
 	return (error);
 }
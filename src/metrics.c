@@ -0,0 +1,305 @@
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <errno.h>
+
+#include "utils/macro.h"
+
+#include "metrics.h"
+
+
+#define METRICS_BUF_SIZE	8192
+
+
+static uint64_t
+metrics_time_us(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ((((uint64_t)ts.tv_sec) * 1000000) +
+	    (((uint64_t)ts.tv_nsec) / 1000));
+}
+
+/* Printable chars only, no quotes: safe for JSON and label values. */
+static void
+metrics_str_copy(char *dst, size_t dst_size, const uint8_t *src,
+    size_t src_size) {
+	size_t i, j = 0;
+
+	for (i = 0; i < src_size && 0 != src[i] && (j + 1) < dst_size; i ++) {
+		if (0x20 > src[i] || 0x7e < src[i] ||
+		    '"' == src[i] || '\\' == src[i])
+			continue;
+		dst[j ++] = (char)src[i];
+	}
+	dst[j] = 0;
+}
+
+
+void
+metrics_init(metrics_p metrics) {
+
+	if (NULL == metrics)
+		return;
+	memset(metrics, 0x00, sizeof(metrics_t));
+	metrics->ts = time(NULL);
+	metrics->action = "none";
+	metrics->page = "";
+	metrics->cur_phase = METRICS_PH_NONE;
+	metrics->start_us = metrics_time_us();
+}
+
+void
+metrics_phase_set(metrics_p metrics, int phase) {
+	uint64_t now;
+
+	if (NULL == metrics)
+		return;
+	now = metrics_time_us();
+	if (METRICS_PH_NONE != metrics->cur_phase) {
+		metrics->phase_us[metrics->cur_phase] +=
+		    (now - metrics->cur_start);
+	}
+	metrics->cur_phase = phase;
+	metrics->cur_start = now;
+	metrics->total_us = (now - metrics->start_us);
+}
+
+void
+metrics_device_set(metrics_p metrics, minipro_p mp) {
+	minipro_ver_p ver;
+	chip_p chip;
+
+	if (NULL == metrics || NULL == mp)
+		return;
+	ver = minipro_ver_get(mp);
+	metrics_str_copy(metrics->serial, sizeof(metrics->serial),
+	    ver->serial_num, sizeof(ver->serial_num));
+	chip = minipro_chip_get(mp);
+	if (NULL != chip) {
+		metrics_str_copy(metrics->chip_name,
+		    sizeof(metrics->chip_name),
+		    (const uint8_t*)chip->name, strlen(chip->name));
+	}
+	minipro_stats_get(mp, &metrics->stats);
+	/* Erase is done inside write: split it out, if it was not timed
+	 * as own phase. */
+	if (0 == metrics->phase_us[METRICS_PH_ERASE]) {
+		metrics->phase_us[METRICS_PH_ERASE] = metrics->stats.erase_us;
+		metrics->phase_us[METRICS_PH_WRITE] -=
+		    MIN(metrics->stats.erase_us,
+		    metrics->phase_us[METRICS_PH_WRITE]);
+	}
+}
+
+void
+metrics_rusage_set(metrics_p metrics) {
+	struct rusage ru;
+
+	if (NULL == metrics ||
+	    0 != getrusage(RUSAGE_SELF, &ru))
+		return;
+	metrics->cpu_user_us = ((((uint64_t)ru.ru_utime.tv_sec) * 1000000) +
+	    (uint64_t)ru.ru_utime.tv_usec);
+	metrics->cpu_sys_us = ((((uint64_t)ru.ru_stime.tv_sec) * 1000000) +
+	    (uint64_t)ru.ru_stime.tv_usec);
+#ifdef DARWIN /* Bytes on Darwin, KB on others. */
+	metrics->max_rss_kb = ((size_t)ru.ru_maxrss / 1024);
+#else
+	metrics->max_rss_kb = (size_t)ru.ru_maxrss;
+#endif
+}
+
+void
+metrics_profile_print(FILE *fp, const metrics_p metrics) {
+	size_t i;
+
+	if (NULL == fp || NULL == metrics)
+		return;
+	fprintf(fp, "Profile:\n");
+	for (i = 0; METRICS_PH__COUNT__ > i; i ++) {
+		if (0 == metrics->phase_us[i])
+			continue;
+		fprintf(fp, "	%-10s %10"PRIu64".%03"PRIu64" ms  %3"PRIu64"%%\n",
+		    metrics_ph_str[i],
+		    (metrics->phase_us[i] / 1000),
+		    (metrics->phase_us[i] % 1000),
+		    ((metrics->phase_us[i] * 100) /
+		    MAX(metrics->total_us, 1)));
+	}
+	fprintf(fp, "	%-10s %10"PRIu64".%03"PRIu64" ms\n"
+	    "	CPU user: %"PRIu64".%03"PRIu64" ms, "
+	    "sys: %"PRIu64".%03"PRIu64" ms, max RSS: %zu KB\n",
+	    "total",
+	    (metrics->total_us / 1000), (metrics->total_us % 1000),
+	    (metrics->cpu_user_us / 1000), (metrics->cpu_user_us % 1000),
+	    (metrics->cpu_sys_us / 1000), (metrics->cpu_sys_us % 1000),
+	    metrics->max_rss_kb);
+}
+
+
+static size_t
+metrics_json_fmt(const metrics_p metrics, char *buf, size_t buf_size) {
+	size_t i, off;
+
+	off = (size_t)snprintf(buf, buf_size,
+	    "{\"ts\":%"PRIu64",\"serial\":\"%s\",\"chip\":\"%s\","
+	    "\"action\":\"%s\",\"page\":\"%s\",\"error\":%i,"
+	    "\"verify_fail\":%i,\"bytes\":%zu,\"phases_us\":{",
+	    (uint64_t)metrics->ts, metrics->serial, metrics->chip_name,
+	    metrics->action, metrics->page, metrics->error,
+	    metrics->verify_fail, metrics->bytes);
+	for (i = 0; METRICS_PH__COUNT__ > i && off < buf_size; i ++) {
+		off += (size_t)snprintf((buf + off), (buf_size - off),
+		    "%s\"%s\":%"PRIu64,
+		    ((0 != i) ? "," : ""), metrics_ph_str[i],
+		    metrics->phase_us[i]);
+	}
+	if (off >= buf_size)
+		return (buf_size);
+	off += (size_t)snprintf((buf + off), (buf_size - off),
+	    "},\"blocks_read\":%zu,\"blocks_written\":%zu,"
+	    "\"status_polls\":%zu,\"overcurrents\":%zu,"
+	    "\"retries\":%zu,\"usb_errors\":%zu,\"usb_timeouts\":%zu,"
+	    "\"usb_stalls\":%zu,\"usb_no_device\":%zu,"
+	    "\"recoveries\":%zu,\"recovery_fails\":%zu,"
+	    "\"total_us\":%"PRIu64",\"cpu_user_us\":%"PRIu64","
+	    "\"cpu_sys_us\":%"PRIu64",\"max_rss_kb\":%zu}\n",
+	    metrics->stats.blocks_read, metrics->stats.blocks_written,
+	    metrics->stats.status_polls, metrics->stats.overcurrents,
+	    metrics->stats.retries, metrics->stats.usb_errors,
+	    metrics->stats.usb_timeouts, metrics->stats.usb_stalls,
+	    metrics->stats.usb_no_device, metrics->stats.recoveries,
+	    metrics->stats.recovery_fails,
+	    metrics->total_us, metrics->cpu_user_us,
+	    metrics->cpu_sys_us, metrics->max_rss_kb);
+
+	return (off);
+}
+
+static size_t
+metrics_prom_fmt(const metrics_p metrics, char *buf, size_t buf_size) {
+	size_t i, off;
+	char labels[256];
+	const struct {
+		const char	*name;
+		const char	*help;
+		size_t		val;
+	} cnt[] = {
+		{ "bytes",		"Job payload size.",
+		    metrics->bytes },
+		{ "verify_fail",	"Verify data mismatch, 1 - fail.",
+		    (size_t)metrics->verify_fail },
+		{ "blocks_read",	"Blocks readed from chip.",
+		    metrics->stats.blocks_read },
+		{ "blocks_written",	"Blocks written to chip.",
+		    metrics->stats.blocks_written },
+		{ "status_polls",	"Device status requests.",
+		    metrics->stats.status_polls },
+		{ "overcurrents",	"Overcurrency protection events.",
+		    metrics->stats.overcurrents },
+		{ "retries",		"Block retries after USB errors.",
+		    metrics->stats.retries },
+		{ "usb_errors",		"USB transfer errors.",
+		    metrics->stats.usb_errors },
+		{ "recoveries",		"Successful USB recoveries.",
+		    metrics->stats.recoveries },
+		{ "recovery_fails",	"Failed USB recoveries.",
+		    metrics->stats.recovery_fails },
+	};
+
+	snprintf(labels, sizeof(labels),
+	    "serial=\"%s\",chip=\"%s\",action=\"%s\",page=\"%s\"",
+	    metrics->serial, metrics->chip_name, metrics->action,
+	    metrics->page);
+	off = (size_t)snprintf(buf, buf_size,
+	    "# HELP minipro_job_timestamp_seconds Job start time.\n"
+	    "# TYPE minipro_job_timestamp_seconds gauge\n"
+	    "minipro_job_timestamp_seconds{%s} %"PRIu64"\n"
+	    "# HELP minipro_job_error Job result, 0 - OK, -1 - verify fail.\n"
+	    "# TYPE minipro_job_error gauge\n"
+	    "minipro_job_error{%s} %i\n"
+	    "# HELP minipro_job_phase_seconds Job phase duration.\n"
+	    "# TYPE minipro_job_phase_seconds gauge\n",
+	    labels, (uint64_t)metrics->ts,
+	    labels, metrics->error);
+	for (i = 0; METRICS_PH__COUNT__ > i && off < buf_size; i ++) {
+		off += (size_t)snprintf((buf + off), (buf_size - off),
+		    "minipro_job_phase_seconds{%s,phase=\"%s\"} "
+		    "%"PRIu64".%06"PRIu64"\n",
+		    labels, metrics_ph_str[i],
+		    (metrics->phase_us[i] / 1000000),
+		    (metrics->phase_us[i] % 1000000));
+	}
+	for (i = 0; SIZEOF(cnt) > i && off < buf_size; i ++) {
+		off += (size_t)snprintf((buf + off), (buf_size - off),
+		    "# HELP minipro_job_%s %s\n"
+		    "# TYPE minipro_job_%s gauge\n"
+		    "minipro_job_%s{%s} %zu\n",
+		    cnt[i].name, cnt[i].help, cnt[i].name,
+		    cnt[i].name, labels, cnt[i].val);
+	}
+
+	return (off);
+}
+
+int
+metrics_write(const char *file_name, int format, const metrics_p metrics) {
+	int error = 0, fd;
+	char tmp_name[1024], buf[METRICS_BUF_SIZE];
+	size_t buf_size;
+
+	if (NULL == file_name || NULL == metrics)
+		return (EINVAL);
+
+	switch (format) {
+	case METRICS_FMT_JSON:
+		buf_size = metrics_json_fmt(metrics, buf, sizeof(buf));
+		if (sizeof(buf) <= buf_size)
+			return (EOVERFLOW);
+		/* Single write: lines from many stations does not mix. */
+		fd = open(file_name, (O_WRONLY | O_CREAT | O_APPEND), 0644);
+		if (-1 == fd)
+			return (errno);
+		if (buf_size != (size_t)write(fd, buf, buf_size)) {
+			error = errno;
+		}
+		close(fd);
+		break;
+	case METRICS_FMT_PROM:
+		buf_size = metrics_prom_fmt(metrics, buf, sizeof(buf));
+		if (sizeof(buf) <= buf_size)
+			return (EOVERFLOW);
+		/* Collector reads whole file: replace it atomically. */
+		if ((int)sizeof(tmp_name) <= snprintf(tmp_name,
+		    sizeof(tmp_name), "%s.tmp", file_name))
+			return (ENAMETOOLONG);
+		fd = open(tmp_name, (O_WRONLY | O_CREAT | O_TRUNC), 0644);
+		if (-1 == fd)
+			return (errno);
+		if (buf_size != (size_t)write(fd, buf, buf_size)) {
+			error = errno;
+		}
+		close(fd);
+		if (0 == error &&
+		    0 != rename(tmp_name, file_name)) {
+			error = errno;
+		}
+		if (0 != error) {
+			unlink(tmp_name);
+		}
+		break;
+	default:
+		return (EINVAL);
+	}
+
+	return (error);
+}
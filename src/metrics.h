@@ -0,0 +1,88 @@
+#ifndef __METRICS_H
+#define __METRICS_H
+
+#include <sys/types.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "minipro.h"
+
+
+#define METRICS_PH_NONE		-1
+#define METRICS_PH_OPTIONS	0
+#define METRICS_PH_DB_LOAD	1
+#define METRICS_PH_OPEN		2
+#define METRICS_PH_CHIP_SET	3
+#define METRICS_PH_CHIP_ID	4
+#define METRICS_PH_TUNE		5
+#define METRICS_PH_FILE		6
+#define METRICS_PH_ERASE	7
+#define METRICS_PH_READ		8
+#define METRICS_PH_WRITE	9
+#define METRICS_PH_VERIFY	10
+#define METRICS_PH_TEARDOWN	11
+#define METRICS_PH__COUNT__	12
+static const char *metrics_ph_str[] = {
+	"options",
+	"db_load",
+	"open",
+	"chip_set",
+	"chip_id",
+	"tune",
+	"file",
+	"erase",
+	"read",
+	"write",
+	"verify",
+	"teardown",
+	NULL
+};
+
+#define METRICS_FMT_JSON	0 /* One line per job, appended. */
+#define METRICS_FMT_PROM	1 /* Prometheus textfile, last job. */
+#define METRICS_FMT__COUNT__	2
+static const char *metrics_fmt_str[] = {
+	"json",
+	"prom",
+	NULL
+};
+
+
+typedef struct metrics_s {
+	time_t		ts;		/* Job start. */
+	char		serial[32];
+	char		chip_name[CHIP_NAME_MAX];
+	const char	*action;
+	const char	*page;
+	int		error;		/* -1: verify mismatch. */
+	int		verify_fail;	/* Verify found data mismatch. */
+	size_t		bytes;		/* Job payload size. */
+	uint64_t	phase_us[METRICS_PH__COUNT__];
+	int		cur_phase;
+	uint64_t	cur_start;
+	uint64_t	start_us;	/* metrics_init() time. */
+	uint64_t	total_us;	/* Wall time to last phase end. */
+	/* Process resources usage, from metrics_rusage_set(). */
+	uint64_t	cpu_user_us;
+	uint64_t	cpu_sys_us;
+	size_t		max_rss_kb;
+	minipro_stats_t	stats;
+} metrics_t, *metrics_p;
+
+
+void	metrics_init(metrics_p metrics);
+/* Close current phase and start new, METRICS_PH_NONE - just close. */
+void	metrics_phase_set(metrics_p metrics, int phase);
+/* Take device serial, chip and counters from handle. */
+void	metrics_device_set(metrics_p metrics, minipro_p mp);
+/* Take CPU time and peak RSS of process. */
+void	metrics_rusage_set(metrics_p metrics);
+
+/* Human readable phases breakdown. */
+void	metrics_profile_print(FILE *fp, const metrics_p metrics);
+
+int	metrics_write(const char *file_name, int format,
+	    const metrics_p metrics);
+
+#endif
@@ -5,6 +5,8 @@
 #include <string.h>
 #include <unistd.h>
 #include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <errno.h>
 #include <libusb.h>
 
@@ -12,19 +14,69 @@
 #include "utils/mem_utils.h"
 #include "utils/strh2num.h"
 #include "minipro.h"
+#include "minipro_int.h"
 
 
+/* Block routines, address scaling variant selected on chip set. */
+typedef int (*mp_read_block_fn)(minipro_p mp, uint8_t cmd,
+	    uint32_t addr, uint8_t *buf, size_t buf_size);
+typedef int (*mp_write_block_fn)(minipro_p mp, uint8_t cmd,
+	    uint32_t addr, const uint8_t *buf, size_t buf_size);
+
+/* Shared libusb context with events thread. */
+typedef struct minipro_usb_ctx_s {
+	libusb_context	*ctx;
+	pthread_t	thread;
+	atomic_int	stop;
+} minipro_usb_ctx_t;
+
 typedef struct minipro_handle_s {
 	libusb_device_handle *usb_handle;
 	libusb_context	*ctx;
+	minipro_usb_ctx_p usb_ctx;	/* Shared, not owned. */
+	size_t		dev_idx;
+	/* Opened device identity: reopen must find same programmer. */
+	uint8_t		usb_bus;
+	uint8_t		usb_ports[8];	/* Port path from root hub. */
+	int		usb_ports_cnt;	/* 0 - not set yet. */
+	uint8_t		usb_serial[sizeof(((minipro_ver_p)0)->serial_num)];
+	minipro_transfer_fn transfer;	/* Not NULL: used instead of USB. */
+	void		*transfer_udata;
+	uint16_t	vendor_id;
+	uint16_t	product_id;
+	int		usb_error;	/* Last libusb error, for recovery. */
+	uint32_t	tmo[MP_TMO__COUNT__]; /* Deadlines in use, ms. */
+	uint32_t	tmo_ovr[MP_TMO__COUNT__]; /* User set, 0 = auto. */
+	minipro_stats_t	stats;
 	chip_p		chip;
 	uint8_t		icsp;
 	uint8_t		msg_hdr[16]; /* Message constan header with chip settings. */
-	uint8_t		msg[4096];
-	uint8_t		*read_block_buf;
+	uint8_t		msg[MP_MSG_SIZE_MAX];
+	uint8_t		*read_block_buf; /* MP_BLOCK_SIZE_MAX size. */
 	uint8_t		*write_block_buf;
 	int		verboce;
 	minipro_ver_t	ver;
+	/* Partial write blocks padding, instead of read back. */
+	int		wr_fill;
+	uint8_t		wr_fill_val;
+	const uint8_t	*wr_fill_img;	/* Page image, not owned. */
+	size_t		wr_fill_img_size;
+	const uint8_t	*vr_mask;	/* Verify mask, not owned. */
+	size_t		vr_mask_size;
+	const mp_overlay_t *ovls;	/* Not owned. */
+	size_t		ovls_count;
+	uint8_t		*ovl_buf;	/* MP_BLOCK_SIZE_MAX size, verify. */
+	/* Tuning. */
+	uint32_t	rd_blk_size;	/* Code read block size. */
+	uint32_t	status_poll_ival; /* Overcurrency check every N blocks. */
+	uint32_t	status_poll_cnt;
+	uint32_t	rd_poll_ival;	/* Current read operation. */
+	/* CHIP_OPT4_ADDR_SCALE variant, selected on chip set. */
+	mp_read_block_fn	read_block;
+	mp_write_block_fn	write_block;
+	/* Readed data consumer. */
+	minipro_data_cb	data_cb;
+	void		*data_cb_udata;
 } minipro_t;
 
 static const uint8_t mp_chip_page_read_cmd[] = {
@@ -68,7 +120,7 @@ enum GND_PINS {
 };
 
 /* 16 VPP pins. NPN trans. mask */
-static mp_zif_pins_t vpp_pins[] = {
+static const mp_zif_pins_t vpp_pins[] = {
 	{ .pin =  1, .latch = 1, .oe = 1, .mask = 0x04 },
 	{ .pin =  2, .latch = 1, .oe = 1, .mask = 0x08 },
 	{ .pin =  3, .latch = 0, .oe = 1, .mask = 0x04 },
@@ -88,7 +140,7 @@ static mp_zif_pins_t vpp_pins[] = {
 };
 
 /* 24 VCC Pins. PNP trans. mask */
-static mp_zif_pins_t vcc_pins[] = {
+static const mp_zif_pins_t vcc_pins[] = {
 	{ .pin =  1, .latch = 2, .oe = 2, .mask = 0x7f },
 	{ .pin =  2, .latch = 2, .oe = 2, .mask = 0xef },
 	{ .pin =  3, .latch = 2, .oe = 2, .mask = 0xdf },
@@ -116,7 +168,7 @@ static mp_zif_pins_t vcc_pins[] = {
 };
 
 /* 25 GND Pins. NPN trans. mask */
-static mp_zif_pins_t gnd_pins[] = {
+static const mp_zif_pins_t gnd_pins[] = {
 	{ .pin =  1, .latch = 6, .oe = 2, .mask = 0x04 },
 	{ .pin =  2, .latch = 6, .oe = 2, .mask = 0x08 },
 	{ .pin =  3, .latch = 6, .oe = 2, .mask = 0x40 },
@@ -146,6 +198,17 @@ static mp_zif_pins_t gnd_pins[] = {
 
 
 void	minipro_chip_clean(minipro_p mp);
+static int minipro_get_version_info_ex(minipro_p mp, minipro_ver_p ver,
+	    uint32_t timeout);
+static int minipro_chip_adapter_init(minipro_p mp);
+static int mp_read_block_raw(minipro_p mp, uint8_t cmd, uint32_t addr,
+	    uint8_t *buf, size_t buf_size);
+static int mp_read_block_as(minipro_p mp, uint8_t cmd, uint32_t addr,
+	    uint8_t *buf, size_t buf_size);
+static int mp_write_block_raw(minipro_p mp, uint8_t cmd, uint32_t addr,
+	    const uint8_t *buf, size_t buf_size);
+static int mp_write_block_as(minipro_p mp, uint8_t cmd, uint32_t addr,
+	    const uint8_t *buf, size_t buf_size);
 
 #define MP_LOG_TEXT(__text)						\
 	if (0 != mp->verboce) {						\
@@ -203,6 +266,12 @@ void	minipro_chip_clean(minipro_p mp);
 		(__cb)((__mp), (__done), (__total), (__udata));		\
 	}
 
+#define MP_DATA_UPDATE(__mp, __addr, __buf, __size)			\
+	if (NULL != (__mp)->data_cb) {					\
+		MP_RET_ON_ERR_CLEANUP((__mp)->data_cb((__mp), (__addr),	\
+		    (__buf), (__size), (__mp)->data_cb_udata));		\
+	}
+
 
 
 static inline uint16_t
@@ -268,11 +337,21 @@ U32TO8n_LITTLE(const uint32_t v, size_t size, uint8_t *p) {
 	memcpy(p, &v, size);
 }
 
+static inline uint64_t
+mp_time_us(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ((((uint64_t)ts.tv_sec) * 1000000) +
+	    (((uint64_t)ts.tv_nsec) / 1000));
+}
+
 
 /* Internal staff. */
 /* abc=zxy */
-static int
-buf_get_named_line_val32(const uint8_t *buf, size_t buf_size,
+int
+mp_buf_get_named_line_val32(const uint8_t *buf, size_t buf_size,
     const char *val_name, size_t val_name_size, uint32_t *value) {
 	const uint8_t *ptr, *end;
 
@@ -317,8 +396,8 @@ buf_get_named_line_val32(const uint8_t *buf, size_t buf_size,
 	return (0);
 }
 
-static size_t
-memcmp_idx(const uint8_t *buf1, const uint8_t *buf2, const size_t size) {
+size_t
+mp_memcmp_idx(const uint8_t *buf1, const uint8_t *buf2, const size_t size) {
 	register size_t i;
 
 	if (0 != memcmp(buf1, buf2, size)) {
@@ -332,16 +411,127 @@ memcmp_idx(const uint8_t *buf1, const uint8_t *buf2, const size_t size) {
 	return (size);
 }
 
+/* Compare under mask: word at a time, byte search only in word with
+ * difference. */
+size_t
+mp_memcmp_mask_idx(const uint8_t *buf1, const uint8_t *buf2,
+    const uint8_t *mask, const size_t size) {
+	register size_t i = 0;
+	uint64_t w1, w2, wm;
+
+	for (; (i + sizeof(uint64_t)) <= size; i += sizeof(uint64_t)) {
+		memcpy(&w1, (buf1 + i), sizeof(uint64_t));
+		memcpy(&w2, (buf2 + i), sizeof(uint64_t));
+		memcpy(&wm, (mask + i), sizeof(uint64_t));
+		if (0 != ((w1 ^ w2) & wm))
+			break;
+	}
+	for (; size > i; i ++) {
+		if (0 != ((buf1[i] ^ buf2[i]) & mask[i]))
+			return (i);
+	}
+
+	return (size);
+}
+
+/* Image part at addr with overlays: buf if none hits, else patched
+ * copy in tmp (buf may be tmp: patched in place). */
+static const uint8_t *
+minipro_overlay_apply(minipro_p mp, uint32_t addr, const uint8_t *buf,
+    size_t size, uint8_t *tmp) {
+	size_t i, start, end;
+	const uint8_t *ret = buf;
+	const mp_overlay_t *ovl;
+
+	for (i = 0; i < mp->ovls_count; i ++) {
+		ovl = &mp->ovls[i];
+		start = MAX((size_t)ovl->address, (size_t)addr);
+		end = MIN(((size_t)ovl->address + ovl->size),
+		    ((size_t)addr + size));
+		if (start >= end)
+			continue;
+		if (ret != tmp) {
+			memcpy(tmp, buf, size);
+			ret = tmp;
+		}
+		memcpy((tmp + (start - addr)),
+		    (ovl->data + (start - ovl->address)), (end - start));
+	}
+
+	return (ret);
+}
+
+/* Verify compare of chip data at addr: with overlays and mask if set.
+ * Image value at difference stored to buf_val. */
+static size_t
+minipro_verify_cmp(minipro_p mp, uint32_t addr, const uint8_t *buf,
+    const uint8_t *chip_buf, const size_t size, uint32_t *buf_val) {
+	size_t tm, diff_off;
+
+	buf = minipro_overlay_apply(mp, addr, buf, size, mp->ovl_buf);
+	if (NULL == mp->vr_mask ||
+	    mp->vr_mask_size <= addr) {
+		diff_off = mp_memcmp_idx(buf, chip_buf, size);
+	} else {
+		tm = MIN(size, (mp->vr_mask_size - addr));
+		diff_off = mp_memcmp_mask_idx(buf, chip_buf,
+		    (mp->vr_mask + addr), tm);
+		if (diff_off == tm && tm != size) {
+			diff_off = (tm + mp_memcmp_idx((buf + tm),
+			    (chip_buf + tm), (size - tm)));
+		}
+	}
+	if (diff_off != size) {
+		(*buf_val) = buf[diff_off];
+	}
+
+	return (diff_off);
+}
+
+/* Fill part of block with data from page image or with fill value. */
+static void
+minipro_write_fill(minipro_p mp, uint32_t addr, uint8_t *buf, size_t size) {
+	size_t tm = 0;
+
+	if (NULL != mp->wr_fill_img &&
+	    mp->wr_fill_img_size > addr) {
+		tm = MIN(size, (mp->wr_fill_img_size - addr));
+		memcpy(buf, (mp->wr_fill_img + addr), tm);
+	}
+	memset((buf + tm), mp->wr_fill_val, (size - tm));
+}
+
 
 static int
 msg_transfer(minipro_p mp, uint8_t direction,
     uint8_t *buf, size_t buf_size, uint32_t timeout, size_t *transferred) {
 	int error, bytes_transferred = 0;
+	size_t tm = 0;
 
-	error = libusb_bulk_transfer(mp->usb_handle, (1 | direction),
-	    buf, (int)buf_size, &bytes_transferred, timeout);
+	if (NULL != mp->transfer) {
+		error = mp->transfer(mp->transfer_udata, direction,
+		    buf, buf_size, timeout, &tm);
+		bytes_transferred = (int)tm;
+	} else {
+		error = libusb_bulk_transfer(mp->usb_handle, (1 | direction),
+		    buf, (int)buf_size, &bytes_transferred, timeout);
+	}
 	if (0 != error) {
 		MP_LOG_USB_ERR(error, "libusb_bulk_transfer().");
+		/* Remember and classify for recovery. */
+		mp->usb_error = error;
+		mp->stats.usb_errors ++;
+		switch (error) {
+		case LIBUSB_ERROR_TIMEOUT:
+			mp->stats.usb_timeouts ++;
+			break;
+		case LIBUSB_ERROR_PIPE:
+			mp->stats.usb_stalls ++;
+			break;
+		case LIBUSB_ERROR_NO_DEVICE:
+			mp->stats.usb_no_device ++;
+			break;
+		}
 		goto err_out;
 	}
 
@@ -380,7 +570,8 @@ static int
 msg_send(minipro_p mp, uint8_t *buf, size_t buf_size,
     size_t *transferred) {
 
-	return (msg_send_ex(mp, buf, buf_size, 0, transferred));
+	return (msg_send_ex(mp, buf, buf_size, mp->tmo[MP_TMO_CMD],
+	    transferred));
 }
 
 static int
@@ -395,11 +586,12 @@ static int
 msg_recv(minipro_p mp, uint8_t *buf, size_t buf_size,
     size_t *transferred) {
 
-	return (msg_recv_ex(mp, buf, buf_size, 0, transferred));
+	return (msg_recv_ex(mp, buf, buf_size, mp->tmo[MP_TMO_CMD],
+	    transferred));
 }
 
-static void
-msg_chip_hdr_gen(chip_p chip, uint8_t icsp, uint8_t *buf,
+void
+mp_msg_chip_hdr_gen(chip_p chip, uint8_t icsp, uint8_t *buf,
     size_t buf_size) {
 
 	memset(buf, 0x00, buf_size);
@@ -447,33 +639,341 @@ static int
 msg_send_chip_hdr(minipro_p mp, uint8_t cmd, size_t msg_size,
     size_t *transferred) {
 
-	return (msg_send_chip_hdr_ex(mp, cmd, msg_size, 0, transferred));
+	return (msg_send_chip_hdr_ex(mp, cmd, msg_size, mp->tmo[MP_TMO_CMD],
+	    transferred));
+}
+
+
+/* Calc per command class deadlines from chip params. */
+static void
+minipro_tmo_update(minipro_p mp) {
+	size_t i;
+	chip_p chip = mp->chip;
+
+	mp->tmo[MP_TMO_CMD] = MP_TMO_CMD_DEF;
+	mp->tmo[MP_TMO_READ] = MP_TMO_READ_DEF;
+	mp->tmo[MP_TMO_WRITE] = MP_TMO_WRITE_DEF;
+	mp->tmo[MP_TMO_ERASE] = MP_TMO_ERASE_DEF;
+	if (NULL != chip) {
+		mp->tmo[MP_TMO_READ] += (MP_TMO_READ_PER_KB *
+		    ((MAX(mp->rd_blk_size, chip->read_block_size) + 1023) /
+		     1024));
+		mp->tmo[MP_TMO_WRITE] += (MP_TMO_WRITE_PER_B *
+		    chip->write_block_size);
+		mp->tmo[MP_TMO_ERASE] += (MP_TMO_ERASE_PER_KB *
+		    ((chip->code_memory_size + 1023) / 1024));
+	}
+	for (i = 0; i < MP_TMO__COUNT__; i ++) {
+		if (0 == mp->tmo_ovr[i])
+			continue;
+		mp->tmo[i] = mp->tmo_ovr[i];
+	}
+}
+
+/* Flush unreaded and get version. */
+static int
+msg_sync(minipro_p mp) {
+	int error = 0, verboce = mp->verboce;
+	minipro_stats_t stats;
+
+	/* Flush errors are expected, do not count them. */
+	memcpy(&stats, &mp->stats, sizeof(stats));
+	mp->verboce = 0;
+	for (size_t i = 0; i < MP_INIT_SUB_TRY_COUNT; i ++) {
+		error = msg_recv_ex(mp, mp->msg, sizeof(mp->msg), 100, NULL);
+		usleep(10000);
+		error = minipro_get_version_info_ex(mp, &mp->ver, 100);
+		if (0 == error)
+			break;
+	}
+	mp->verboce = verboce;
+	memcpy(&mp->stats, &stats, sizeof(stats));
+	mp->usb_error = 0;
+
+	return (error);
+}
+
+/* Idle device answers at first time: drain pending data without wait
+ * and do single get version with short timeout. */
+static int
+msg_sync_fast(minipro_p mp) {
+	int error, verboce = mp->verboce;
+	size_t i;
+	minipro_stats_t stats;
+
+	memcpy(&stats, &mp->stats, sizeof(stats));
+	mp->verboce = 0;
+	for (i = 0; i < MP_FAST_SYNC_DRAIN_MAX; i ++) {
+		if (0 != msg_recv_ex(mp, mp->msg, sizeof(mp->msg), 1, NULL))
+			break; /* Nothing more to drain. */
+	}
+	error = minipro_get_version_info_ex(mp, &mp->ver,
+	    MP_FAST_SYNC_TMO);
+	mp->verboce = verboce;
+	memcpy(&mp->stats, &stats, sizeof(stats));
+	mp->usb_error = 0;
+
+	return (error);
+}
+
+/* Open dev_idx-th device with vendor_id/product_id, once opened:
+ * device on same bus port path. */
+static libusb_device_handle *
+minipro_usb_dev_open(minipro_p mp) {
+	int ports_cnt;
+	ssize_t i, count;
+	size_t idx = 0;
+	uint8_t ports[sizeof(mp->usb_ports)];
+	libusb_device **list;
+	libusb_device_handle *usb_handle = NULL;
+	struct libusb_device_descriptor desc;
+
+	if (0 == mp->dev_idx && 0 == mp->usb_ports_cnt)
+		return (libusb_open_device_with_vid_pid(mp->ctx,
+		    mp->vendor_id, mp->product_id));
+	count = libusb_get_device_list(mp->ctx, &list);
+	if (0 > count)
+		return (NULL);
+	for (i = 0; i < count; i ++) {
+		if (0 != libusb_get_device_descriptor(list[i], &desc) ||
+		    mp->vendor_id != desc.idVendor ||
+		    mp->product_id != desc.idProduct)
+			continue;
+		if (0 != mp->usb_ports_cnt) { /* Reopen. */
+			ports_cnt = libusb_get_port_numbers(list[i], ports,
+			    (int)sizeof(ports));
+			if (mp->usb_bus != libusb_get_bus_number(list[i]) ||
+			    mp->usb_ports_cnt != ports_cnt ||
+			    0 != memcmp(mp->usb_ports, ports,
+			    (size_t)ports_cnt))
+				continue;
+		} else if (mp->dev_idx != idx ++) {
+			continue;
+		}
+		if (0 != libusb_open(list[i], &usb_handle)) {
+			usb_handle = NULL;
+		}
+		break;
+	}
+	libusb_free_device_list(list, 1);
+
+	return (usb_handle);
+}
+
+/* Remember opened device bus port path for reopen. */
+static void
+minipro_usb_dev_id_set(minipro_p mp) {
+	int ports_cnt;
+	libusb_device *dev;
+
+	dev = libusb_get_device(mp->usb_handle);
+	ports_cnt = libusb_get_port_numbers(dev, mp->usb_ports,
+	    (int)sizeof(mp->usb_ports));
+	if (0 >= ports_cnt)
+		return; /* Root hub or fail: reopen by index. */
+	mp->usb_bus = libusb_get_bus_number(dev);
+	mp->usb_ports_cnt = ports_cnt;
+}
+
+/* Device gone or reseted and re-enumerated: open it again. */
+static int
+minipro_usb_reopen(minipro_p mp) {
+	int error;
+	size_t i;
+
+	if (NULL != mp->usb_handle) {
+		libusb_release_interface(mp->usb_handle, 0);
+		libusb_close(mp->usb_handle);
+		mp->usb_handle = NULL;
+	}
+	for (i = 0; i < MP_REOPEN_TRY_COUNT; i ++) {
+		usleep(MP_REOPEN_DELAY);
+		mp->usb_handle = minipro_usb_dev_open(mp);
+		if (NULL != mp->usb_handle)
+			break;
+	}
+	if (NULL == mp->usb_handle) {
+		error = ENOENT;
+		MP_LOG_ERR(error, "error reopening device.");
+		return (error);
+	}
+	error = libusb_claim_interface(mp->usb_handle, 0);
+	if (0 != error) {
+		MP_LOG_USB_ERR(error, "libusb_claim_interface().");
+		return (error);
+	}
+
+	return (0);
+}
+
+/* Recover after USB transfer error: clear halt / reset / reopen device,
+ * resync, restore chip adapter and transaction state. */
+static int
+minipro_recover(minipro_p mp) {
+	int error, usb_error = mp->usb_error;
+
+	MP_LOG_TEXT_FMT("USB error %s, recovering...",
+	    libusb_error_name(usb_error));
+	mp->usb_error = 0;
+	if (NULL != mp->transfer) { /* No USB device. */
+		usb_error = LIBUSB_ERROR_TIMEOUT;
+	}
+	switch (usb_error) {
+	case LIBUSB_ERROR_TIMEOUT: /* Resync is enough. */
+		error = 0;
+		break;
+	case LIBUSB_ERROR_PIPE: /* Endpoint stall. */
+		libusb_clear_halt(mp->usb_handle, (1 | LIBUSB_ENDPOINT_IN));
+		error = libusb_clear_halt(mp->usb_handle,
+		    (1 | LIBUSB_ENDPOINT_OUT));
+		break;
+	case LIBUSB_ERROR_NO_DEVICE:
+		error = minipro_usb_reopen(mp);
+		break;
+	default:
+		error = libusb_reset_device(mp->usb_handle);
+		if (LIBUSB_ERROR_NOT_FOUND == error ||
+		    LIBUSB_ERROR_NO_DEVICE == error) { /* Re-enumerated. */
+			error = minipro_usb_reopen(mp);
+		}
+	}
+	if (0 != error)
+		goto err_out;
+	error = msg_sync(mp);
+	if (0 != error)
+		goto err_out;
+	if (NULL == mp->transfer &&
+	    0 != memcmp(mp->usb_serial, mp->ver.serial_num,
+	    sizeof(mp->usb_serial))) {
+		error = ENODEV;
+		MP_LOG_ERR(error, "Reopened other programmer: serial "
+		    "number mismatch.");
+		goto err_out;
+	}
+	if (NULL != mp->chip) {
+		minipro_end_transaction(mp);
+		error = minipro_chip_adapter_init(mp);
+		if (0 != error)
+			goto err_out;
+		error = minipro_begin_transaction(mp);
+		if (0 != error)
+			goto err_out;
+	}
+	mp->stats.recoveries ++;
+
+	return (0);
+
+err_out:
+	mp->stats.recovery_fails ++;
+	MP_LOG_ERR(error, "USB recovery failed.");
+	return (error);
 }
 
 
 /* API */
 
+uint32_t
+minipro_api_version(void) {
+
+	return (MINIPRO_API_VERSION);
+}
+
+static void *
+minipro_usb_ctx_thread(void *arg) {
+	minipro_usb_ctx_p ctx = arg;
+	struct timeval tv;
+
+	while (0 == atomic_load(&ctx->stop)) {
+		tv.tv_sec = 0;
+		tv.tv_usec = 100000; /* Stop check without interrupt. */
+		libusb_handle_events_timeout_completed(ctx->ctx, &tv, NULL);
+	}
+
+	return (NULL);
+}
+
+int
+minipro_usb_ctx_create(minipro_usb_ctx_p *ctx_ret) {
+	int error;
+	minipro_usb_ctx_p ctx;
+
+	if (NULL == ctx_ret)
+		return (EINVAL);
+	ctx = zalloc(sizeof(minipro_usb_ctx_t));
+	if (NULL == ctx)
+		return (ENOMEM);
+	atomic_init(&ctx->stop, 0);
+	error = libusb_init(&ctx->ctx);
+	if (0 != error) {
+		free(ctx);
+		return (error);
+	}
+	error = pthread_create(&ctx->thread, NULL, minipro_usb_ctx_thread,
+	    ctx);
+	if (0 != error) {
+		libusb_exit(ctx->ctx);
+		free(ctx);
+		return (error);
+	}
+	(*ctx_ret) = ctx;
+
+	return (0);
+}
+
+void
+minipro_usb_ctx_destroy(minipro_usb_ctx_p ctx) {
+
+	if (NULL == ctx)
+		return;
+	atomic_store(&ctx->stop, 1);
+#if defined(LIBUSB_API_VERSION) && LIBUSB_API_VERSION >= 0x01000105
+	libusb_interrupt_event_handler(ctx->ctx);
+#endif
+	pthread_join(ctx->thread, NULL);
+	libusb_exit(ctx->ctx);
+	free(ctx);
+}
+
 int
 minipro_open(uint16_t vendor_id, uint16_t product_id,
     int verboce, minipro_p *handle_ret) {
-	int error;
+
+	return (minipro_open_ex(NULL, vendor_id, product_id, 0, verboce,
+	    handle_ret));
+}
+
+int
+minipro_open_ex(minipro_usb_ctx_p ctx, uint16_t vendor_id,
+    uint16_t product_id, size_t dev_idx, int verboce,
+    minipro_p *handle_ret) {
+	int error, fast = 1;
 	minipro_p mp;
+	struct timespec ts_start, ts_end;
 
 	if (NULL == handle_ret)
 		return (EINVAL);
+	clock_gettime(CLOCK_MONOTONIC, &ts_start);
 	mp = zalloc(sizeof(minipro_t));
 	if (NULL == mp)
 		return (ENOMEM);
 	mp->verboce = verboce;
-
-	error = libusb_init(&mp->ctx);
-	if (0 != error) {
-		MP_LOG_USB_ERR(error, "libusb_init().");
-		goto err_out;
+	mp->vendor_id = vendor_id;
+	mp->product_id = product_id;
+	mp->dev_idx = dev_idx;
+	minipro_tmo_update(mp);
+
+	if (NULL != ctx) {
+		mp->usb_ctx = ctx;
+		mp->ctx = ctx->ctx;
+	} else {
+		error = libusb_init(&mp->ctx);
+		if (0 != error) {
+			MP_LOG_USB_ERR(error, "libusb_init().");
+			goto err_out;
+		}
 	}
 
-	mp->usb_handle = libusb_open_device_with_vid_pid(mp->ctx,
-	    vendor_id, product_id);
+	mp->usb_handle = minipro_usb_dev_open(mp);
 	if (NULL == mp->usb_handle) {
 		error = ENOENT;
 		MP_LOG_ERR(error, "error opening device.");
@@ -484,21 +984,24 @@ minipro_open(uint16_t vendor_id, uint16_t product_id,
 		MP_LOG_USB_ERR(error, "libusb_claim_interface().");
 		goto err_out;
 	}
+	minipro_usb_dev_id_set(mp);
 
 	/* Flush unreaded and get version. */
-	mp->verboce = 0;
-	for (size_t i = 0; i < MP_INIT_SUB_TRY_COUNT; i ++) {
-		error = msg_recv_ex(mp, mp->msg, sizeof(mp->msg), 100, NULL);
-		usleep(10000);
-		error = minipro_get_version_info(mp, &mp->ver);
-		if (0 == error)
-			break;
+	error = msg_sync_fast(mp);
+	if (0 != error) { /* Fallback to slow way. */
+		fast = 0;
+		error = msg_sync(mp);
 	}
-	mp->verboce = verboce;
 	if (0 != error) {
 		MP_LOG_ERR(error, "minipro_get_version_info().");
 		goto err_out;
 	}
+	memcpy(mp->usb_serial, mp->ver.serial_num, sizeof(mp->usb_serial));
+	clock_gettime(CLOCK_MONOTONIC, &ts_end);
+	MP_LOG_TEXT_FMT("Device opened in %"PRIu64" ms (%s handshake).",
+	    (uint64_t)(((ts_end.tv_sec - ts_start.tv_sec) * 1000) +
+	    ((ts_end.tv_nsec - ts_start.tv_nsec) / 1000000)),
+	    ((0 != fast) ? "fast" : "slow"));
 
 	(*handle_ret) = mp;
 
@@ -509,6 +1012,36 @@ err_out:
 	return (error);
 }
 
+int
+minipro_open_transfer(minipro_transfer_fn transfer, void *udata,
+    int verboce, minipro_p *handle_ret) {
+	int error;
+	minipro_p mp;
+
+	if (NULL == transfer || NULL == handle_ret)
+		return (EINVAL);
+	mp = zalloc(sizeof(minipro_t));
+	if (NULL == mp)
+		return (ENOMEM);
+	mp->verboce = verboce;
+	mp->transfer = transfer;
+	mp->transfer_udata = udata;
+	minipro_tmo_update(mp);
+
+	error = msg_sync_fast(mp);
+	if (0 != error) {
+		error = msg_sync(mp);
+	}
+	if (0 != error) {
+		MP_LOG_ERR(error, "minipro_get_version_info().");
+		minipro_close(mp);
+		return (error);
+	}
+	(*handle_ret) = mp;
+
+	return (0);
+}
+
 void
 minipro_close(minipro_p mp) {
 
@@ -516,22 +1049,29 @@ minipro_close(minipro_p mp) {
 		return;
 
 	minipro_chip_clean(mp);
-	libusb_release_interface(mp->usb_handle, 0);
-	libusb_close(mp->usb_handle);
-	libusb_exit(mp->ctx);
+	if (NULL != mp->usb_handle) {
+		libusb_release_interface(mp->usb_handle, 0);
+		libusb_close(mp->usb_handle);
+	}
+	if (NULL != mp->ctx &&
+	    NULL == mp->usb_ctx) { /* Own context. */
+		libusb_exit(mp->ctx);
+	}
 	free(mp);
 }
 
-int
-minipro_get_version_info(minipro_p mp, minipro_ver_p ver) {
+static int
+minipro_get_version_info_ex(minipro_p mp, minipro_ver_p ver,
+    uint32_t timeout) {
 	size_t rcvd;
 
 	if (NULL == mp)
 		return (EINVAL);
 
-	//MP_RET_ON_ERR(msg_send_chip_hdr_ex(mp, MP_CMD_GET_VERSION, 5, 100, NULL));
-	msg_send_chip_hdr_ex(mp, MP_CMD_GET_VERSION, 5, 100, NULL);
-	MP_RET_ON_ERR(msg_recv_ex(mp, mp->msg, sizeof(mp->msg), 100, &rcvd));
+	//MP_RET_ON_ERR(msg_send_chip_hdr_ex(mp, MP_CMD_GET_VERSION, 5, timeout, NULL));
+	msg_send_chip_hdr_ex(mp, MP_CMD_GET_VERSION, 5, timeout, NULL);
+	MP_RET_ON_ERR(msg_recv_ex(mp, mp->msg, sizeof(mp->msg), timeout,
+	    &rcvd));
 
 	if (MP_CMD_GET_VERSION != mp->msg[0])
 		return (EBADMSG);
@@ -549,6 +1089,12 @@ minipro_get_version_info(minipro_p mp, minipro_ver_p ver) {
 	return (0);
 }
 
+int
+minipro_get_version_info(minipro_p mp, minipro_ver_p ver) {
+
+	return (minipro_get_version_info_ex(mp, ver, 100));
+}
+
 int
 minipro_is_version_info_ok(minipro_p mp) {
 
@@ -625,7 +1171,7 @@ minipro_print_info(minipro_p mp) {
 
 
 static int
-minipro_hardware_check_pins(minipro_p mp, mp_zif_pins_p pins,
+minipro_hardware_check_pins(minipro_p mp, const mp_zif_pins_t *pins,
     size_t pins_count, int is_gnd, size_t *errors_count) {
 	int error = 0, pin_ok;
 	size_t i, rcvd;
@@ -773,7 +1319,6 @@ err_out:
 int
 minipro_chip_set(minipro_p mp, chip_p chip, uint8_t icsp) {
 	int error;
-	uint8_t tsop48;
 
 	if (NULL == mp)
 		return (EINVAL);
@@ -791,8 +1336,8 @@ minipro_chip_set(minipro_p mp, chip_p chip, uint8_t icsp) {
 		    chip->write_block_size);
 		return (EINVAL);
 	}
-	if ((sizeof(mp->msg) - 7) < chip->read_block_size ||
-	    (sizeof(mp->msg) - 7) < chip->write_block_size) {
+	if (MP_BLOCK_SIZE_MAX < chip->read_block_size ||
+	    MP_BLOCK_SIZE_MAX < chip->write_block_size) {
 		MP_LOG_ERR_FMT(EINVAL,
 		    "Cant handle this chip: increase msg_hdr[%zu] buf "
 		    "to %i and recompile.",
@@ -802,26 +1347,54 @@ minipro_chip_set(minipro_p mp, chip_p chip, uint8_t icsp) {
 	}
 
 	/* Set new. */
-	mp->read_block_buf = malloc((chip->read_block_size + 16));
+	mp->read_block_buf = malloc((MP_BLOCK_SIZE_MAX + 16)); /* For tuning. */
 	mp->write_block_buf = malloc((chip->write_block_size + 16));
+	mp->ovl_buf = malloc((MP_BLOCK_SIZE_MAX + 16));
 	if (NULL == mp->read_block_buf ||
-	    NULL == mp->write_block_buf) {
+	    NULL == mp->write_block_buf ||
+	    NULL == mp->ovl_buf) {
 		minipro_chip_clean(mp);
 		return (ENOMEM);
 	}
 	mp->chip = chip;
 	mp->icsp = icsp;
+	mp->rd_blk_size = chip->read_block_size;
+	mp->status_poll_ival = 1;
+	mp->status_poll_cnt = 0;
+	mp->rd_poll_ival = 1;
+	if (0 != (CHIP_OPT4_ADDR_SCALE & chip->opts4)) {
+		mp->read_block = mp_read_block_as;
+		mp->write_block = mp_write_block_as;
+	} else {
+		mp->read_block = mp_read_block_raw;
+		mp->write_block = mp_write_block_raw;
+	}
+	minipro_tmo_update(mp);
 	/* Generate msg header with chip constans. */
-	msg_chip_hdr_gen(chip, icsp, mp->msg_hdr, sizeof(mp->msg_hdr));
+	mp_msg_chip_hdr_gen(chip, icsp, mp->msg_hdr, sizeof(mp->msg_hdr));
+
+	error = minipro_chip_adapter_init(mp);
+	if (0 != error) {
+		minipro_chip_clean(mp);
+		return (error);
+	}
+
+	return (0);
+}
+
+/* Unlocking the TSOP48 adapter (if applicable). */
+static int
+minipro_chip_adapter_init(minipro_p mp) {
+	int error;
+	uint8_t tsop48;
+	chip_p chip = mp->chip;
 
 	if (CHIP_PKG_D_ADAPTER_TSOP48 != CHIP_PKG_D_ADAPTER(chip->package_details) &&
 	    CHIP_PKG_D_ADAPTER_SOP44 != CHIP_PKG_D_ADAPTER(chip->package_details) &&
 	    CHIP_PKG_D_ADAPTER_SOP56 != CHIP_PKG_D_ADAPTER(chip->package_details))
 		return (0);
-	/* Unlocking the TSOP48 adapter (if applicable). */
 	error = minipro_unlock_tsop48(mp, &tsop48);
 	if (0 != error) {
-		minipro_chip_clean(mp);
 		MP_LOG_ERR(error, "Cant unlock TSOP48.");
 		return (error);
 	}
@@ -830,7 +1403,6 @@ minipro_chip_set(minipro_p mp, chip_p chip, uint8_t icsp) {
 		MP_LOG_TEXT("Found TSOP adapter V3.");
 		break;
 	case MP_TSOP48_TYPE_NONE:
-		minipro_chip_clean(mp);
 		MP_LOG_ERR(EINVAL, "TSOP adapter not found!");
 		return (EINVAL);
 	case MP_TSOP48_TYPE_V2:
@@ -864,9 +1436,15 @@ minipro_chip_clean(minipro_p mp) {
 	/* Free res. */
 	free(mp->read_block_buf);
 	free(mp->write_block_buf);
+	free(mp->ovl_buf);
 	mp->read_block_buf = NULL;
 	mp->write_block_buf = NULL;
+	mp->ovl_buf = NULL;
 	mp->chip = NULL;
+	mp->read_block = NULL;
+	mp->write_block = NULL;
+	mp->rd_blk_size = 0;
+	minipro_tmo_update(mp);
 }
 
 chip_p
@@ -877,6 +1455,141 @@ minipro_chip_get(minipro_p mp) {
 	return (mp->chip);
 }
 
+minipro_ver_p
+minipro_ver_get(minipro_p mp) {
+
+	if (NULL == mp)
+		return (NULL);
+	return (&mp->ver);
+}
+
+int
+minipro_tune_set(minipro_p mp, uint32_t read_block_size,
+    uint32_t status_poll_ival) {
+
+	if (NULL == mp || NULL == mp->chip)
+		return (EINVAL);
+	if (0 == read_block_size) {
+		read_block_size = mp->chip->read_block_size;
+	}
+	if (0 == status_poll_ival) {
+		status_poll_ival = 1;
+	}
+	/* Blocks must not cross code memory end. */
+	if (MP_BLOCK_SIZE_MAX < read_block_size ||
+	    0 != (read_block_size % mp->chip->read_block_size) ||
+	    0 != (mp->chip->code_memory_size % read_block_size))
+		return (EINVAL);
+	mp->rd_blk_size = read_block_size;
+	mp->status_poll_ival = status_poll_ival;
+	mp->status_poll_cnt = 0;
+	minipro_tmo_update(mp);
+
+	return (0);
+}
+
+int
+minipro_tune_get(minipro_p mp, uint32_t *read_block_size,
+    uint32_t *status_poll_ival) {
+
+	if (NULL == mp || NULL == mp->chip)
+		return (EINVAL);
+	if (NULL != read_block_size) {
+		(*read_block_size) = mp->rd_blk_size;
+	}
+	if (NULL != status_poll_ival) {
+		(*status_poll_ival) = mp->status_poll_ival;
+	}
+
+	return (0);
+}
+
+int
+minipro_timeout_set(minipro_p mp, int op, uint32_t timeout) {
+
+	if (NULL == mp || 0 > op || MP_TMO__COUNT__ <= op)
+		return (EINVAL);
+	mp->tmo_ovr[op] = timeout;
+	minipro_tmo_update(mp);
+
+	return (0);
+}
+
+uint32_t
+minipro_timeout_get(minipro_p mp, int op) {
+
+	if (NULL == mp || 0 > op || MP_TMO__COUNT__ <= op)
+		return (0);
+	return (mp->tmo[op]);
+}
+
+int
+minipro_stats_get(minipro_p mp, minipro_stats_p stats) {
+
+	if (NULL == mp || NULL == stats)
+		return (EINVAL);
+	memcpy(stats, &mp->stats, sizeof(minipro_stats_t));
+
+	return (0);
+}
+
+int
+minipro_data_cb_set(minipro_p mp, minipro_data_cb cb, void *udata) {
+
+	if (NULL == mp)
+		return (EINVAL);
+	mp->data_cb = cb;
+	mp->data_cb_udata = udata;
+
+	return (0);
+}
+
+int
+minipro_write_fill_set(minipro_p mp, int enable, uint8_t val,
+    const uint8_t *img, size_t img_size) {
+
+	if (NULL == mp ||
+	    (NULL == img && 0 != img_size))
+		return (EINVAL);
+	mp->wr_fill = enable;
+	mp->wr_fill_val = val;
+	mp->wr_fill_img = img;
+	mp->wr_fill_img_size = ((NULL != img) ? img_size : 0);
+
+	return (0);
+}
+
+int
+minipro_verify_mask_set(minipro_p mp, const uint8_t *mask,
+    size_t mask_size) {
+
+	if (NULL == mp ||
+	    (NULL == mask && 0 != mask_size))
+		return (EINVAL);
+	mp->vr_mask = mask;
+	mp->vr_mask_size = ((NULL != mask) ? mask_size : 0);
+
+	return (0);
+}
+
+int
+minipro_overlay_set(minipro_p mp, const mp_overlay_t *ovls,
+    size_t count) {
+	size_t i;
+
+	if (NULL == mp ||
+	    (NULL == ovls && 0 != count))
+		return (EINVAL);
+	for (i = 0; i < count; i ++) {
+		if (NULL == ovls[i].data && 0 != ovls[i].size)
+			return (EINVAL);
+	}
+	mp->ovls = ovls;
+	mp->ovls_count = ((NULL != ovls) ? count : 0);
+
+	return (0);
+}
+
 
 int
 minipro_begin_transaction(minipro_p mp) {
@@ -946,9 +1659,12 @@ int
 minipro_erase(minipro_p mp) {
 	int error;
 	size_t rcvd;
+	uint64_t tm;
 
 	if (NULL == mp || NULL == mp->chip)
 		return (EINVAL);
+
+	tm = mp_time_us();
 	MP_RET_ON_ERR(minipro_begin_transaction(mp));
 	msg_chip_hdr_set(mp, MP_CMD_ERASE, 15);
 	/* Set fuses count. */
@@ -959,13 +1675,15 @@ minipro_erase(minipro_p mp) {
 		mp->msg[2] = mp->chip->fuses[0].size;
 	}
 	MP_RET_ON_ERR_CLEANUP(msg_send(mp, mp->msg, 15, NULL));
-	MP_RET_ON_ERR_CLEANUP(msg_recv(mp, mp->msg, sizeof(mp->msg),
-	    &rcvd)); /* rcvd == 10 */
+	MP_RET_ON_ERR_CLEANUP(msg_recv_ex(mp, mp->msg, sizeof(mp->msg),
+	    mp->tmo[MP_TMO_ERASE], &rcvd)); /* rcvd == 10 */
 	/* Overcurrency status check. */
 	MP_RET_ON_ERR_CLEANUP(minipro_overcurrency_chk(mp));
 
 err_out:
 	minipro_end_transaction(mp); /* Let MP_CMD_ERASE to take an effect. */
+	mp->stats.erase_us += (mp_time_us() - tm);
+	mp->stats.erases ++;
 	return (error);
 }
 
@@ -1022,15 +1740,17 @@ minipro_unlock_tsop48(minipro_p mp, uint8_t *type) {
 	return (0);
 }
 
-int
-minipro_get_status(minipro_p mp, minipro_status_p status) {
+static int
+minipro_get_status_ex(minipro_p mp, minipro_status_p status,
+    uint32_t timeout) {
 	size_t rcvd;
 
 	if (NULL == mp || NULL == mp->chip || NULL == status)
 		return (EINVAL);
 
 	MP_RET_ON_ERR(msg_send_chip_hdr(mp, MP_CMD_GET_STATUS, 5, NULL));
-	MP_RET_ON_ERR(msg_recv(mp, mp->msg, sizeof(mp->msg), &rcvd)); /* rcvd == 32 */
+	MP_RET_ON_ERR(msg_recv_ex(mp, mp->msg, sizeof(mp->msg), timeout,
+	    &rcvd)); /* rcvd == 32 */
 	if (10 > rcvd)
 		return (EMSGSIZE);
 	status->error = U8TO16_LITTLE(&mp->msg[0]);
@@ -1038,18 +1758,34 @@ minipro_get_status(minipro_p mp, minipro_status_p status) {
 	status->c2 = U8TO16_LITTLE(&mp->msg[4]);
 	status->address = U8TO32n_LITTLE(&mp->msg[6], 3);
 	status->ovp = mp->msg[9]; /* Overcurrency protection. */
+	mp->stats.status_polls ++;
+	if (0 != status->ovp) {
+		mp->stats.overcurrents ++;
+	}
 
 	return (0);
 }
 
+int
+minipro_get_status(minipro_p mp, minipro_status_p status) {
+
+	if (NULL == mp)
+		return (EINVAL);
+	return (minipro_get_status_ex(mp, status, mp->tmo[MP_TMO_CMD]));
+}
+
 int
 minipro_overcurrency_chk(minipro_p mp) {
 	minipro_status_t status;
+	uint64_t tm;
 
 	if (NULL == mp || NULL == mp->chip)
 		return (EINVAL);
 
+	tm = mp_time_us();
 	MP_RET_ON_ERR(minipro_get_status(mp, &status));
+	mp->stats.ovc_check_us += (mp_time_us() - tm);
+	mp->stats.ovc_checks ++;
 	if (0 != status.ovp) {
 		MP_LOG_ERR(-1, "Overcurrency protection.");
 		return (-1);
@@ -1058,50 +1794,49 @@ minipro_overcurrency_chk(minipro_p mp) {
 	return (0);
 }
 
-int
-minipro_read_block(minipro_p mp, uint8_t cmd, uint32_t addr,
+/* Block routines: address already translated. */
+static int
+mp_read_block_raw(minipro_p mp, uint8_t cmd, uint32_t addr,
     uint8_t *buf, size_t buf_size) {
 	size_t rcvd;
+	uint64_t tm = mp_time_us();
 
-	if (NULL == mp || NULL == mp->chip ||
-	    (sizeof(mp->msg) - 7) < buf_size)
-		return (EINVAL);
 	msg_chip_hdr_set(mp, cmd, 18);
 	U16TO8_LITTLE((uint16_t)buf_size, &mp->msg[2]);
-	/* Translating address to protocol-specific. */
-	if (0 != (CHIP_OPT4_ADDR_SCALE & mp->chip->opts4)) {
-		addr = (addr >> 1);
-	}
 	U24TO8_LITTLE(addr, &mp->msg[4]);
 	MP_RET_ON_ERR(msg_send(mp, mp->msg, 18, NULL));
-	MP_RET_ON_ERR(msg_recv(mp, buf, buf_size, &rcvd));
+	MP_RET_ON_ERR(msg_recv_ex(mp, buf, buf_size, mp->tmo[MP_TMO_READ],
+	    &rcvd));
 	if (rcvd != buf_size)
 		return (EMSGSIZE);
-	/* Overcurrency status check. */
-	MP_RET_ON_ERR(minipro_overcurrency_chk(mp));
+	mp->stats.blocks_read ++;
+	mp->stats.read_block_us += (mp_time_us() - tm);
+	/* Overcurrency status check, every rd_poll_ival blocks. */
+	mp->status_poll_cnt ++;
+	if (mp->rd_poll_ival <= mp->status_poll_cnt) {
+		mp->status_poll_cnt = 0;
+		MP_RET_ON_ERR(minipro_overcurrency_chk(mp));
+	}
 
 	return (0);
 }
 
-int
-minipro_write_block(minipro_p mp, uint8_t cmd, uint32_t addr,
+static int
+mp_write_block_raw(minipro_p mp, uint8_t cmd, uint32_t addr,
     const uint8_t *buf, size_t buf_size) {
 	minipro_status_t status;
+	uint64_t tm = mp_time_us();
 
-	if (NULL == mp || NULL == mp->chip ||
-	    (sizeof(mp->msg) - 7) < buf_size)
-		return (EINVAL);
 	msg_chip_hdr_set(mp, cmd, 7);
 	U16TO8_LITTLE((uint16_t)buf_size, &mp->msg[2]);
-	if (0 != (CHIP_OPT4_ADDR_SCALE & mp->chip->opts4)) {
-		addr = (addr >> 1);
-	}
 	U24TO8_LITTLE(addr, &mp->msg[4]);
 	memcpy(&mp->msg[7], buf, buf_size);
-	MP_RET_ON_ERR(msg_send(mp, mp->msg, (7 + buf_size), NULL));
+	MP_RET_ON_ERR(msg_send_ex(mp, mp->msg, (7 + buf_size),
+	    mp->tmo[MP_TMO_WRITE], NULL));
 
-	/* Status check. */
-	MP_RET_ON_ERR(minipro_get_status(mp, &status));
+	/* Status check, wait for block write done. */
+	MP_RET_ON_ERR(minipro_get_status_ex(mp, &status,
+	    mp->tmo[MP_TMO_WRITE]));
 	if (0 != status.ovp) {
 		MP_LOG_ERR(-1, "Overcurrency protection.");
 		return (-1);
@@ -1113,10 +1848,103 @@ minipro_write_block(minipro_p mp, uint8_t cmd, uint32_t addr,
 		    status.address, status.c2, status.c1);
 		return (-1);
 	}
+	mp->stats.blocks_written ++;
+	mp->stats.write_block_us += (mp_time_us() - tm);
 
 	return (0);
 }
 
+/* Byte address to protocol word address: CHIP_OPT4_ADDR_SCALE. */
+static int
+mp_read_block_as(minipro_p mp, uint8_t cmd, uint32_t addr,
+    uint8_t *buf, size_t buf_size) {
+
+	return (mp_read_block_raw(mp, cmd, (addr >> 1), buf, buf_size));
+}
+
+static int
+mp_write_block_as(minipro_p mp, uint8_t cmd, uint32_t addr,
+    const uint8_t *buf, size_t buf_size) {
+
+	return (mp_write_block_raw(mp, cmd, (addr >> 1), buf, buf_size));
+}
+
+/* Overcurrency check interval for read operation: status_poll_ival is
+ * calibrated for code page only, other pages checked every block. */
+static inline void
+minipro_rd_poll_set(minipro_p mp, uint8_t cmd) {
+
+	mp->rd_poll_ival = ((MP_CMD_READ_CODE == cmd) ?
+	    mp->status_poll_ival : 1);
+}
+
+int
+minipro_read_block(minipro_p mp, uint8_t cmd, uint32_t addr,
+    uint8_t *buf, size_t buf_size) {
+
+	if (NULL == mp || NULL == mp->chip ||
+	    MP_BLOCK_SIZE_MAX < buf_size)
+		return (EINVAL);
+	minipro_rd_poll_set(mp, cmd);
+
+	return (mp->read_block(mp, cmd, addr, buf, buf_size));
+}
+
+int
+minipro_write_block(minipro_p mp, uint8_t cmd, uint32_t addr,
+    const uint8_t *buf, size_t buf_size) {
+
+	if (NULL == mp || NULL == mp->chip ||
+	    MP_BLOCK_SIZE_MAX < buf_size)
+		return (EINVAL);
+
+	return (mp->write_block(mp, cmd, addr, buf, buf_size));
+}
+
+/* Block read/write with recovery and retry on USB transfer errors.
+ * is_write: 0 - read to rd_buf, else write wr_buf. */
+static int
+minipro_block_rt(minipro_p mp, int is_write, uint8_t cmd, uint32_t addr,
+    uint8_t *rd_buf, const uint8_t *wr_buf, size_t buf_size) {
+	int error;
+	size_t i;
+	useconds_t delay = MP_BLOCK_RETRY_DELAY;
+
+	for (i = 0;; i ++) {
+		mp->usb_error = 0;
+		if (0 != is_write) {
+			error = mp->write_block(mp, cmd, addr, wr_buf,
+			    buf_size);
+		} else {
+			error = mp->read_block(mp, cmd, addr, rd_buf,
+			    buf_size);
+		}
+		if (0 == error ||
+		    0 == mp->usb_error ||
+		    MP_BLOCK_RETRY_COUNT <= i)
+			return (error);
+		usleep(delay);
+		delay *= 2;
+		mp->stats.retries ++;
+		if (0 != minipro_recover(mp))
+			return (error);
+	}
+}
+
+static inline int
+minipro_read_block_rt(minipro_p mp, uint8_t cmd, uint32_t addr,
+    uint8_t *buf, size_t buf_size) {
+
+	return (minipro_block_rt(mp, 0, cmd, addr, buf, NULL, buf_size));
+}
+
+static inline int
+minipro_write_block_rt(minipro_p mp, uint8_t cmd, uint32_t addr,
+    const uint8_t *buf, size_t buf_size) {
+
+	return (minipro_block_rt(mp, 1, cmd, addr, NULL, buf, buf_size));
+}
+
 int
 minipro_read_fuses(minipro_p mp, uint8_t cmd,
     uint8_t *buf, size_t buf_size) {
@@ -1191,7 +2019,7 @@ minipro_read_buf(minipro_p mp, uint8_t cmd,
     uint32_t addr, uint8_t *buf, size_t buf_size,
     minipro_progress_cb cb, void *udata) {
 	int error = 0;
-	uint32_t blk_size, offset;
+	uint32_t blk_size, offset, start = addr;
 	size_t to_read = buf_size, tm;
 
 	if (NULL == mp || NULL == mp->chip || NULL == buf ||
@@ -1201,18 +2029,21 @@ minipro_read_buf(minipro_p mp, uint8_t cmd,
 	MP_RET_ON_ERR(minipro_begin_transaction(mp));
 	/* Overcurrency status check. */
 	MP_RET_ON_ERR_CLEANUP(minipro_overcurrency_chk(mp));
+	minipro_rd_poll_set(mp, cmd);
 
-	blk_size = mp->chip->read_block_size;
+	blk_size = ((MP_CMD_READ_CODE == cmd) ?
+	    mp->rd_blk_size : mp->chip->read_block_size);
 	offset = (addr % blk_size); /* Offset from first block start. */
 	/* Need to read part from first block / pre alligment. */
 	if (0 != offset) {
 		addr -= offset; /* Allign addr to block size. */
 		MP_PROGRESS_UPDATE(cb, mp, 0, buf_size, udata);
-		MP_RET_ON_ERR_CLEANUP(minipro_read_block(mp, cmd, addr,
+		MP_RET_ON_ERR_CLEANUP(minipro_read_block_rt(mp, cmd, addr,
 		    mp->read_block_buf, blk_size));
 		tm = MIN((blk_size - offset), to_read); /* Data size to store in buf. */
 		memcpy(buf, (mp->read_block_buf + offset), tm);
-		addr += tm;
+		MP_DATA_UPDATE(mp, start, buf, tm);
+		addr += blk_size; /* Next block start. */
 		buf += tm;
 		to_read -= tm;
 	}
@@ -1221,8 +2052,10 @@ minipro_read_buf(minipro_p mp, uint8_t cmd,
 	while (blk_size <= to_read) {
 		MP_PROGRESS_UPDATE(cb, mp, (buf_size - to_read),
 		    buf_size, udata);
-		MP_RET_ON_ERR_CLEANUP(minipro_read_block(mp, cmd, addr,
+		MP_RET_ON_ERR_CLEANUP(minipro_read_block_rt(mp, cmd, addr,
 		    buf, blk_size));
+		MP_DATA_UPDATE(mp, (start + (uint32_t)(buf_size - to_read)),
+		    buf, blk_size);
 		addr += blk_size;
 		buf += blk_size;
 		to_read -= blk_size;
@@ -1232,9 +2065,15 @@ minipro_read_buf(minipro_p mp, uint8_t cmd,
 	if (0 != to_read) {
 		MP_PROGRESS_UPDATE(cb, mp, (buf_size - to_read),
 		    buf_size, udata);
-		MP_RET_ON_ERR_CLEANUP(minipro_read_block(mp, cmd, addr,
+		MP_RET_ON_ERR_CLEANUP(minipro_read_block_rt(mp, cmd, addr,
 		    mp->read_block_buf, blk_size));
 		memcpy(buf, mp->read_block_buf, to_read);
+		MP_DATA_UPDATE(mp, (start + (uint32_t)(buf_size - to_read)),
+		    buf, to_read);
+	}
+	/* Final overcurrency status check if some was skipped. */
+	if (1 < mp->rd_poll_ival) {
+		MP_RET_ON_ERR_CLEANUP(minipro_overcurrency_chk(mp));
 	}
 
 	MP_PROGRESS_UPDATE(cb, mp, buf_size, buf_size, udata);
@@ -1261,25 +2100,27 @@ minipro_verify_buf(minipro_p mp, uint8_t cmd,
 	MP_RET_ON_ERR(minipro_begin_transaction(mp));
 	/* Overcurrency status check. */
 	MP_RET_ON_ERR_CLEANUP(minipro_overcurrency_chk(mp));
+	minipro_rd_poll_set(mp, cmd);
 
-	blk_size = mp->chip->read_block_size;
+	blk_size = ((MP_CMD_READ_CODE == cmd) ?
+	    mp->rd_blk_size : mp->chip->read_block_size);
 	offset = (addr % blk_size); /* Offset from first block start. */
 	/* Need to read part from first block / pre alligment. */
 	if (0 != offset) {
 		addr -= offset; /* Allign addr to block size. */
 		MP_PROGRESS_UPDATE(cb, mp, 0, buf_size, udata);
-		MP_RET_ON_ERR_CLEANUP(minipro_read_block(mp, cmd, addr,
+		MP_RET_ON_ERR_CLEANUP(minipro_read_block_rt(mp, cmd, addr,
 		    mp->read_block_buf, blk_size));
 		tm = MIN((blk_size - offset), to_read); /* Data size to store in buf. */
-		diff_off = memcmp_idx(buf,
-		    (mp->read_block_buf + offset), tm);
+		diff_off = minipro_verify_cmp(mp, (addr + offset), buf,
+		    (mp->read_block_buf + offset), tm, buf_val);
 		if (diff_off != tm) {
 			/* movemem() for get (*chip_val) at diff pos offset. */
 			memmove(mp->read_block_buf,
 			    (mp->read_block_buf + offset), tm);
 			goto diff_out;
 		}
-		addr += tm;
+		addr += blk_size; /* Next block start. */
 		buf += tm;
 		to_read -= tm;
 	}
@@ -1288,9 +2129,10 @@ minipro_verify_buf(minipro_p mp, uint8_t cmd,
 	while (blk_size <= to_read) {
 		MP_PROGRESS_UPDATE(cb, mp, (buf_size - to_read),
 		    buf_size, udata);
-		MP_RET_ON_ERR_CLEANUP(minipro_read_block(mp, cmd, addr,
+		MP_RET_ON_ERR_CLEANUP(minipro_read_block_rt(mp, cmd, addr,
 		    mp->read_block_buf, blk_size));
-		diff_off = memcmp_idx(buf, mp->read_block_buf, blk_size);
+		diff_off = minipro_verify_cmp(mp, addr, buf,
+		    mp->read_block_buf, blk_size, buf_val);
 		if (diff_off != blk_size)
 			goto diff_out;
 		addr += blk_size;
@@ -1302,12 +2144,17 @@ minipro_verify_buf(minipro_p mp, uint8_t cmd,
 	if (0 != to_read) {
 		MP_PROGRESS_UPDATE(cb, mp, (buf_size - to_read),
 		    buf_size, udata);
-		MP_RET_ON_ERR_CLEANUP(minipro_read_block(mp, cmd, addr,
+		MP_RET_ON_ERR_CLEANUP(minipro_read_block_rt(mp, cmd, addr,
 		    mp->read_block_buf, blk_size));
-		diff_off = memcmp_idx(buf, mp->read_block_buf, to_read);
+		diff_off = minipro_verify_cmp(mp, addr, buf,
+		    mp->read_block_buf, to_read, buf_val);
 		if (diff_off != to_read)
 			goto diff_out;
 	}
+	/* Final overcurrency status check if some was skipped. */
+	if (1 < mp->rd_poll_ival) {
+		MP_RET_ON_ERR_CLEANUP(minipro_overcurrency_chk(mp));
+	}
 
 	MP_PROGRESS_UPDATE(cb, mp, buf_size, buf_size, udata);
 	MP_RET_ON_ERR(minipro_end_transaction(mp));
@@ -1319,7 +2166,6 @@ minipro_verify_buf(minipro_p mp, uint8_t cmd,
 diff_out:
 	(*err_offset) = (diff_off + (buf_size - to_read));
 	(*chip_val) = mp->read_block_buf[diff_off];
-	(*buf_val) = buf[diff_off];
 err_out:
 	minipro_end_transaction(mp);
 	return (error);
@@ -1331,7 +2177,7 @@ minipro_write_buf(minipro_p mp, uint8_t cmd,
     minipro_progress_cb cb, void *udata) {
 	int error = 0;
 	uint8_t read_cmd;
-	uint32_t blk_size, offset;
+	uint32_t blk_size, offset, tail;
 	size_t to_write = buf_size, tm;
 
 	if (NULL == mp || NULL == mp->chip ||
@@ -1356,21 +2202,42 @@ minipro_write_buf(minipro_p mp, uint8_t cmd,
 	if (0 != offset) {
 		addr -= offset; /* Allign addr to block size. */
 		MP_PROGRESS_UPDATE(cb, mp, 0, buf_size, udata);
-		/* Read head of first block. */
-		/* read_block_size may not match write_block_size,
-		 * use minipro_read_buf() to handle this case. */
-		MP_RET_ON_ERR(minipro_read_buf(mp, read_cmd,
-		    addr, mp->write_block_buf, offset, NULL, NULL));
-
-		MP_RET_ON_ERR(minipro_begin_transaction(mp));
+		tm = MIN((blk_size - offset), to_write); /* Data size to store in buf. */
+		tail = (offset + (uint32_t)tm); /* Block end part after data. */
+		if (0 != mp->wr_fill) { /* Pad head and tail of block. */
+			minipro_write_fill(mp, addr, mp->write_block_buf,
+			    offset);
+			if (tail < blk_size) {
+				minipro_write_fill(mp, (addr + tail),
+				    (mp->write_block_buf + tail),
+				    (blk_size - tail));
+			}
+			MP_RET_ON_ERR(minipro_begin_transaction(mp));
+			/* Overcurrency status check. */
+			MP_RET_ON_ERR_CLEANUP(minipro_overcurrency_chk(mp));
+		} else {
+			/* Read head and tail of first block. */
+			/* read_block_size may not match write_block_size,
+			 * use minipro_read_buf() to handle this case. */
+			MP_RET_ON_ERR(minipro_read_buf(mp, read_cmd,
+			    addr, mp->write_block_buf, offset, NULL, NULL));
+			if (tail < blk_size) {
+				MP_RET_ON_ERR(minipro_read_buf(mp, read_cmd,
+				    (addr + tail),
+				    (mp->write_block_buf + tail),
+				    (blk_size - tail), NULL, NULL));
+			}
+			MP_RET_ON_ERR(minipro_begin_transaction(mp));
+		}
 
 		/* Update block. */
-		tm = MIN((blk_size - offset), to_write); /* Data size to store in buf. */
 		memcpy((mp->write_block_buf + offset), buf, tm);
+		minipro_overlay_apply(mp, addr, mp->write_block_buf, blk_size,
+		    mp->write_block_buf);
 		/* Write updated block. */
-		MP_RET_ON_ERR_CLEANUP(minipro_write_block(mp, cmd, addr,
+		MP_RET_ON_ERR_CLEANUP(minipro_write_block_rt(mp, cmd, addr,
 		    mp->write_block_buf, blk_size));
-		addr += tm;
+		addr += blk_size; /* Next block start. */
 		buf += tm;
 		to_write -= tm;
 	} else {
@@ -1383,8 +2250,9 @@ minipro_write_buf(minipro_p mp, uint8_t cmd,
 	while (blk_size <= to_write) {
 		MP_PROGRESS_UPDATE(cb, mp, (buf_size - to_write),
 		    buf_size, udata);
-		MP_RET_ON_ERR_CLEANUP(minipro_write_block(mp, cmd, addr,
-		    buf, blk_size));
+		MP_RET_ON_ERR_CLEANUP(minipro_write_block_rt(mp, cmd, addr,
+		    minipro_overlay_apply(mp, addr, buf, blk_size,
+		    mp->write_block_buf), blk_size));
 		addr += blk_size;
 		buf += blk_size;
 		to_write -= blk_size;
@@ -1394,16 +2262,23 @@ minipro_write_buf(minipro_p mp, uint8_t cmd,
 	if (0 != to_write) {
 		MP_PROGRESS_UPDATE(cb, mp, (buf_size - to_write),
 		    buf_size, udata);
-		/* Read tail of last block. */
-		MP_RET_ON_ERR(minipro_end_transaction(mp));
-		MP_RET_ON_ERR(minipro_read_buf(mp, read_cmd,
-		    (addr + (uint32_t)to_write),
-		    (mp->write_block_buf + to_write),
-		    (blk_size - to_write), NULL, NULL));
+		if (0 != mp->wr_fill) { /* Pad tail of last block. */
+			minipro_write_fill(mp, (addr + (uint32_t)to_write),
+			    (mp->write_block_buf + to_write),
+			    (blk_size - to_write));
+		} else { /* Read tail of last block. */
+			MP_RET_ON_ERR(minipro_end_transaction(mp));
+			MP_RET_ON_ERR(minipro_read_buf(mp, read_cmd,
+			    (addr + (uint32_t)to_write),
+			    (mp->write_block_buf + to_write),
+			    (blk_size - to_write), NULL, NULL));
+			MP_RET_ON_ERR(minipro_begin_transaction(mp));
+		}
 		/* Set data and write. */
 		memcpy(mp->write_block_buf, buf, to_write);
-		MP_RET_ON_ERR(minipro_begin_transaction(mp));
-		MP_RET_ON_ERR_CLEANUP(minipro_write_block(mp, cmd, addr,
+		minipro_overlay_apply(mp, addr, mp->write_block_buf, blk_size,
+		    mp->write_block_buf);
+		MP_RET_ON_ERR_CLEANUP(minipro_write_block_rt(mp, cmd, addr,
 		    mp->write_block_buf, blk_size));
 	}
 
@@ -1539,7 +2414,7 @@ minipro_fuses_verify(minipro_p mp, const uint8_t *buf, size_t buf_size,
 				continue;
 			val = U8TO32n_LITTLE(&tmbuf[fuses[j].offset],
 			    fuses[j].size);
-			error = buf_get_named_line_val32(buf, buf_size,
+			error = mp_buf_get_named_line_val32(buf, buf_size,
 			    fuses[j].name, strlen(fuses[j].name), &valb);
 			if (0 != error) {
 				MP_LOG_ERR_FMT(error,
@@ -1612,7 +2487,7 @@ minipro_fuses_write(minipro_p mp, const uint8_t *buf, size_t buf_size,
 		for (j = 1; i < count; j ++) {
 			if (cmd != fuses[j].cmd)
 				continue;
-			error = buf_get_named_line_val32(buf, buf_size,
+			error = mp_buf_get_named_line_val32(buf, buf_size,
 			    fuses[j].name, strlen(fuses[j].name), &val);
 			if (0 != error) {
 				MP_LOG_ERR_FMT(error,
@@ -1803,3 +2678,153 @@ minipro_page_write(minipro_p mp, uint32_t flags,
 
 	return (error);
 }
+
+static int
+mp_range_cmp(const void *a, const void *b) {
+	const mp_range_t *ra = a, *rb = b;
+
+	if (ra->address != rb->address)
+		return ((ra->address > rb->address) ? 1 : -1);
+	if (ra->size != rb->size)
+		return ((ra->size > rb->size) ? 1 : -1);
+
+	return (0);
+}
+
+/* Walk chip blocks covered by ranges, read each once, copy to buf or
+ * compare with buf. */
+static int
+minipro_ranges_io(minipro_p mp, int page, const mp_range_t *ranges,
+    size_t count, uint8_t *rd_buf, const uint8_t *vr_buf, size_t buf_size,
+    size_t *err_offset, uint32_t *buf_val, uint32_t *chip_val,
+    minipro_progress_cb cb, void *udata) {
+	int error = 0;
+	uint8_t cmd;
+	uint32_t blk_size, blk, blk_end, start, end;
+	size_t i, j, chip_size, total = 0, done = 0, diff_off;
+	mp_range_p r = NULL;
+
+	if (NULL == mp || NULL == mp->chip || NULL == ranges ||
+	    0 == count || (NULL == rd_buf && NULL == vr_buf))
+		return (EINVAL);
+	switch (page) {
+	case MP_CHIP_PAGE_CODE:
+	case MP_CHIP_PAGE_DATA:
+		chip_size = ((MP_CHIP_PAGE_CODE == page) ?
+		    mp->chip->code_memory_size :
+		    mp->chip->data_memory_size);
+		break;
+	default:
+		return (EINVAL);
+	}
+	for (i = 0; i < count; i ++) {
+		if (0 == ranges[i].size ||
+		    ((size_t)ranges[i].address + ranges[i].size) > chip_size ||
+		    (ranges[i].offset + ranges[i].size) > buf_size)
+			return (EINVAL); /* Out of range. */
+		total += ranges[i].size;
+	}
+	r = malloc((count * sizeof(mp_range_t)));
+	if (NULL == r)
+		return (ENOMEM);
+	memcpy(r, ranges, (count * sizeof(mp_range_t)));
+	qsort(r, count, sizeof(mp_range_t), mp_range_cmp);
+
+	cmd = mp_chip_page_read_cmd[page];
+	blk_size = ((MP_CMD_READ_CODE == cmd) ?
+	    mp->rd_blk_size : mp->chip->read_block_size);
+	error = minipro_begin_transaction(mp);
+	if (0 != error) {
+		free(r);
+		return (error);
+	}
+	minipro_rd_poll_set(mp, cmd);
+	/* Overcurrency status check. */
+	MP_RET_ON_ERR_CLEANUP(minipro_overcurrency_chk(mp));
+
+	blk = (r[0].address - (r[0].address % blk_size));
+	for (i = 0; i < count;) {
+		/* Skip ranges done before block. */
+		if (((size_t)r[i].address + r[i].size) <= blk) {
+			i ++;
+			continue;
+		}
+		/* Gap: jump to next needed block. */
+		if (r[i].address >= (blk + blk_size)) {
+			blk = (r[i].address - (r[i].address % blk_size));
+		}
+		blk_end = (blk + blk_size);
+		MP_PROGRESS_UPDATE(cb, mp, done, total, udata);
+		MP_RET_ON_ERR_CLEANUP(minipro_read_block_rt(mp, cmd, blk,
+		    mp->read_block_buf, blk_size));
+		/* Scatter block to all ranges it overlaps. */
+		for (j = i; j < count && r[j].address < blk_end; j ++) {
+			start = MAX(r[j].address, blk);
+			end = (uint32_t)MIN(((size_t)r[j].address + r[j].size),
+			    blk_end);
+			if (start >= end)
+				continue;
+			if (NULL != rd_buf) {
+				memcpy((rd_buf + r[j].offset +
+				    (start - r[j].address)),
+				    (mp->read_block_buf + (start - blk)),
+				    (end - start));
+			} else {
+				diff_off = minipro_verify_cmp(mp, start,
+				    (vr_buf + r[j].offset +
+				    (start - r[j].address)),
+				    (mp->read_block_buf + (start - blk)),
+				    (end - start), buf_val);
+				if (diff_off != (end - start)) {
+					(*chip_val) = mp->read_block_buf[
+					    ((start - blk) + diff_off)];
+					(*err_offset) = (r[j].offset +
+					    (start - r[j].address) + diff_off);
+					goto err_out;
+				}
+			}
+			done += (end - start);
+		}
+		blk = blk_end;
+	}
+	/* Final overcurrency status check if some was skipped. */
+	if (1 < mp->rd_poll_ival) {
+		MP_RET_ON_ERR_CLEANUP(minipro_overcurrency_chk(mp));
+	}
+	MP_PROGRESS_UPDATE(cb, mp, total, total, udata);
+
+err_out:
+	minipro_end_transaction(mp);
+	free(r);
+
+	return (error);
+}
+
+int
+minipro_page_read_ranges(minipro_p mp, int page,
+    const mp_range_t *ranges, size_t count,
+    uint8_t *buf, size_t buf_size,
+    minipro_progress_cb cb, void *udata) {
+
+	if (NULL == buf)
+		return (EINVAL);
+
+	return (minipro_ranges_io(mp, page, ranges, count, buf, NULL,
+	    buf_size, NULL, NULL, NULL, cb, udata));
+}
+
+int
+minipro_page_verify_ranges(minipro_p mp, int page,
+    const mp_range_t *ranges, size_t count,
+    const uint8_t *buf, size_t buf_size,
+    size_t *err_offset, uint32_t *buf_val, uint32_t *chip_val,
+    minipro_progress_cb cb, void *udata) {
+
+	if (NULL == buf || NULL == err_offset ||
+	    NULL == buf_val || NULL == chip_val)
+		return (EINVAL);
+	(*err_offset) = buf_size;
+
+	return (minipro_ranges_io(mp, page, ranges, count, NULL, buf,
+	    buf_size, err_offset, buf_val, chip_val, cb, udata));
+}
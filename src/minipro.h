@@ -7,12 +7,46 @@
 #include "database.h"
 
 
+/* libminipro API version: incremented on incompatible changes,
+ * also shared library SOVERSION. */
+#define MINIPRO_API_VERSION	1
+
 #define MP_TL866_VID		0x04d8
 #define MP_TL866_PID		0xe11c
 
 #define MP_FW_VER_MIN		0x0255
 
+#define MP_MSG_SIZE_MAX		4096
+#define MP_BLOCK_SIZE_MAX	(MP_MSG_SIZE_MAX - 7) /* Max block payload. */
+
 #define MP_INIT_SUB_TRY_COUNT	5
+#define MP_FAST_SYNC_DRAIN_MAX	16 /* Max pending messages to drain. */
+#define MP_FAST_SYNC_TMO	50 /* ms. */
+#define MP_REOPEN_TRY_COUNT	10
+#define MP_REOPEN_DELAY		200000 /* usec. */
+#define MP_BLOCK_RETRY_COUNT	3
+#define MP_BLOCK_RETRY_DELAY	5000 /* usec, doubled on every retry. */
+
+/* USB transfer deadlines, per command class, ms. */
+#define MP_TMO_CMD		0 /* Short commands, status. */
+#define MP_TMO_READ		1 /* Block read. */
+#define MP_TMO_WRITE		2 /* Block write and wait it done. */
+#define MP_TMO_ERASE		3 /* Chip erase. */
+#define MP_TMO__COUNT__		4
+static const char *mp_tmo_str[] = {
+	"cmd",
+	"read",
+	"write",
+	"erase",
+	NULL
+};
+#define MP_TMO_CMD_DEF		3000
+#define MP_TMO_READ_DEF		2000
+#define MP_TMO_READ_PER_KB	1000 /* For slow serial chips. */
+#define MP_TMO_WRITE_DEF	3000
+#define MP_TMO_WRITE_PER_B	2 /* Byte programming EPROMs. */
+#define MP_TMO_ERASE_DEF	20000
+#define MP_TMO_ERASE_PER_KB	20
 
 
 /* Commands. */
@@ -119,16 +153,74 @@ static const uint8_t mp_cmd_wo_chip[] = {
 
 
 
+typedef struct minipro_stats_s {
+	size_t		usb_errors;	/* All libusb transfer errors. */
+	size_t		usb_timeouts;
+	size_t		usb_stalls;	/* Endpoint pipe stall. */
+	size_t		usb_no_device;
+	size_t		recoveries;	/* Successful recoveries. */
+	size_t		recovery_fails;
+	size_t		retries;	/* Block retries. */
+	size_t		blocks_read;
+	size_t		blocks_written;
+	size_t		status_polls;
+	size_t		overcurrents;	/* Overcurrency protection events. */
+	size_t		ovc_checks;	/* Overcurrency check requests. */
+	size_t		erases;
+	/* Time spent, us. */
+	uint64_t	read_block_us;	/* Read block request and data. */
+	uint64_t	write_block_us;	/* Write block and its completion. */
+	uint64_t	ovc_check_us;
+	uint64_t	erase_us;
+} minipro_stats_t, *minipro_stats_p;
+
+
 typedef struct minipro_handle_s *minipro_p;
 typedef void (*minipro_progress_cb)(minipro_p mp, size_t done,
 		size_t total, const void *udata);
+/* Called from minipro_read_buf() for each readed part, buf points to
+ * caller buffer. Non zero return abort read with this error. */
+typedef int (*minipro_data_cb)(minipro_p mp, uint32_t addr,
+		const uint8_t *buf, size_t size, void *udata);
+/* Bulk transfer in place of USB device, for simulators.
+ * dir: 0x00 - to device (OUT), 0x80 - from device (IN).
+ * Return 0 or libusb error code, LIBUSB_ERROR_TIMEOUT if nothink to
+ * read. */
+typedef int (*minipro_transfer_fn)(void *udata, uint8_t dir,
+		uint8_t *buf, size_t buf_size, uint32_t timeout,
+		size_t *transferred);
+
+
+/* Library API version, check against MINIPRO_API_VERSION. */
+uint32_t minipro_api_version(void);
 
+/* Concurrency contract:
+ * - no global state: all is in handle, chips DB and USB context;
+ * - handle is not locked: use each handle from one thread at a time,
+ *   different handles may be used from different threads in parallel;
+ * - USB context may be shared by any number of handles and threads,
+ *   it runs own libusb event thread; destroy it after all its handles
+ *   closed;
+ * - chips DB is read only after load and may be shared. */
+typedef struct minipro_usb_ctx_s *minipro_usb_ctx_p;
 
+int	minipro_usb_ctx_create(minipro_usb_ctx_p *ctx_ret);
+void	minipro_usb_ctx_destroy(minipro_usb_ctx_p ctx);
+
+/* Own USB context, first device with vendor_id/product_id. */
 int	minipro_open(uint16_t vendor_id, uint16_t product_id,
 	    int verboce, minipro_p *handle_ret);
+/* ctx: shared USB context or NULL for own, dev_idx: open N-th device
+ * with vendor_id/product_id (0 - first). */
+int	minipro_open_ex(minipro_usb_ctx_p ctx, uint16_t vendor_id,
+	    uint16_t product_id, size_t dev_idx, int verboce,
+	    minipro_p *handle_ret);
+int	minipro_open_transfer(minipro_transfer_fn transfer, void *udata,
+	    int verboce, minipro_p *handle_ret);
 void	minipro_close(minipro_p mp);
 
 int	minipro_get_version_info(minipro_p mp, minipro_ver_p ver);
+minipro_ver_p minipro_ver_get(minipro_p mp); /* Cached on open. */
 int	minipro_is_version_info_ok(minipro_p mp);
 void	minipro_print_info(minipro_p mp);
 int	minipro_hardware_check(minipro_p mp, size_t *errors_count);
@@ -136,6 +228,50 @@ int	minipro_hardware_check(minipro_p mp, size_t *errors_count);
 int	minipro_chip_set(minipro_p mp, chip_p chip, uint8_t icsp);
 chip_p	minipro_chip_get(minipro_p mp);
 
+int	minipro_stats_get(minipro_p mp, minipro_stats_p stats);
+
+/* Code page read block size (multiple of chip read_block_size) and
+ * overcurrency status poll interval in read blocks, 0 = chip default.
+ * Reseted on minipro_chip_set(). */
+int	minipro_tune_set(minipro_p mp, uint32_t read_block_size,
+	    uint32_t status_poll_ival);
+int	minipro_tune_get(minipro_p mp, uint32_t *read_block_size,
+	    uint32_t *status_poll_ival);
+
+/* Override command class (MP_TMO_*) deadline, ms, 0 = auto from chip. */
+int	minipro_timeout_set(minipro_p mp, int op, uint32_t timeout);
+uint32_t minipro_timeout_get(minipro_p mp, int op);
+
+/* Partial (unaligned) write blocks padding policy.
+ * enable = 0: read back and preserve chip content (default).
+ * enable != 0: pad from img (page image, addressed as chip page, may be
+ * NULL) and with val beyond img, without read back.
+ * img must be valid until disabled or handle closed. */
+int	minipro_write_fill_set(minipro_p mp, int enable, uint8_t val,
+	    const uint8_t *img, size_t img_size);
+/* Code/data verify compare mask, addressed as chip page: only bits set
+ * in mask are compared, 0x00 - don't care byte; beyond mask_size all
+ * compared. NULL to disable. mask must be valid until disabled or
+ * handle closed. */
+int	minipro_verify_mask_set(minipro_p mp, const uint8_t *mask,
+	    size_t mask_size);
+
+/* Patch over code/data written and verified image, addressed as chip
+ * page: per unit data (serial numbers, MAC, CRC) without image copy,
+ * only blocks with overlays differ between units. */
+typedef struct mp_overlay_s {
+	uint32_t	address;
+	size_t		size;
+	const uint8_t	*data;
+} mp_overlay_t, *mp_overlay_p;
+/* NULL to disable. ovls and data must be valid until disabled or
+ * handle closed. */
+int	minipro_overlay_set(minipro_p mp, const mp_overlay_t *ovls,
+	    size_t count);
+
+/* Readed data consumer, NULL to disable. */
+int	minipro_data_cb_set(minipro_p mp, minipro_data_cb cb, void *udata);
+
 int	minipro_begin_transaction(minipro_p mp);
 int	minipro_end_transaction(minipro_p mp);
 int	minipro_get_chip_id(minipro_p mp, uint32_t *chip_id_type,
@@ -208,6 +344,26 @@ int	minipro_page_write(minipro_p mp, uint32_t flags, int page,
 #define MP_PAGE_WR_F_PRE_NO_UNPROTECT	0x00000002
 #define MP_PAGE_WR_F_POST_NO_PROTECT	0x00000004
 
+/* Scatter/gather: chip page range <-> buf part. */
+typedef struct mp_range_s {
+	uint32_t	address;	/* Chip page address. */
+	size_t		size;
+	size_t		offset;		/* Offset in buf. */
+} mp_range_t, *mp_range_p;
+/* Code/data page ranges in one transaction: ranges are taken in
+ * address order, overlapped and adjacent share blocks, every chip
+ * block is read once. Verify: err_offset - buf offset of first
+ * difference by address order, buf_size if equal. */
+int	minipro_page_read_ranges(minipro_p mp, int page,
+	    const mp_range_t *ranges, size_t count,
+	    uint8_t *buf, size_t buf_size,
+	    minipro_progress_cb cb, void *udata);
+int	minipro_page_verify_ranges(minipro_p mp, int page,
+	    const mp_range_t *ranges, size_t count,
+	    const uint8_t *buf, size_t buf_size,
+	    size_t *err_offset, uint32_t *buf_val, uint32_t *chip_val,
+	    minipro_progress_cb cb, void *udata);
+
 
 
 #endif
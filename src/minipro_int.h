@@ -0,0 +1,28 @@
+#ifndef __MINIPRO_INT_H
+#define __MINIPRO_INT_H
+
+#include <sys/types.h>
+#include <inttypes.h>
+
+#include "database.h"
+
+
+/* libminipro internals: not installed, not part of API.
+ * Exposed for host side hot paths benchmark. */
+
+/* Value from "name = val" line in text buf, val is hex. */
+int	mp_buf_get_named_line_val32(const uint8_t *buf, size_t buf_size,
+	    const char *val_name, size_t val_name_size, uint32_t *value);
+
+/* Index of first difference, size if equal. */
+size_t	mp_memcmp_idx(const uint8_t *buf1, const uint8_t *buf2,
+	    const size_t size);
+/* Same, only bits set in mask are compared. */
+size_t	mp_memcmp_mask_idx(const uint8_t *buf1, const uint8_t *buf2,
+	    const uint8_t *mask, const size_t size);
+
+/* Chip message header with chip constants. */
+void	mp_msg_chip_hdr_gen(chip_p chip, uint8_t icsp, uint8_t *buf,
+	    size_t buf_size);
+
+#endif
@@ -0,0 +1,177 @@
+#include <sys/types.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <errno.h>
+
+#include "pipeline.h"
+
+
+typedef struct pipeline_item_s {
+	uint32_t	addr;
+	const uint8_t	*buf;
+	size_t		size;
+} pipeline_item_t, *pipeline_item_p;
+
+typedef struct pipeline_s {
+	pipeline_item_p	ring;
+	size_t		ring_mask;	/* Slots count - 1. */
+	/* Protected by mutex. */
+	pthread_mutex_t	mutex;
+	pthread_cond_t	cond_push;	/* Worker: item pushed or stop. */
+	pthread_cond_t	cond_pop;	/* Producer: slots freed. */
+	size_t		head;		/* Free running: producer next write. */
+	size_t		tail;		/* Free running: consumer next read. */
+	int		stop;
+	int		error;		/* First cb error. */
+	pipeline_cb	cb;
+	void		*udata;
+	pthread_t	thread;
+	int		running;
+} pipeline_t;
+
+
+static void *
+pipeline_worker(void *arg) {
+	pipeline_p pl = arg;
+	pipeline_item_p item;
+	size_t head, tail;
+	int error;
+
+	pthread_mutex_lock(&pl->mutex);
+	for (;;) {
+		while (pl->head == pl->tail && 0 == pl->stop) {
+			pthread_cond_wait(&pl->cond_push, &pl->mutex);
+		}
+		if (pl->head == pl->tail) /* Stopped and all items done. */
+			break;
+		/* Process all pushed items without lock. */
+		head = pl->head;
+		tail = pl->tail;
+		error = pl->error;
+		pthread_mutex_unlock(&pl->mutex);
+		for (; tail != head; tail ++) {
+			if (0 != error)
+				continue; /* Skip after fail. */
+			item = &pl->ring[(tail & pl->ring_mask)];
+			error = pl->cb(pl->udata, item->addr,
+			    item->buf, item->size);
+		}
+		pthread_mutex_lock(&pl->mutex);
+		if (0 == pl->error) {
+			pl->error = error;
+		}
+		pl->tail = tail;
+		pthread_cond_signal(&pl->cond_pop);
+	}
+	pthread_mutex_unlock(&pl->mutex);
+
+	return (NULL);
+}
+
+
+int
+pipeline_create(size_t slots, pipeline_cb cb, void *udata,
+    pipeline_p *pl_ret) {
+	int error;
+	size_t ring_size;
+	pipeline_p pl;
+
+	if (NULL == cb || NULL == pl_ret)
+		return (EINVAL);
+	if (0 == slots) {
+		slots = PIPELINE_SLOTS_DEF;
+	}
+	for (ring_size = 2; ring_size < slots; ring_size <<= 1)
+		;
+	pl = calloc(1, sizeof(pipeline_t));
+	if (NULL == pl)
+		return (ENOMEM);
+	pl->ring = calloc(ring_size, sizeof(pipeline_item_t));
+	if (NULL == pl->ring) {
+		free(pl);
+		return (ENOMEM);
+	}
+	pl->ring_mask = (ring_size - 1);
+	pthread_mutex_init(&pl->mutex, NULL);
+	pthread_cond_init(&pl->cond_push, NULL);
+	pthread_cond_init(&pl->cond_pop, NULL);
+	pl->cb = cb;
+	pl->udata = udata;
+	error = pthread_create(&pl->thread, NULL, pipeline_worker, pl);
+	if (0 != error) {
+		pthread_cond_destroy(&pl->cond_pop);
+		pthread_cond_destroy(&pl->cond_push);
+		pthread_mutex_destroy(&pl->mutex);
+		free(pl->ring);
+		free(pl);
+		return (error);
+	}
+	pl->running = 1;
+	(*pl_ret) = pl;
+
+	return (0);
+}
+
+void
+pipeline_destroy(pipeline_p pl) {
+
+	if (NULL == pl)
+		return;
+	pipeline_finish(pl);
+	pthread_cond_destroy(&pl->cond_pop);
+	pthread_cond_destroy(&pl->cond_push);
+	pthread_mutex_destroy(&pl->mutex);
+	free(pl->ring);
+	free(pl);
+}
+
+
+int
+pipeline_push(pipeline_p pl, uint32_t addr, const uint8_t *buf,
+    size_t size) {
+	int error;
+	pipeline_item_p item;
+
+	if (NULL == pl || 0 == pl->running)
+		return (EINVAL);
+
+	pthread_mutex_lock(&pl->mutex);
+	/* Wait for free slot. */
+	while (pl->ring_mask < (pl->head - pl->tail) && 0 == pl->error) {
+		pthread_cond_wait(&pl->cond_pop, &pl->mutex);
+	}
+	error = pl->error;
+	if (0 == error) {
+		item = &pl->ring[(pl->head & pl->ring_mask)];
+		item->addr = addr;
+		item->buf = buf;
+		item->size = size;
+		pl->head ++;
+		pthread_cond_signal(&pl->cond_push);
+	}
+	pthread_mutex_unlock(&pl->mutex);
+
+	return (error);
+}
+
+int
+pipeline_finish(pipeline_p pl) {
+	int error;
+
+	if (NULL == pl)
+		return (EINVAL);
+	if (0 != pl->running) {
+		pthread_mutex_lock(&pl->mutex);
+		pl->stop = 1;
+		pthread_cond_signal(&pl->cond_push);
+		pthread_mutex_unlock(&pl->mutex);
+		pthread_join(pl->thread, NULL);
+		pl->running = 0;
+	}
+	pthread_mutex_lock(&pl->mutex);
+	error = pl->error;
+	pthread_mutex_unlock(&pl->mutex);
+
+	return (error);
+}
@@ -0,0 +1,31 @@
+#ifndef __PIPELINE_H
+#define __PIPELINE_H
+
+#include <sys/types.h>
+#include <inttypes.h>
+
+
+#define PIPELINE_SLOTS_DEF	256 /* Rounded up to power of 2. */
+
+
+/* Single producer / single consumer stage: producer (USB thread) push
+ * references to completed blocks, worker thread pass them to cb in
+ * same order. Referenced data must stay valid until pipeline_finish().
+ * After cb fail all next items skipped and error returned by push and
+ * finish. */
+typedef int (*pipeline_cb)(void *udata, uint32_t addr,
+		const uint8_t *buf, size_t size);
+
+typedef struct pipeline_s *pipeline_p;
+
+
+int	pipeline_create(size_t slots, pipeline_cb cb, void *udata,
+	    pipeline_p *pl_ret);
+void	pipeline_destroy(pipeline_p pl);
+
+int	pipeline_push(pipeline_p pl, uint32_t addr,
+	    const uint8_t *buf, size_t size);
+/* Wait until all pushed items processed, stop worker. */
+int	pipeline_finish(pipeline_p pl);
+
+#endif
@@ -0,0 +1,192 @@
+#include <sys/types.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#include "utils/macro.h"
+
+#include "minipro.h"
+#include "plan.h"
+
+
+/* Blocks of blk_size touched by [address, address + size). */
+static size_t
+plan_blocks(uint32_t address, size_t size, uint32_t blk_size) {
+	size_t start;
+
+	start = (address - (address % blk_size));
+
+	return ((((size_t)address + size - start) + (blk_size - 1)) /
+	    blk_size);
+}
+
+static void
+plan_step_set(plan_p plan, size_t step, size_t count, uint32_t measured_us,
+    uint64_t model_us, size_t unit_rt) {
+	plan_step_p ps = &plan->step[step];
+
+	ps->count += count;
+	ps->unit_rt = unit_rt;
+	ps->measured = (0 != measured_us);
+	ps->unit_us = ((0 != measured_us) ? measured_us : model_us);
+}
+
+/* Read/verify: one overcurrency check at start, every status_poll_ival
+ * blocks and at end if some was skipped. */
+static void
+plan_read(plan_p plan, uint32_t address, size_t size, uint32_t blk_size,
+    size_t *status_cnt) {
+	size_t blocks;
+
+	blocks = plan_blocks(address, size, blk_size);
+	plan->step[PLAN_STEP_READ].count += blocks;
+	(*status_cnt) += (1 + (blocks / plan->status_poll_ival) +
+	    ((1 < plan->status_poll_ival) ? 1 : 0));
+}
+
+
+int
+plan_estimate(const chip_p chip, const plan_job_p job,
+    const tune_p tune, plan_p plan) {
+	size_t i, chip_size, status_cnt = 0;
+	uint32_t rbs, wbs, lat_read = 0;
+	tune_t tn;
+
+	if (NULL == chip || NULL == job || NULL == plan)
+		return (EINVAL);
+	switch (job->page) {
+	case MP_CHIP_PAGE_CODE:
+	case MP_CHIP_PAGE_DATA:
+		chip_size = ((MP_CHIP_PAGE_CODE == job->page) ?
+		    chip->code_memory_size : chip->data_memory_size);
+		break;
+	default: /* Fuses: few small requests, not worth planning. */
+		return (EOPNOTSUPP);
+	}
+	if (0 == chip_size || 0 == job->size ||
+	    0 == chip->read_block_size || 0 == chip->write_block_size ||
+	    ((size_t)job->address + job->size) > chip_size)
+		return (EINVAL);
+	memset(plan, 0x00, sizeof(plan_t));
+	memset(&tn, 0x00, sizeof(tune_t));
+	if (NULL != tune) {
+		memcpy(&tn, tune, sizeof(tune_t));
+	}
+
+	/* Same block size selection as minipro_tune_set() / read_buf(). */
+	rbs = chip->read_block_size;
+	if (MP_CHIP_PAGE_CODE == job->page &&
+	    0 != tn.read_block_size &&
+	    MP_BLOCK_SIZE_MAX >= tn.read_block_size &&
+	    0 == (tn.read_block_size % chip->read_block_size) &&
+	    0 == (chip->code_memory_size % tn.read_block_size)) {
+		rbs = tn.read_block_size;
+	}
+	wbs = chip->write_block_size;
+	plan->read_block_size = rbs;
+	plan->status_poll_ival = ((MP_CHIP_PAGE_CODE == job->page) ?
+	    MAX(tn.status_poll_ival, 1) : 1);
+	/* Measured with other block size: scale by payload. */
+	if (0 != tn.lat_read && 0 != tn.lat_read_bs) {
+		lat_read = (uint32_t)MIN((((uint64_t)tn.lat_read * rbs) /
+		    tn.lat_read_bs), UINT32_MAX);
+	}
+
+	plan_step_set(plan, PLAN_STEP_OPEN, 1, tn.lat_open,
+	    PLAN_DEF_OPEN_US, 1);
+	plan_step_set(plan, PLAN_STEP_CHIP_SET, 1, tn.lat_chip_set,
+	    PLAN_DEF_CHIP_SET_US, 1);
+	plan_step_set(plan, PLAN_STEP_STATUS, 0, tn.lat_status,
+	    PLAN_DEF_RT_US, 1);
+	plan_step_set(plan, PLAN_STEP_READ, 0, lat_read,
+	    (PLAN_DEF_RT_US + (((uint64_t)rbs * PLAN_DEF_BYTE_NS) / 1000)), 1);
+
+	switch (job->action) {
+	case 0: /* read. */
+	case 1: /* verify. */
+		plan_read(plan, job->address, job->size, rbs, &status_cnt);
+		break;
+	case 2: /* write. */
+		status_cnt ++; /* minipro_page_write() start. */
+		if (0 == (MP_PAGE_WR_F_NO_ERASE & job->write_flags) &&
+		    0 != (CHIP_OPT4_ERASE & chip->opts4)) {
+			plan_step_set(plan, PLAN_STEP_ERASE, 1, tn.lat_erase,
+			    PLAN_DEF_ERASE_US, 1);
+		}
+		if (0 != (CHIP_OPT4_PROTECTION & chip->opts4)) {
+			plan_step_set(plan, PLAN_STEP_PROTECT,
+			    ((0 == (MP_PAGE_WR_F_PRE_NO_UNPROTECT &
+			    job->write_flags)) ? 1 : 0) +
+			    ((0 == (MP_PAGE_WR_F_POST_NO_PROTECT &
+			    job->write_flags)) ? 1 : 0),
+			    tn.lat_status, PLAN_DEF_RT_US, 1);
+		}
+		plan_step_set(plan, PLAN_STEP_WRITE,
+		    plan_blocks(job->address, job->size, wbs), tn.lat_write,
+		    (PLAN_DEF_RT_US +
+		    (((uint64_t)wbs * PLAN_DEF_BYTE_NS) / 1000)), 1);
+		/* Unaligned head/tail: read back rest of block,
+		 * unless padded by fill. */
+		if (0 != job->fill) {
+			status_cnt ++;
+		} else if (0 != (job->address % wbs)) {
+			plan_read(plan, (job->address - (job->address % wbs)),
+			    (job->address % wbs), chip->read_block_size,
+			    &status_cnt);
+		} else {
+			status_cnt ++;
+		}
+		if (0 == job->fill &&
+		    0 != ((job->address + job->size) % wbs)) {
+			plan_read(plan, (uint32_t)(job->address + job->size),
+			    (wbs - ((job->address + job->size) % wbs)),
+			    chip->read_block_size, &status_cnt);
+		}
+		if (0 != job->post_wr_verify) {
+			plan_read(plan, job->address, job->size, rbs,
+			    &status_cnt);
+		}
+		break;
+	default:
+		return (EINVAL);
+	}
+	plan->step[PLAN_STEP_STATUS].count = status_cnt;
+
+	for (i = 0; PLAN_STEP__COUNT__ > i; i ++) {
+		plan->total_us += (plan->step[i].count * plan->step[i].unit_us);
+		plan->round_trips += (plan->step[i].count *
+		    plan->step[i].unit_rt);
+	}
+
+	return (0);
+}
+
+void
+plan_print(FILE *fp, const plan_p plan) {
+	size_t i;
+	uint64_t tm;
+
+	if (NULL == fp || NULL == plan)
+		return;
+	fprintf(fp, "Plan: read block size: 0x%"PRIx32", "
+	    "status poll: 1/%"PRIu32".\n",
+	    plan->read_block_size, plan->status_poll_ival);
+	for (i = 0; PLAN_STEP__COUNT__ > i; i ++) {
+		if (0 == plan->step[i].count)
+			continue;
+		tm = (plan->step[i].count * plan->step[i].unit_us);
+		fprintf(fp, "	%-10s %8zu x %8"PRIu64" us = "
+		    "%8"PRIu64".%03"PRIu64" ms  %3"PRIu64"%%  %s\n",
+		    plan_step_str[i], plan->step[i].count,
+		    plan->step[i].unit_us, (tm / 1000), (tm % 1000),
+		    ((tm * 100) / MAX(plan->total_us, 1)),
+		    ((0 != plan->step[i].measured) ? "measured" : "model"));
+	}
+	fprintf(fp, "	%-10s %10"PRIu64".%03"PRIu64" s, "
+	    "USB round trips: %zu\n",
+	    "total",
+	    (plan->total_us / 1000000), ((plan->total_us / 1000) % 1000),
+	    plan->round_trips);
+}
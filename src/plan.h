@@ -0,0 +1,70 @@
+#ifndef __PLAN_H
+#define __PLAN_H
+
+#include <sys/types.h>
+#include <inttypes.h>
+#include <stdio.h>
+
+#include "database.h"
+#include "tune.h"
+
+
+/* Model defaults, used then no measured latency in tune cache. */
+#define PLAN_DEF_OPEN_US	100000
+#define PLAN_DEF_CHIP_SET_US	10000
+#define PLAN_DEF_RT_US		1000	/* USB request/response. */
+#define PLAN_DEF_BYTE_NS	1000	/* USB full speed payload. */
+#define PLAN_DEF_ERASE_US	1000000
+
+
+typedef struct plan_job_s {
+	int		action;		/* 0 - read, 1 - verify, 2 - write. */
+	int		page;		/* MP_CHIP_PAGE_CODE / DATA. */
+	uint32_t	address;
+	size_t		size;
+	uint32_t	write_flags;	/* MP_PAGE_WR_F_*. */
+	int		fill;		/* Unaligned head/tail padded, no read. */
+	int		post_wr_verify;
+} plan_job_t, *plan_job_p;
+
+#define PLAN_STEP_OPEN		0
+#define PLAN_STEP_CHIP_SET	1
+#define PLAN_STEP_ERASE		2
+#define PLAN_STEP_PROTECT	3 /* Unprotect before and protect after. */
+#define PLAN_STEP_WRITE		4
+#define PLAN_STEP_READ		5 /* Read or verify. */
+#define PLAN_STEP_STATUS	6 /* Overcurrency checks. */
+#define PLAN_STEP__COUNT__	7
+static const char *plan_step_str[] = {
+	"open",
+	"chip_set",
+	"erase",
+	"protect",
+	"write",
+	"read",
+	"status",
+	NULL
+};
+
+typedef struct plan_step_s {
+	size_t		count;		/* Operations. */
+	uint64_t	unit_us;	/* Time per operation. */
+	size_t		unit_rt;	/* USB round trips per operation. */
+	int		measured;	/* unit_us from previous runs. */
+} plan_step_t, *plan_step_p;
+
+typedef struct plan_s {
+	plan_step_t	step[PLAN_STEP__COUNT__];
+	uint32_t	read_block_size;
+	uint32_t	status_poll_ival;
+	uint64_t	total_us;
+	size_t		round_trips;
+} plan_t, *plan_p;
+
+
+/* tune may be NULL: model defaults only. */
+int	plan_estimate(const chip_p chip, const plan_job_p job,
+	    const tune_p tune, plan_p plan);
+void	plan_print(FILE *fp, const plan_p plan);
+
+#endif
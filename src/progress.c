@@ -0,0 +1,344 @@
+#include <sys/types.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <errno.h>
+
+#include "utils/macro.h"
+
+#include "progress.h"
+
+
+#define PROGRESS_JSON_BUF_SIZE	(16 * 1024)
+
+
+typedef struct progress_s {
+	/* Hot: written by transfer thread only. */
+	atomic_size_t	done;
+	const char	*msg_ptr;	/* Phase key. */
+	size_t		total;
+	/* Phase state, under mutex. */
+	pthread_mutex_t	mtx;
+	pthread_cond_t	cond;
+	pthread_t	thread;
+	int		stop;
+	int		active;	/* Changed by transfer thread only. */
+	int		rendered;
+	char		msg[128];
+	size_t		start_done;	/* Done on phase begin, for speed. */
+	uint64_t	start_ms;
+	size_t		last_done;	/* Last rendered. */
+	uint64_t	last_log_ms;
+	int		line_dirty;	/* Partial line on terminal. */
+	/* Outputs. */
+	uint32_t	flags;
+	int		is_tty;
+	int		json_fd;
+	/* JSON events queued under mutex, written by own thread: slow
+	 * reader must not stall transfer thread. */
+	char		json_buf[PROGRESS_JSON_BUF_SIZE];
+	size_t		json_used;
+	char		json_wr_buf[PROGRESS_JSON_BUF_SIZE];
+	uint64_t	created_ms;
+} progress_t;
+
+
+static uint64_t
+progress_time_ms(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ((((uint64_t)ts.tv_sec) * 1000) +
+	    (((uint64_t)ts.tv_nsec) / 1000000));
+}
+
+/* Phase name for JSON: message without trailing dots and spaces. */
+static size_t
+progress_phase_name(const char *msg, char *buf, size_t buf_size) {
+	size_t i, j = 0;
+
+	for (i = 0; 0 != msg[i] && (j + 1) < buf_size; i ++) {
+		if ('"' == msg[i] || '\\' == msg[i] ||
+		    0x20 > (uint8_t)msg[i])
+			continue;
+		buf[j ++] = msg[i];
+	}
+	while (0 < j && ('.' == buf[(j - 1)] || ' ' == buf[(j - 1)])) {
+		j --;
+	}
+	buf[j] = 0;
+
+	return (j);
+}
+
+/* Queue event, dropped if queue full. */
+static void
+progress_json_write(progress_p progress, const char *fmt, ...) {
+	int size;
+	va_list ap;
+
+	if (-1 == progress->json_fd)
+		return;
+	va_start(ap, fmt);
+	size = vsnprintf((progress->json_buf + progress->json_used),
+	    (sizeof(progress->json_buf) - progress->json_used), fmt, ap);
+	va_end(ap);
+	if (0 >= size ||
+	    (sizeof(progress->json_buf) - progress->json_used) <= (size_t)size)
+		return;
+	progress->json_used += (size_t)size;
+}
+
+/* Write queued events to json_fd, mutex unlocked while write(). */
+static void
+progress_json_flush_locked(progress_p progress) {
+	int fd = progress->json_fd;
+	size_t size, off;
+	ssize_t ios;
+
+	if (-1 == fd || 0 == progress->json_used)
+		return;
+	size = progress->json_used;
+	memcpy(progress->json_wr_buf, progress->json_buf, size);
+	progress->json_used = 0;
+	pthread_mutex_unlock(&progress->mtx);
+	for (off = 0; off < size; off += (size_t)ios) {
+		ios = write(fd, (progress->json_wr_buf + off), (size - off));
+		if (0 < ios)
+			continue;
+		if (0 > ios && EINTR == errno) {
+			ios = 0;
+			continue;
+		}
+		break; /* Reader gone (EPIPE) or fail. */
+	}
+	pthread_mutex_lock(&progress->mtx);
+	if (off < size) { /* Stop events. */
+		progress->json_fd = -1;
+		progress->json_used = 0;
+	}
+}
+
+static void
+progress_render_locked(progress_p progress, uint64_t now) {
+	size_t done, speed, eta;
+	uint64_t elapsed;
+	char phase[128];
+
+	done = atomic_load_explicit(&progress->done, memory_order_relaxed);
+	if (done == progress->last_done &&
+	    0 != progress->rendered)
+		return; /* Nothink changed. */
+	progress->last_done = done;
+	progress->rendered = 1;
+	elapsed = (now - progress->start_ms);
+	speed = (size_t)(((uint64_t)(done - progress->start_done) * 1000) /
+	    MAX(elapsed, 1));
+	eta = ((0 != speed) ? ((progress->total - done) / speed) : 0);
+
+	if (0 == (PROGRESS_F_NO_TEXT & progress->flags)) {
+		if (0 != progress->is_tty) {
+			printf("\r\e[K%s%zu / %zu bytes - %zu%%, "
+			    "%zu KB/s, ETA %zum%02zus",
+			    progress->msg, done, progress->total,
+			    ((done * 100) / MAX(progress->total, 1)),
+			    (speed / 1024), (eta / 60), (eta % 60));
+			fflush(stdout);
+			progress->line_dirty = 1;
+		} else if (PROGRESS_LOG_IVAL <= (now - progress->last_log_ms)) {
+			printf("%s%zu / %zu bytes - %zu%%\n",
+			    progress->msg, done, progress->total,
+			    ((done * 100) / MAX(progress->total, 1)));
+			fflush(stdout);
+			progress->last_log_ms = now;
+		}
+	}
+	progress_phase_name(progress->msg, phase, sizeof(phase));
+	progress_json_write(progress,
+	    "{\"event\":\"progress\",\"ts_ms\":%"PRIu64",\"phase\":\"%s\","
+	    "\"done\":%zu,\"total\":%zu,\"bytes_per_s\":%zu,"
+	    "\"eta_s\":%zu}\n",
+	    (now - progress->created_ms), phase, done, progress->total,
+	    speed, eta);
+}
+
+static void
+progress_end_locked(progress_p progress, int error) {
+	size_t done;
+	uint64_t now;
+	char phase[128];
+
+	if (0 == progress->active)
+		return;
+	now = progress_time_ms();
+	done = atomic_load_explicit(&progress->done, memory_order_relaxed);
+	if (0 == (PROGRESS_F_NO_TEXT & progress->flags)) {
+		if (0 == error && done == progress->total) {
+			printf("%s%sOK.\n",
+			    ((0 != progress->is_tty) ? "\r\e[K" : ""),
+			    progress->msg);
+		} else if (0 != progress->line_dirty) {
+			printf("\n");
+		}
+		fflush(stdout);
+	}
+	progress_phase_name(progress->msg, phase, sizeof(phase));
+	progress_json_write(progress,
+	    "{\"event\":\"end\",\"ts_ms\":%"PRIu64",\"phase\":\"%s\","
+	    "\"done\":%zu,\"total\":%zu,\"elapsed_ms\":%"PRIu64","
+	    "\"error\":%i}\n",
+	    (now - progress->created_ms), phase, done, progress->total,
+	    (now - progress->start_ms), error);
+	progress->active = 0;
+	progress->line_dirty = 0;
+	pthread_cond_signal(&progress->cond); /* Flush events. */
+}
+
+static void *
+progress_thread(void *arg) {
+	progress_p progress = arg;
+	struct timespec ts;
+	uint64_t deadline;
+
+	pthread_mutex_lock(&progress->mtx);
+	while (0 == progress->stop) {
+		deadline = (progress_time_ms() + PROGRESS_RENDER_IVAL);
+		ts.tv_sec = (time_t)(deadline / 1000);
+		ts.tv_nsec = (long)((deadline % 1000) * 1000000);
+		pthread_cond_timedwait(&progress->cond, &progress->mtx, &ts);
+		if (0 != progress->stop)
+			break;
+		if (0 != progress->active) {
+			progress_render_locked(progress, progress_time_ms());
+		}
+		progress_json_flush_locked(progress);
+	}
+	progress_json_flush_locked(progress);
+	pthread_mutex_unlock(&progress->mtx);
+
+	return (NULL);
+}
+
+
+int
+progress_create(uint32_t flags, int json_fd, progress_p *progress_ret) {
+	int error;
+	progress_p progress;
+	pthread_condattr_t cattr;
+
+	if (NULL == progress_ret)
+		return (EINVAL);
+	progress = calloc(1, sizeof(progress_t));
+	if (NULL == progress)
+		return (ENOMEM);
+	atomic_init(&progress->done, 0);
+	progress->flags = flags;
+	progress->is_tty = isatty(STDOUT_FILENO);
+	progress->json_fd = json_fd;
+	progress->created_ms = progress_time_ms();
+	pthread_mutex_init(&progress->mtx, NULL);
+	pthread_condattr_init(&cattr);
+	pthread_condattr_setclock(&cattr, CLOCK_MONOTONIC);
+	pthread_cond_init(&progress->cond, &cattr);
+	pthread_condattr_destroy(&cattr);
+	error = pthread_create(&progress->thread, NULL, progress_thread,
+	    progress);
+	if (0 != error) {
+		pthread_cond_destroy(&progress->cond);
+		pthread_mutex_destroy(&progress->mtx);
+		free(progress);
+		return (error);
+	}
+	(*progress_ret) = progress;
+
+	return (0);
+}
+
+void
+progress_destroy(progress_p progress) {
+
+	if (NULL == progress)
+		return;
+	pthread_mutex_lock(&progress->mtx);
+	progress->stop = 1;
+	pthread_cond_signal(&progress->cond);
+	pthread_mutex_unlock(&progress->mtx);
+	pthread_join(progress->thread, NULL);
+	progress_abort(progress, ECANCELED);
+	pthread_mutex_lock(&progress->mtx);
+	progress_json_flush_locked(progress);
+	pthread_mutex_unlock(&progress->mtx);
+	pthread_cond_destroy(&progress->cond);
+	pthread_mutex_destroy(&progress->mtx);
+	free(progress);
+}
+
+
+void
+progress_update(progress_p progress, const char *msg, size_t done,
+    size_t total) {
+	char phase[128];
+
+	if (NULL == progress)
+		return;
+	/* Fast path: same phase, in progress. */
+	if (0 != progress->active &&
+	    msg == progress->msg_ptr &&
+	    total == progress->total &&
+	    done < total) {
+		atomic_store_explicit(&progress->done, done,
+		    memory_order_relaxed);
+		return;
+	}
+
+	pthread_mutex_lock(&progress->mtx);
+	if (msg != progress->msg_ptr ||
+	    total != progress->total ||
+	    0 == progress->active) { /* New phase. */
+		progress_end_locked(progress, 0);
+		progress->msg_ptr = msg;
+		progress->total = total;
+		snprintf(progress->msg, sizeof(progress->msg), "%s",
+		    ((NULL != msg) ? msg : ""));
+		atomic_store_explicit(&progress->done, done,
+		    memory_order_relaxed);
+		progress->start_done = done;
+		progress->start_ms = progress_time_ms();
+		progress->last_done = done;
+		progress->last_log_ms = progress->start_ms;
+		progress->line_dirty = 0;
+		progress->rendered = 0;
+		progress->active = 1;
+		progress_phase_name(progress->msg, phase, sizeof(phase));
+		progress_json_write(progress,
+		    "{\"event\":\"begin\",\"ts_ms\":%"PRIu64","
+		    "\"phase\":\"%s\",\"done\":%zu,\"total\":%zu}\n",
+		    (progress->start_ms - progress->created_ms), phase,
+		    done, total);
+		if (done < total) {
+			progress_render_locked(progress, progress->start_ms);
+		}
+	}
+	atomic_store_explicit(&progress->done, done, memory_order_relaxed);
+	if (done >= total) {
+		progress_end_locked(progress, 0);
+	}
+	pthread_mutex_unlock(&progress->mtx);
+}
+
+void
+progress_abort(progress_p progress, int error) {
+
+	if (NULL == progress)
+		return;
+	pthread_mutex_lock(&progress->mtx);
+	progress_end_locked(progress, error);
+	pthread_mutex_unlock(&progress->mtx);
+}
@@ -0,0 +1,30 @@
+#ifndef __PROGRESS_H
+#define __PROGRESS_H
+
+#include <sys/types.h>
+#include <inttypes.h>
+
+
+#define PROGRESS_RENDER_IVAL	100	/* ms, terminal redraw rate. */
+#define PROGRESS_LOG_IVAL	5000	/* ms, line rate then not a tty. */
+
+#define PROGRESS_F_NO_TEXT	0x00000001 /* Do not render to stdout. */
+
+
+/* Transfer thread only publish counters, rendering done by own thread
+ * at fixed rate. Optional line delimited JSON events to json_fd:
+ * {"event":"begin|progress|end", ...}. */
+typedef struct progress_s *progress_p;
+
+
+int	progress_create(uint32_t flags, int json_fd, progress_p *progress_ret);
+void	progress_destroy(progress_p progress);
+
+/* Phase switched then msg pointer or total changed.
+ * done == total finish phase. */
+void	progress_update(progress_p progress, const char *msg,
+	    size_t done, size_t total);
+/* Finish current phase (if any) with error. */
+void	progress_abort(progress_p progress, int error);
+
+#endif
@@ -0,0 +1,282 @@
+#include <sys/types.h>
+#include <sys/file.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include "utils/macro.h"
+#include "utils/mem_utils.h"
+#include "utils/strh2num.h"
+
+#include "serial.h"
+
+
+#define SERIAL_COUNTER_SIZE_MAX	64
+#define SERIAL_CRC_CHUNK	4096
+
+
+/* CRC-32 IEEE 802.3, reflected, bit by bit: range is small. */
+static uint32_t
+serial_crc32_upd(uint32_t crc, const uint8_t *buf, size_t buf_size) {
+	size_t i;
+	int bit;
+
+	for (i = 0; i < buf_size; i ++) {
+		crc ^= buf[i];
+		for (bit = 0; bit < 8; bit ++) {
+			crc = ((crc >> 1) ^ (0xedb88320 & (0 - (crc & 1))));
+		}
+	}
+
+	return (crc);
+}
+
+/* Value to item data, ERANGE if value not fit. */
+static int
+serial_item_fmt(serial_item_p item, uint64_t value) {
+	size_t i;
+
+	switch (item->fmt) {
+	case SERIAL_FMT_LE:
+	case SERIAL_FMT_BE:
+		if (8 > item->size &&
+		    0 != (value >> (item->size * 8)))
+			return (ERANGE);
+		for (i = 0; i < item->size; i ++, value >>= 8) {
+			item->data[((SERIAL_FMT_LE == item->fmt) ?
+			    i : (item->size - i - 1))] = (uint8_t)value;
+		}
+		break;
+	case SERIAL_FMT_BCD:
+		for (i = item->size; 0 < i; i --) {
+			item->data[(i - 1)] = (uint8_t)(value % 10);
+			value /= 10;
+			item->data[(i - 1)] |= (uint8_t)((value % 10) << 4);
+			value /= 10;
+		}
+		if (0 != value)
+			return (ERANGE);
+		break;
+	case SERIAL_FMT_ASCII:
+		for (i = item->size; 0 < i; i --) {
+			item->data[(i - 1)] = (uint8_t)('0' + (value % 10));
+			value /= 10;
+		}
+		if (0 != value)
+			return (ERANGE);
+		break;
+	default:
+		return (EINVAL);
+	}
+
+	return (0);
+}
+
+
+int
+serial_parse(const char *str, serial_p serial) {
+	size_t i, tm, fcount, item_size, fld_size[5];
+	const char *ptr, *item, *fld[5];
+	serial_item_p si;
+
+	if (NULL == str || NULL == serial)
+		return (EINVAL);
+	memset(serial, 0x00, sizeof(serial_t));
+	for (ptr = str; 0 != (*ptr);) {
+		if (',' == (*ptr)) {
+			ptr ++;
+			continue;
+		}
+		item = ptr;
+		while (0 != (*ptr) && ',' != (*ptr)) {
+			ptr ++;
+		}
+		item_size = (size_t)(ptr - item);
+		/* Split to fields. */
+		for (fcount = 0, i = 0; fcount < 5 && i <= item_size; fcount ++) {
+			fld[fcount] = (item + i);
+			for (tm = 0; (i + tm) < item_size &&
+			    ':' != item[(i + tm)]; tm ++)
+				;
+			fld_size[fcount] = tm;
+			i += (tm + 1);
+		}
+		if (SERIAL_ITEMS_MAX <= serial->count) {
+			fprintf(stderr, "Too many serial items, max: %i.\n",
+			    SERIAL_ITEMS_MAX);
+			return (EINVAL);
+		}
+		si = &serial->items[serial->count];
+		if (3 > fcount || i <= item_size)
+			goto bad_item;
+		for (si->fmt = 0; SERIAL_FMT__COUNT__ > si->fmt; si->fmt ++) {
+			if (0 == mem_cmpn_cstr(serial_fmt_str[si->fmt],
+			    fld[2], fld_size[2]))
+				break;
+		}
+		si->address = strh2u32(fld[0], fld_size[0]);
+		si->size = strh2usize(fld[1], fld_size[1]);
+		switch (si->fmt) {
+		case SERIAL_FMT_LE:
+		case SERIAL_FMT_BE:
+			if (8 < si->size || 4 < fcount)
+				goto bad_item;
+			break;
+		case SERIAL_FMT_BCD:
+			if ((SERIAL_ITEM_SIZE_MAX / 2) < si->size ||
+			    4 < fcount)
+				goto bad_item;
+			break;
+		case SERIAL_FMT_ASCII:
+			if (SERIAL_ITEM_SIZE_MAX < si->size || 4 < fcount)
+				goto bad_item;
+			break;
+		case SERIAL_FMT_CRC32:
+			if (4 != si->size || 5 != fcount)
+				goto bad_item;
+			si->crc_size = strh2usize(fld[4], fld_size[4]);
+			if (0 == si->crc_size)
+				goto bad_item;
+			break;
+		default:
+			goto bad_item;
+		}
+		if (0 == si->size)
+			goto bad_item;
+		if (3 < fcount) {
+			si->base = strh2u64(fld[3], fld_size[3]);
+		}
+		serial->count ++;
+		continue;
+bad_item:
+		fprintf(stderr, "Bad serial item: \"%.*s\".\n",
+		    (int)item_size, item);
+		return (EINVAL);
+	}
+	if (0 == serial->count)
+		return (EINVAL);
+
+	return (0);
+}
+
+int
+serial_counter_next(const char *file_name, uint64_t *value) {
+	int error = 0, fd;
+	ssize_t ios;
+	char buf[SERIAL_COUNTER_SIZE_MAX];
+
+	if (NULL == file_name || NULL == value)
+		return (EINVAL);
+
+	fd = open(file_name, (O_RDWR | O_CREAT), 0600);
+	if (-1 == fd)
+		return (errno);
+	/* Released on close. */
+	if (0 != flock(fd, LOCK_EX)) {
+		error = errno;
+		goto err_out;
+	}
+	ios = pread(fd, buf, (sizeof(buf) - 1), 0);
+	if (0 > ios) {
+		error = errno;
+		goto err_out;
+	}
+	(*value) = ustrh2u64((const uint8_t*)buf, (size_t)ios);
+	ios = snprintf(buf, sizeof(buf), "0x%016"PRIx64"\n", ((*value) + 1));
+	if (ios != pwrite(fd, buf, (size_t)ios, 0) ||
+	    0 != ftruncate(fd, ios) ||
+	    0 != fsync(fd)) {
+		error = errno;
+		goto err_out;
+	}
+
+err_out:
+	close(fd);
+
+	return (error);
+}
+
+int
+serial_build(serial_p serial, uint64_t value, const uint8_t *img,
+    uint32_t img_addr, size_t img_size) {
+	int error;
+	size_t i, j, start, end, pos, tm;
+	uint32_t crc;
+	uint64_t item_val;
+	serial_item_p si;
+	uint8_t buf[SERIAL_CRC_CHUNK];
+
+	if (NULL == serial || NULL == img)
+		return (EINVAL);
+
+	for (i = 0; i < serial->count; i ++) {
+		si = &serial->items[i];
+		if (si->address < img_addr ||
+		    ((size_t)si->address + si->size) >
+		    ((size_t)img_addr + img_size)) {
+			fprintf(stderr, "Serial item at 0x%08"PRIx32" is out "
+			    "of image range.\n", si->address);
+			return (EINVAL);
+		}
+		if (SERIAL_FMT_CRC32 != si->fmt) {
+			item_val = (si->base + value);
+			if (item_val < value) {
+				error = ERANGE;
+			} else {
+				error = serial_item_fmt(si, item_val);
+			}
+			if (0 != error) {
+				fprintf(stderr, "Serial value 0x%"PRIx64" does "
+				    "not fit to item at 0x%08"PRIx32".\n",
+				    item_val, si->address);
+				return (error);
+			}
+		} else {
+			if (si->base < img_addr ||
+			    (si->base + si->crc_size) >
+			    ((uint64_t)img_addr + img_size)) {
+				fprintf(stderr, "Serial CRC range at "
+				    "0x%08"PRIx64" is out of image "
+				    "range.\n", si->base);
+				return (EINVAL);
+			}
+			/* Image by chunks with previous items patched. */
+			crc = 0xffffffff;
+			for (pos = (size_t)si->base;
+			    pos < (size_t)(si->base + si->crc_size);
+			    pos += tm) {
+				tm = MIN(sizeof(buf),
+				    (size_t)(si->base + si->crc_size - pos));
+				memcpy(buf, (img + (pos - img_addr)), tm);
+				for (j = 0; j < i; j ++) {
+					start = MAX(pos,
+					    (size_t)serial->items[j].address);
+					end = MIN((pos + tm),
+					    ((size_t)serial->items[j].address +
+					    serial->items[j].size));
+					if (start >= end)
+						continue;
+					memcpy((buf + (start - pos)),
+					    (serial->items[j].data + (start -
+					    serial->items[j].address)),
+					    (end - start));
+				}
+				crc = serial_crc32_upd(crc, buf, tm);
+			}
+			crc ^= 0xffffffff;
+			for (j = 0; j < 4; j ++, crc >>= 8) {
+				si->data[j] = (uint8_t)crc;
+			}
+		}
+		serial->ovls[i].address = si->address;
+		serial->ovls[i].size = si->size;
+		serial->ovls[i].data = si->data;
+	}
+	serial->value = value;
+
+	return (0);
+}
@@ -0,0 +1,64 @@
+#ifndef __SERIAL_H
+#define __SERIAL_H
+
+#include <sys/types.h>
+#include <inttypes.h>
+
+#include "minipro.h"
+
+
+#define SERIAL_ITEMS_MAX	16
+#define SERIAL_ITEM_SIZE_MAX	20	/* Decimal digits in uint64_t. */
+
+/* Per unit patch items, list: <addr>:<size>:<format>[:<base>],...
+ * (hex), value is base + counter.
+ * le, be - binary, size 1..8; MAC: <addr>:6:be:<OUI and prefix>.
+ * bcd - packed BCD, most significant digit first, size 1..10.
+ * ascii - decimal digits, zero padded, size 1..20.
+ * CRC fix-up: <addr>:4:crc32:<start>:<size> - CRC-32 (IEEE 802.3),
+ * little endian, of image range with previous items applied. */
+#define SERIAL_FMT_LE		0
+#define SERIAL_FMT_BE		1
+#define SERIAL_FMT_BCD		2
+#define SERIAL_FMT_ASCII	3
+#define SERIAL_FMT_CRC32	4
+#define SERIAL_FMT__COUNT__	5
+static const char *serial_fmt_str[] = {
+	"le",
+	"be",
+	"bcd",
+	"ascii",
+	"crc32",
+	NULL
+};
+
+typedef struct serial_item_s {
+	int		fmt;		/* SERIAL_FMT_*. */
+	uint32_t	address;
+	size_t		size;
+	uint64_t	base;		/* crc32: range start address. */
+	size_t		crc_size;
+	uint8_t		data[SERIAL_ITEM_SIZE_MAX];
+} serial_item_t, *serial_item_p;
+
+typedef struct serial_s {
+	serial_item_t	items[SERIAL_ITEMS_MAX];
+	mp_overlay_t	ovls[SERIAL_ITEMS_MAX]; /* For minipro_overlay_set(). */
+	size_t		count;
+	uint64_t	value;
+} serial_t, *serial_p;
+
+
+int	serial_parse(const char *str, serial_p serial);
+
+/* Take next value from counter file: hex number, created if not
+ * exist. File is locked while updated: concurrent stations never get
+ * same value. */
+int	serial_counter_next(const char *file_name, uint64_t *value);
+
+/* Make item patches for value, img - base image at img_addr, all items
+ * must be inside it. */
+int	serial_build(serial_p serial, uint64_t value, const uint8_t *img,
+	    uint32_t img_addr, size_t img_size);
+
+#endif
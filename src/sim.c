@@ -0,0 +1,228 @@
+#include <sys/types.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <libusb.h>
+
+#include "utils/macro.h"
+
+#include "sim.h"
+
+
+#define SIM_FW_VER		0x0256
+#define SIM_STATUS_SIZE		32
+
+
+typedef struct sim_s {
+	chip_p		chip;
+	uint8_t		*code;
+	uint8_t		*data;
+	uint32_t	cmd_lat_us;
+	uint32_t	byte_ns;
+	uint8_t		resp[MP_MSG_SIZE_MAX]; /* Pending answer. */
+	size_t		resp_size;
+	sim_stats_t	stats;
+} sim_t;
+
+
+static void
+sim_delay(sim_p sim, size_t bytes, int is_cmd) {
+	uint64_t ns;
+	struct timespec ts;
+
+	ns = (((uint64_t)bytes) * sim->byte_ns);
+	if (0 != is_cmd) {
+		ns += (((uint64_t)sim->cmd_lat_us) * 1000);
+	}
+	if (0 == ns)
+		return;
+	ts.tv_sec = (time_t)(ns / 1000000000);
+	ts.tv_nsec = (long)(ns % 1000000000);
+	nanosleep(&ts, NULL);
+}
+
+/* Chip memory for page read/write command, NULL if no page. */
+static uint8_t *
+sim_page_mem(sim_p sim, uint8_t cmd, size_t *size) {
+
+	switch (cmd) {
+	case MP_CMD_READ_CODE:
+	case MP_CMD_WRITE_CODE:
+		(*size) = sim->chip->code_memory_size;
+		return (sim->code);
+	case MP_CMD_READ_DATA:
+	case MP_CMD_WRITE_DATA:
+		(*size) = sim->chip->data_memory_size;
+		return (sim->data);
+	}
+
+	return (NULL);
+}
+
+static void
+sim_cmd(sim_p sim, const uint8_t *buf, size_t buf_size) {
+	uint8_t *mem;
+	uint32_t addr, tm;
+	size_t size, mem_size = 0;
+	minipro_ver_p ver;
+
+	sim->resp_size = 0;
+	switch (buf[0]) {
+	case MP_CMD_GET_VERSION:
+		ver = (minipro_ver_p)(void*)sim->resp;
+		memset(ver, 0x00, sizeof(minipro_ver_t));
+		ver->echo = MP_CMD_GET_VERSION;
+		ver->device_status = MP_DEV_VER_STATUS_NORMAL;
+		ver->report_size = sizeof(minipro_ver_t);
+		ver->firmware_version_major = (SIM_FW_VER >> 8);
+		ver->firmware_version_minor = (SIM_FW_VER & 0xff);
+		ver->device_version = MP_DEV_VER_TL866A;
+		memcpy(ver->device_code, "SIM     ", 8);
+		memcpy(ver->serial_num, "SIMULATED", 9);
+		sim->resp_size = sizeof(minipro_ver_t);
+		break;
+	case MP_CMD_GET_STATUS: /* No errors, no overcurrency. */
+		memset(sim->resp, 0x00, SIM_STATUS_SIZE);
+		sim->resp_size = SIM_STATUS_SIZE;
+		break;
+	case MP_CMD_GET_CHIP_ID:
+		memset(sim->resp, 0x00, 8);
+		sim->resp[0] = MP_CHIP_ID_TYPE1;
+		sim->resp[1] = (MIN(sim->chip->chip_id_size, 3) & 0x03);
+		tm = sim->chip->chip_id;
+		for (size = sim->resp[1]; 0 < size; size --) {
+			sim->resp[(1 + size)] = (uint8_t)tm;
+			tm >>= 8;
+		}
+		sim->resp_size = 8;
+		break;
+	case MP_CMD_UNLOCK_TSOP48:
+		memset(sim->resp, 0x00, 17);
+		sim->resp[1] = MP_TSOP48_TYPE_V3;
+		sim->resp_size = 17;
+		break;
+	case MP_CMD_ERASE:
+		memset(sim->code, 0xff, sim->chip->code_memory_size);
+		memset(sim->data, 0xff, sim->chip->data_memory_size);
+		memset(sim->resp, 0x00, 10);
+		sim->resp[0] = MP_CMD_ERASE;
+		sim->resp_size = 10;
+		break;
+	case MP_CMD_READ_CODE:
+	case MP_CMD_READ_DATA:
+	case MP_CMD_WRITE_CODE:
+	case MP_CMD_WRITE_DATA:
+		if (7 > buf_size)
+			break;
+		mem = sim_page_mem(sim, buf[0], &mem_size);
+		size = (size_t)(buf[2] | (buf[3] << 8));
+		addr = (uint32_t)(buf[4] | (buf[5] << 8) | (buf[6] << 16));
+		if (0 != (CHIP_OPT4_ADDR_SCALE & sim->chip->opts4)) {
+			addr <<= 1;
+		}
+		if (NULL == mem || addr >= mem_size)
+			break;
+		size = MIN(size, (mem_size - addr));
+		if (MP_CMD_READ_CODE == buf[0] ||
+		    MP_CMD_READ_DATA == buf[0]) {
+			memcpy(sim->resp, (mem + addr), size);
+			sim->resp_size = size;
+		} else {
+			memcpy((mem + addr), (buf + 7),
+			    MIN(size, (buf_size - 7)));
+		}
+		break;
+	default: /* Transactions, protect, pins: no answer. */
+		break;
+	}
+}
+
+
+int
+sim_create(const chip_p chip, uint32_t cmd_lat_us, uint32_t byte_ns,
+    sim_p *sim_ret) {
+	sim_p sim;
+
+	if (NULL == chip || NULL == sim_ret)
+		return (EINVAL);
+	sim = calloc(1, sizeof(sim_t));
+	if (NULL == sim)
+		return (ENOMEM);
+	sim->chip = chip;
+	sim->cmd_lat_us = cmd_lat_us;
+	sim->byte_ns = byte_ns;
+	/* Erased chip. */
+	sim->code = malloc(chip->code_memory_size + 1);
+	sim->data = malloc(chip->data_memory_size + 1);
+	if (NULL == sim->code || NULL == sim->data) {
+		sim_destroy(sim);
+		return (ENOMEM);
+	}
+	memset(sim->code, 0xff, chip->code_memory_size);
+	memset(sim->data, 0xff, chip->data_memory_size);
+	(*sim_ret) = sim;
+
+	return (0);
+}
+
+void
+sim_destroy(sim_p sim) {
+
+	if (NULL == sim)
+		return;
+	free(sim->code);
+	free(sim->data);
+	free(sim);
+}
+
+int
+sim_transfer(void *udata, uint8_t dir, uint8_t *buf, size_t buf_size,
+    uint32_t timeout __unused, size_t *transferred) {
+	sim_p sim = udata;
+	size_t size;
+
+	if (NULL == sim || NULL == buf)
+		return (LIBUSB_ERROR_INVALID_PARAM);
+	if (LIBUSB_ENDPOINT_IN == (LIBUSB_ENDPOINT_IN & dir)) {
+		if (0 == sim->resp_size) {
+			(*transferred) = 0;
+			return (LIBUSB_ERROR_TIMEOUT);
+		}
+		size = MIN(buf_size, sim->resp_size);
+		memcpy(buf, sim->resp, size);
+		sim->resp_size = 0;
+		sim->stats.resps ++;
+		sim->stats.bytes_in += size;
+		sim_delay(sim, size, 0);
+		(*transferred) = size;
+		return (0);
+	}
+	if (0 == buf_size)
+		return (LIBUSB_ERROR_INVALID_PARAM);
+	sim->stats.cmds ++;
+	sim->stats.bytes_out += buf_size;
+	sim_cmd(sim, buf, buf_size);
+	sim_delay(sim, buf_size, 1);
+	(*transferred) = buf_size;
+
+	return (0);
+}
+
+void
+sim_stats_get(sim_p sim, sim_stats_p stats) {
+
+	if (NULL == sim || NULL == stats)
+		return;
+	memcpy(stats, &sim->stats, sizeof(sim_stats_t));
+}
+
+void
+sim_stats_reset(sim_p sim) {
+
+	if (NULL == sim)
+		return;
+	memset(&sim->stats, 0x00, sizeof(sim_stats_t));
+}
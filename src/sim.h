@@ -0,0 +1,35 @@
+#ifndef __SIM_H
+#define __SIM_H
+
+#include <sys/types.h>
+#include <inttypes.h>
+
+#include "minipro.h"
+
+
+/* Memory backed TL866 simulator: minipro_transfer_fn for
+ * minipro_open_transfer(). Handles version, transactions, status,
+ * chip ID, erase, protect and code/data block read/write; other
+ * commands are accepted and ignored. */
+typedef struct sim_s *sim_p;
+
+typedef struct sim_stats_s {
+	size_t		cmds;		/* Transfers to device. */
+	size_t		resps;		/* Transfers from device. */
+	size_t		bytes_out;
+	size_t		bytes_in;
+} sim_stats_t, *sim_stats_p;
+
+
+/* cmd_lat_us: device time per command, byte_ns: per payload byte. */
+int	sim_create(const chip_p chip, uint32_t cmd_lat_us, uint32_t byte_ns,
+	    sim_p *sim_ret);
+void	sim_destroy(sim_p sim);
+
+int	sim_transfer(void *udata, uint8_t dir, uint8_t *buf, size_t buf_size,
+	    uint32_t timeout, size_t *transferred);
+
+void	sim_stats_get(sim_p sim, sim_stats_p stats);
+void	sim_stats_reset(sim_p sim);
+
+#endif
@@ -0,0 +1,407 @@
+#include <sys/types.h>
+#include <sys/file.h>
+#include <inttypes.h>
+#include <stddef.h> /* offsetof */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <errno.h>
+
+#include "utils/macro.h"
+#include "utils/mem_utils.h"
+#include "utils/strh2num.h"
+#include "utils/sys.h"
+#include "utils/ini.h"
+
+#include "tune.h"
+
+
+#define TUNE_CACHE_PREALLOC	16
+#define TUNE_CACHE_SIZE_MAX	(16 * 1024 * 1024)
+#define TUNE_KEY_SIZE		(CHIP_NAME_MAX + 8)
+
+
+/* Cache file fields. */
+static const struct {
+	const char	*name;
+	size_t		offset;
+} tune_fields[] = {
+	{ "read_block_size",	offsetof(tune_t, read_block_size) },
+	{ "status_poll_ival",	offsetof(tune_t, status_poll_ival) },
+	{ "lat_open",		offsetof(tune_t, lat_open) },
+	{ "lat_chip_set",	offsetof(tune_t, lat_chip_set) },
+	{ "lat_status",		offsetof(tune_t, lat_status) },
+	{ "lat_read",		offsetof(tune_t, lat_read) },
+	{ "lat_read_bs",	offsetof(tune_t, lat_read_bs) },
+	{ "lat_write",		offsetof(tune_t, lat_write) },
+	{ "lat_erase",		offsetof(tune_t, lat_erase) },
+};
+#define TUNE_FIELD(__tune, __idx)					\
+	((uint32_t*)(void*)(((uint8_t*)(__tune)) + tune_fields[(__idx)].offset))
+
+
+typedef struct tune_entry_s {
+	char		key[TUNE_KEY_SIZE]; /* "<fw_ver>:<chip_name>" */
+	tune_t		tune;
+} tune_entry_t, *tune_entry_p;
+
+/* Status poll intervals to probe. */
+static const uint32_t tune_status_poll_ivals[] = {
+	1, 4, 16, 64
+};
+
+
+static size_t
+tune_key(char *buf, size_t buf_size, const char *chip_name,
+    uint16_t fw_ver) {
+
+	return ((size_t)snprintf(buf, buf_size, "%04x:%s", fw_ver, chip_name));
+}
+
+static uint64_t
+tune_time_us(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ((((uint64_t)ts.tv_sec) * 1000000) +
+	    (((uint64_t)ts.tv_nsec) / 1000));
+}
+
+
+static int
+tune_cache_load(const char *file_name, tune_entry_p *entries,
+    size_t *entries_count) {
+	int error;
+	uint8_t *buf = NULL;
+	const uint8_t *sname, *vn, *val;
+	size_t i, buf_size, soff, voff, sname_sz, vn_sz, val_size;
+	size_t allocated = 0, count = 0;
+	ini_p ini = NULL;
+	tune_entry_p ents = NULL;
+
+	error = read_file(file_name, 0, 0, 0, TUNE_CACHE_SIZE_MAX,
+	    &buf, &buf_size);
+	if (0 != error)
+		return (error);
+	error = ini_create(&ini);
+	if (0 != error)
+		goto err_out;
+	error = ini_buf_parse(ini, buf, buf_size);
+	if (0 != error)
+		goto err_out;
+	soff = 0;
+	while (0 == ini_sect_enum(ini, &soff, &sname, &sname_sz)) {
+		error = realloc_items((void**)&ents,
+		    sizeof(tune_entry_t), &allocated,
+		    TUNE_CACHE_PREALLOC, count);
+		if (0 != error)
+			goto err_out;
+		memset(&ents[count], 0x00, sizeof(tune_entry_t));
+		sname_sz = MIN(sname_sz, (TUNE_KEY_SIZE - 1));
+		memcpy(ents[count].key, sname, sname_sz);
+		ents[count].key[sname_sz] = 0;
+		voff = 0;
+		while (0 == ini_sect_val_enum(ini, soff, &voff,
+		    &vn, &vn_sz, &val, &val_size)) {
+			for (i = 0; i < SIZEOF(tune_fields); i ++) {
+				if (0 != mem_cmpn_cstr(tune_fields[i].name,
+				    vn, vn_sz))
+					continue;
+				(*TUNE_FIELD(&ents[count].tune, i)) =
+				    ustrh2u32(val, val_size);
+				break;
+			}
+			voff ++;
+		}
+		count ++;
+		soff ++;
+	}
+	(*entries) = ents;
+	(*entries_count) = count;
+
+err_out:
+	if (0 != error) {
+		free(ents);
+	}
+	ini_destroy(ini);
+	free(buf);
+
+	return (error);
+}
+
+
+int
+tune_cache_get(const char *file_name, const char *chip_name,
+    uint16_t fw_ver, tune_p tune) {
+	int error;
+	char key[TUNE_KEY_SIZE];
+	size_t i, count = 0;
+	tune_entry_p ents = NULL;
+
+	if (NULL == file_name || NULL == chip_name || NULL == tune)
+		return (EINVAL);
+
+	error = tune_cache_load(file_name, &ents, &count);
+	if (0 != error)
+		return (error);
+	tune_key(key, sizeof(key), chip_name, fw_ver);
+	error = ENOENT;
+	for (i = 0; i < count; i ++) {
+		if (TUNE_FW_VER_ANY == fw_ver) { /* Skip "<fw_ver>:". */
+			if (5 > strlen(ents[i].key) ||
+			    0 != strcasecmp(chip_name, (ents[i].key + 5)))
+				continue;
+			memcpy(tune, &ents[i].tune, sizeof(tune_t));
+			error = 0;
+			continue; /* Last one. */
+		}
+		if (0 != strcasecmp(key, ents[i].key))
+			continue;
+		memcpy(tune, &ents[i].tune, sizeof(tune_t));
+		error = 0;
+		break;
+	}
+	free(ents);
+
+	return (error);
+}
+
+/* Update or add entry and rewrite whole file.
+ * Lock file held while load-modify-rename: other minipro processes may
+ * update same cache. */
+int
+tune_cache_set(const char *file_name, const char *chip_name,
+    uint16_t fw_ver, const tune_p tune) {
+	int error, fd, lock_fd;
+	FILE *fp;
+	char key[TUNE_KEY_SIZE], tmp_name[1024];
+	size_t i, j, allocated, count = 0;
+	tune_entry_p ents = NULL;
+
+	if (NULL == file_name || NULL == chip_name || NULL == tune)
+		return (EINVAL);
+
+	if ((int)sizeof(tmp_name) <= snprintf(tmp_name, sizeof(tmp_name),
+	    "%s.lock", file_name))
+		return (ENAMETOOLONG);
+	lock_fd = open(tmp_name, (O_RDWR | O_CREAT), 0600);
+	if (-1 == lock_fd)
+		return (errno);
+	/* Released on close. */
+	if (0 != flock(lock_fd, LOCK_EX)) {
+		error = errno;
+		goto err_out;
+	}
+
+	error = tune_cache_load(file_name, &ents, &count);
+	if (0 != error && ENOENT != error)
+		goto err_out;
+	tune_key(key, sizeof(key), chip_name, fw_ver);
+	for (i = 0; i < count; i ++) {
+		if (0 == strcasecmp(key, ents[i].key))
+			break;
+	}
+	if (i == count) { /* Not found, add. */
+		allocated = count;
+		error = realloc_items((void**)&ents,
+		    sizeof(tune_entry_t), &allocated,
+		    TUNE_CACHE_PREALLOC, count);
+		if (0 != error)
+			goto err_out;
+		memcpy(ents[i].key, key, sizeof(key));
+		count ++;
+	}
+	memcpy(&ents[i].tune, tune, sizeof(tune_t));
+
+	/* Write to unique temp file and rename it. */
+	snprintf(tmp_name, sizeof(tmp_name), "%s.XXXXXX", file_name);
+	fd = mkstemp(tmp_name);
+	if (-1 == fd) {
+		error = errno;
+		goto err_out;
+	}
+	fp = fdopen(fd, "w");
+	if (NULL == fp) {
+		error = errno;
+		close(fd);
+		unlink(tmp_name);
+		goto err_out;
+	}
+	for (i = 0; i < count; i ++) {
+		fprintf(fp, "[%s]\n", ents[i].key);
+		for (j = 0; j < SIZEOF(tune_fields); j ++) {
+			fprintf(fp, "%s=0x%02"PRIx32"\n",
+			    tune_fields[j].name,
+			    (*TUNE_FIELD(&ents[i].tune, j)));
+		}
+		fprintf(fp, "\n");
+	}
+	error = ((0 != ferror(fp)) ? EIO : 0);
+	if (0 != fclose(fp) && 0 == error) {
+		error = errno;
+	}
+	if (0 == error &&
+	    0 != rename(tmp_name, file_name)) {
+		error = errno;
+	}
+	if (0 != error) {
+		unlink(tmp_name);
+	}
+
+err_out:
+	close(lock_fd);
+	free(ents);
+
+	return (error);
+}
+
+
+/* Read code page start with all read block sizes and status poll
+ * intervals, compare with reference read done with chip defaults and
+ * select fastest correct combination. */
+int
+tune_calibrate(minipro_p mp, int verbose, tune_p tune) {
+	int error;
+	chip_p chip;
+	uint8_t *ref = NULL, *buf = NULL;
+	uint32_t rbs;
+	uint64_t tm, best_tm;
+	size_t i, size;
+	tune_t best;
+
+	chip = minipro_chip_get(mp);
+	if (NULL == chip || NULL == tune)
+		return (EINVAL);
+	size = MIN(chip->code_memory_size, TUNE_CALIBRATE_SIZE);
+	if (0 == size)
+		return (EINVAL);
+	ref = malloc(size);
+	buf = malloc(size);
+	if (NULL == ref || NULL == buf) {
+		error = ENOMEM;
+		goto err_out;
+	}
+
+	/* Reference: chip defaults. */
+	best.read_block_size = chip->read_block_size;
+	best.status_poll_ival = 1;
+	error = minipro_tune_set(mp, 0, 0);
+	if (0 != error)
+		goto err_out;
+	tm = tune_time_us();
+	error = minipro_read_buf(mp, MP_CMD_READ_CODE, 0, ref, size,
+	    NULL, NULL);
+	if (0 != error)
+		goto err_out;
+	best_tm = (tune_time_us() - tm);
+	/* Blank chip or data repeated with read block period: misordered
+	 * or shifted blocks read back equal, failed combination will be
+	 * taken as good. */
+	if (size <= chip->read_block_size ||
+	    0 == memcmp(ref, (ref + chip->read_block_size),
+	    (size - chip->read_block_size))) {
+		fprintf(stderr, "Calibration needs chip with programmed "
+		    "non repeated data in first %zu bytes.\n", size);
+		error = EINVAL;
+		goto err_out;
+	}
+	if (0 != verbose) {
+		printf("Calibration: %zu bytes, default read block: 0x%x, "
+		    "%"PRIu64" bytes/s.\n",
+		    size, chip->read_block_size,
+		    (((uint64_t)size * 1000000) / MAX(best_tm, 1)));
+	}
+
+	for (rbs = chip->read_block_size;
+	    MP_BLOCK_SIZE_MAX >= rbs && size >= rbs;
+	    rbs *= 2) {
+		for (i = 0; i < SIZEOF(tune_status_poll_ivals); i ++) {
+			if (chip->read_block_size == rbs &&
+			    1 == tune_status_poll_ivals[i])
+				continue; /* Reference. */
+			if (0 != minipro_tune_set(mp, rbs,
+			    tune_status_poll_ivals[i]))
+				break; /* Block size not allowed. */
+			memset(buf, 0x00, size);
+			tm = tune_time_us();
+			error = minipro_read_buf(mp, MP_CMD_READ_CODE, 0,
+			    buf, size, NULL, NULL);
+			tm = (tune_time_us() - tm);
+			if (0 == error &&
+			    0 != memcmp(ref, buf, size)) {
+				error = EBADMSG;
+			}
+			if (0 != verbose) {
+				printf("	read block: 0x%04x, "
+				    "status poll: 1/%-2"PRIu32", "
+				    "%"PRIu64" bytes/s - %s\n",
+				    rbs, tune_status_poll_ivals[i],
+				    (((uint64_t)size * 1000000) / MAX(tm, 1)),
+				    ((0 == error) ? "OK" : "FAIL"));
+			}
+			if (0 != error) {
+				error = 0;
+				break; /* Larger intervals does not help. */
+			}
+			if (tm < best_tm) {
+				best_tm = tm;
+				best.read_block_size = rbs;
+				best.status_poll_ival = tune_status_poll_ivals[i];
+			}
+		}
+	}
+
+	error = minipro_tune_set(mp, best.read_block_size,
+	    best.status_poll_ival);
+	if (0 == error) {
+		tune->read_block_size = best.read_block_size;
+		tune->status_poll_ival = best.status_poll_ival;
+	}
+
+err_out:
+	free(ref);
+	free(buf);
+
+	return (error);
+}
+
+
+/* Average of new measurement blended with old: smooth outliers. */
+static void
+tune_lat_blend(uint32_t *lat, uint64_t total_us, size_t count) {
+	uint64_t val;
+
+	if (0 == count)
+		return;
+	val = MIN((total_us / count), UINT32_MAX);
+	if (0 != (*lat)) {
+		val = (((((uint64_t)(*lat)) * 3) + val) / 4);
+	}
+	(*lat) = (uint32_t)MAX(val, 1);
+}
+
+void
+tune_lat_update(tune_p tune, const minipro_stats_p stats,
+    uint32_t read_block_size, uint64_t open_us, uint64_t chip_set_us) {
+
+	if (NULL == tune || NULL == stats)
+		return;
+	tune_lat_blend(&tune->lat_open, open_us, ((0 != open_us) ? 1 : 0));
+	tune_lat_blend(&tune->lat_chip_set, chip_set_us,
+	    ((0 != chip_set_us) ? 1 : 0));
+	tune_lat_blend(&tune->lat_status, stats->ovc_check_us,
+	    stats->ovc_checks);
+	if (tune->lat_read_bs != read_block_size) { /* Not comparable. */
+		tune->lat_read = 0;
+		tune->lat_read_bs = read_block_size;
+	}
+	tune_lat_blend(&tune->lat_read, stats->read_block_us,
+	    stats->blocks_read);
+	tune_lat_blend(&tune->lat_write, stats->write_block_us,
+	    stats->blocks_written);
+	tune_lat_blend(&tune->lat_erase, stats->erase_us, stats->erases);
+}
@@ -0,0 +1,40 @@
+#ifndef __TUNE_H
+#define __TUNE_H
+
+#include <sys/types.h>
+#include <inttypes.h>
+
+#include "minipro.h"
+
+
+#define TUNE_CACHE_FILE_DEF	".minipro_tune.ini" /* In $HOME. */
+#define TUNE_CALIBRATE_SIZE	(64 * 1024) /* Max bytes to read per probe. */
+#define TUNE_FW_VER_ANY		0xffff /* tune_cache_get(): last for chip. */
+
+
+/* Per chip name and firmware version transfer settings and
+ * latencies measured on previous runs (us, 0 = unknown). */
+typedef struct tune_s {
+	uint32_t	read_block_size;
+	uint32_t	status_poll_ival;
+	uint32_t	lat_open;
+	uint32_t	lat_chip_set;
+	uint32_t	lat_status;	/* Overcurrency check. */
+	uint32_t	lat_read;	/* Per lat_read_bs bytes block. */
+	uint32_t	lat_read_bs;
+	uint32_t	lat_write;	/* Per chip write block. */
+	uint32_t	lat_erase;
+} tune_t, *tune_p;
+
+
+int	tune_cache_get(const char *file_name, const char *chip_name,
+	    uint16_t fw_ver, tune_p tune);
+int	tune_cache_set(const char *file_name, const char *chip_name,
+	    uint16_t fw_ver, const tune_p tune);
+
+int	tune_calibrate(minipro_p mp, int verbose, tune_p tune);
+/* Blend latencies measured by finished job into tune. */
+void	tune_lat_update(tune_p tune, const minipro_stats_p stats,
+	    uint32_t read_block_size, uint64_t open_us, uint64_t chip_set_us);
+
+#endif
@@ -0,0 +1,219 @@
+#include <sys/types.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#include "utils/macro.h"
+#include "utils/mem_utils.h"
+#include "utils/strh2num.h"
+
+#include "xform.h"
+
+
+/* Chip bytes per pass: all ops done on block while it is in cache. */
+#define XFORM_BLOCK_SIZE	(64 * 1024)
+
+
+/* Byte ops on 64 bit words (compiler vectorize it), tail by bytes.
+ * size aligned by op. */
+static void
+xform_op_bytes(int op, uint8_t *buf, size_t size) {
+	register size_t i;
+	uint64_t w;
+	uint8_t tm;
+
+	for (i = 0; (i + 8) <= size; i += 8) {
+		memcpy(&w, (buf + i), 8);
+		switch (op) {
+		case XFORM_OP_BSWAP32:
+			w = (((w & 0x0000ffff0000ffffull) << 16) |
+			    ((w >> 16) & 0x0000ffff0000ffffull));
+			/* FALLTHROUGH */
+		case XFORM_OP_BSWAP16:
+			w = (((w & 0x00ff00ff00ff00ffull) << 8) |
+			    ((w >> 8) & 0x00ff00ff00ff00ffull));
+			break;
+		case XFORM_OP_BITREV:
+			w = (((w & 0x0f0f0f0f0f0f0f0full) << 4) |
+			    ((w >> 4) & 0x0f0f0f0f0f0f0f0full));
+			w = (((w & 0x3333333333333333ull) << 2) |
+			    ((w >> 2) & 0x3333333333333333ull));
+			w = (((w & 0x5555555555555555ull) << 1) |
+			    ((w >> 1) & 0x5555555555555555ull));
+			break;
+		}
+		memcpy((buf + i), &w, 8);
+	}
+	for (; i < size; i ++) {
+		switch (op) {
+		case XFORM_OP_BSWAP16:
+			tm = buf[i];
+			buf[i] = buf[(i + 1)];
+			buf[(i + 1)] = tm;
+			i ++;
+			break;
+		case XFORM_OP_BSWAP32:
+			tm = buf[i];
+			buf[i] = buf[(i + 3)];
+			buf[(i + 3)] = tm;
+			tm = buf[(i + 1)];
+			buf[(i + 1)] = buf[(i + 2)];
+			buf[(i + 2)] = tm;
+			i += 3;
+			break;
+		case XFORM_OP_BITREV:
+			tm = buf[i];
+			tm = (uint8_t)(((tm & 0x0f) << 4) | (tm >> 4));
+			tm = (uint8_t)(((tm & 0x33) << 2) | ((tm >> 2) & 0x33));
+			buf[i] = (uint8_t)(((tm & 0x55) << 1) | ((tm >> 1) & 0x55));
+			break;
+		}
+	}
+}
+
+
+int
+xform_parse(const char *str, xform_p xf) {
+	size_t i, tm, item_size, fld_size[3];
+	const char *ptr, *item, *fld[3];
+	xform_op_p xop;
+
+	if (NULL == str || NULL == xf)
+		return (EINVAL);
+	memset(xf, 0x00, sizeof(xform_t));
+	xf->ratio = 1;
+	xf->align = 1;
+	for (ptr = str; 0 != (*ptr);) {
+		if (',' == (*ptr)) {
+			ptr ++;
+			continue;
+		}
+		item = ptr;
+		while (0 != (*ptr) && ',' != (*ptr)) {
+			ptr ++;
+		}
+		item_size = (size_t)(ptr - item);
+		if (XFORM_OPS_MAX <= xf->count) {
+			fprintf(stderr, "Too many transforms, max: %i.\n",
+			    XFORM_OPS_MAX);
+			return (EINVAL);
+		}
+		memset(fld_size, 0x00, sizeof(fld_size));
+		for (tm = 0, i = 0; tm < 3 && i <= item_size; tm ++) {
+			fld[tm] = (item + i);
+			for (; i < item_size && ':' != item[i]; i ++)
+				;
+			fld_size[tm] = (size_t)((item + i) - fld[tm]);
+			i ++;
+		}
+		if (i <= item_size)
+			goto bad_item;
+		xop = &xf->ops[xf->count];
+		for (xop->op = 0; XFORM_OP__COUNT__ > xop->op; xop->op ++) {
+			if (0 == mem_cmpn_cstr(xform_op_str[xop->op],
+			    fld[0], fld_size[0]))
+				break;
+		}
+		switch (xop->op) {
+		case XFORM_OP_BSWAP16:
+		case XFORM_OP_BSWAP32:
+		case XFORM_OP_BITREV:
+			if (1 != tm)
+				goto bad_item;
+			xf->align = MAX(xf->align,
+			    ((XFORM_OP_BSWAP16 == xop->op) ? 2 :
+			     ((XFORM_OP_BSWAP32 == xop->op) ? 4 : 1)));
+			break;
+		case XFORM_OP_LANE:
+			if (3 != tm || 0 != xf->count)
+				goto bad_item;
+			xop->lanes = strh2usize(fld[1], fld_size[1]);
+			xop->lane = strh2usize(fld[2], fld_size[2]);
+			if (2 > xop->lanes || XFORM_LANES_MAX < xop->lanes ||
+			    xop->lane >= xop->lanes)
+				goto bad_item;
+			xf->ratio = xop->lanes;
+			break;
+		default:
+			goto bad_item;
+		}
+		xf->count ++;
+		continue;
+bad_item:
+		fprintf(stderr, "Bad transform: \"%.*s\".\n",
+		    (int)item_size, item);
+		return (EINVAL);
+	}
+	if (0 == xf->count)
+		return (EINVAL);
+
+	return (0);
+}
+
+int
+xform_to_chip(const xform_p xf, uint8_t *buf, size_t buf_size,
+    size_t *size_ret) {
+	size_t i, j, off, tm, size, start = 0, lanes = 1, lane = 0;
+
+	if (NULL == xf || NULL == buf || NULL == size_ret)
+		return (EINVAL);
+	if (0 != xf->count && XFORM_OP_LANE == xf->ops[0].op) {
+		lanes = xf->ops[0].lanes;
+		lane = xf->ops[0].lane;
+		start = 1;
+	}
+	size = (buf_size / lanes);
+	if (0 != (size % xf->align))
+		return (EINVAL);
+	for (off = 0; off < size; off += tm) {
+		tm = MIN(XFORM_BLOCK_SIZE, (size - off));
+		/* Lane gather: output never overruns input. */
+		if (1 != lanes) {
+			for (i = 0, j = (((off * lanes)) + lane); i < tm;
+			    i ++, j += lanes) {
+				buf[(off + i)] = buf[j];
+			}
+		}
+		for (i = start; i < xf->count; i ++) {
+			xform_op_bytes(xf->ops[i].op, (buf + off), tm);
+		}
+	}
+	(*size_ret) = size;
+
+	return (0);
+}
+
+int
+xform_to_file(const xform_p xf, uint8_t *chip, size_t size,
+    uint8_t *file_buf) {
+	size_t i, j, off, tm, start = 0, lanes = 1, lane = 0;
+
+	if (NULL == xf || NULL == chip)
+		return (EINVAL);
+	if (0 != xf->count && XFORM_OP_LANE == xf->ops[0].op) {
+		if (NULL == file_buf)
+			return (EINVAL);
+		lanes = xf->ops[0].lanes;
+		lane = xf->ops[0].lane;
+		start = 1;
+	}
+	if (0 != (size % xf->align))
+		return (EINVAL);
+	for (off = 0; off < size; off += tm) {
+		tm = MIN(XFORM_BLOCK_SIZE, (size - off));
+		/* All byte ops are own inverse: reverse order. */
+		for (i = xf->count; i > start; i --) {
+			xform_op_bytes(xf->ops[(i - 1)].op, (chip + off), tm);
+		}
+		if (1 != lanes) { /* Lane scatter. */
+			for (i = 0, j = ((off * lanes) + lane); i < tm;
+			    i ++, j += lanes) {
+				file_buf[j] = chip[(off + i)];
+			}
+		}
+	}
+
+	return (0);
+}
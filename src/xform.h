@@ -0,0 +1,58 @@
+#ifndef __XFORM_H
+#define __XFORM_H
+
+#include <sys/types.h>
+#include <inttypes.h>
+
+
+/* Image transforms between file and chip page, list applied in order
+ * from file to chip, reversed from chip to file:
+ * bswap16, bswap32 - swap bytes in 16/32 bit words;
+ * bitrev - reverse bits in each byte;
+ * lane:<n>:<i> - chip gets byte i of each n file bytes: odd/even half
+ * of 16 bit EPROM pair, one of interleaved chips. Only first in list;
+ * on read other lanes of file are kept, so several chips can be
+ * readed in to one interleaved file. */
+#define XFORM_OP_BSWAP16	0
+#define XFORM_OP_BSWAP32	1
+#define XFORM_OP_BITREV		2
+#define XFORM_OP_LANE		3
+#define XFORM_OP__COUNT__	4
+static const char *xform_op_str[] = {
+	"bswap16",
+	"bswap32",
+	"bitrev",
+	"lane",
+	NULL
+};
+
+#define XFORM_OPS_MAX		8
+#define XFORM_LANES_MAX		16
+
+typedef struct xform_op_s {
+	int		op;		/* XFORM_OP_*. */
+	size_t		lanes;
+	size_t		lane;
+} xform_op_t, *xform_op_p;
+
+typedef struct xform_s {
+	xform_op_t	ops[XFORM_OPS_MAX];
+	size_t		count;
+	size_t		ratio;		/* File bytes per chip byte. */
+	size_t		align;		/* Chip data size alignment. */
+} xform_t, *xform_p;
+
+
+int	xform_parse(const char *str, xform_p xf);
+
+/* File to chip, in place: size_ret = (buf_size / ratio) chip bytes at
+ * buf begin. */
+int	xform_to_chip(const xform_p xf, uint8_t *buf, size_t buf_size,
+	    size_t *size_ret);
+/* Chip to file: chip data transformed in place, with lane scattered to
+ * file_buf (size * ratio bytes, other lanes untouched), else result is
+ * in chip buf and file_buf not used. */
+int	xform_to_file(const xform_p xf, uint8_t *chip, size_t size,
+	    uint8_t *file_buf);
+
+#endif